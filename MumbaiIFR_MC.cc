@@ -9,190 +9,707 @@
 // variation in slum naive IFR after the first serosurvey
 // variation in nonslum naive IFR after the first serosurvey
 
-// Compile with g++ using "g++ -lm -std=gnu++11 MumbaiIFR_MC.cc -o MumbaiIFR_MC"
+// Compile with g++ using "g++ -O3 -lm -std=gnu++11 -pthread MumbaiIFR_MC.cc -o MumbaiIFR_MC"
+// Run with "./MumbaiIFR_MC [<output_prefix> [<param_file> ...]]"
+
+// Each parameter file describes one configuration of priors (see
+// params/MumbaiIFRparams for all the options and their default values). With
+// no parameter file, one configuration with the default values is run. All
+// configurations use the same random number streams (experiment e always
+// uses stream e), so differences between configurations are not swamped by
+// sampling noise. Options missing from a file take their default values.
+//
+// For configuration k, output goes to "<output_prefix>_k_log" (options
+// used and a summary), "<output_prefix>_k_hist" (histograms, as
+// percentages of the experiments), "<output_prefix>_k_quant" (mean, SD,
+// SE and quantiles of each derived quantity) and optionally
+// "<output_prefix>_k_exps". If there is only one configuration "_k" is
+// left out. The default output prefix is "Mumbai".
+
+// Experiments are evaluated in blocks of BLOCKSIZE, with the blocks shared out
+// between threads. Experiment number e takes its random numbers from stream e
+// of a counter-based generator (see cbrng.h), so the results for a given seed
+// do not depend on the number of threads. Each thread keeps its own
+// histograms, which are combined at the end. The sums and the quantile
+// estimators (t-digests, see tdigest.h) depend on the order in which values
+// are combined, so each block gets its own, and these are merged into the
+// totals in block order as the blocks finish.
+
+// The binary output file (option "binary_output 1") holds, for each
+// experiment in order, six doubles (native byte order): slumprevfinal,
+// nonslumprevfinal, totprevfinal, IFRfinal, slum naive IFR (2020), nonslum
+// naive IFR (2020).
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <thread>
+#include <mutex>
+#include <map>
+#include <vector>
+#include <random>
+#include "cbrng.h"
+#include "tdigest.h"
+
+#define BLOCKSIZE 256 // number of experiments evaluated together
+#define MAXSERIES 200 // maximum length of the fatality series
+#define MAXHIST 20 // maximum number of histograms
+#define MAXQUANT 20 // maximum number of quantiles reported
+#define MAXTRIES 1000 // attempts at a truncated normal before giving up
+
+// The variables which have priors
+#define NUMVARS 8
+#define V_SLUMPREV 0
+#define V_NONSLUMPREV 1
+#define V_DELAY 2
+#define V_FATALITIES 3
+#define V_POSTWAVE_SLUMFRAC 4
+#define V_P1_SLUMDEATHSFRAC 5
+#define V_SLUMIFR_MULT 6
+#define V_NONSLUMIFR_MULT 7
+const char *varnames[NUMVARS]={"slumprev", "nonslumprev", "delay", "fatalities", "postwave_slumfrac", "P1_slumdeathsfrac", "slumIFR_mult", "nonslumIFR_mult"};
+
+// The derived quantities (also the columns of the binary output)
+#define NUMQ 6
+const char *qnames[NUMQ]={"slumprevfinal", "nonslumprevfinal", "totprevfinal", "IFRfinal", "slumnaiveIFR", "nonslumnaiveIFR"};
+
+// Types of prior
+#define PRIOR_FIXED 0 // fixed value a
+#define PRIOR_UNIFORM 1 // uniform on [a,b]
+#define PRIOR_UNIFORMINT 2 // uniform on the integers a,...,b
+#define PRIOR_NORMAL 3 // normal with mean a and SD b, truncated to [lo,hi]
+#define PRIOR_BETA 4 // beta with shape parameters a and b, rescaled to [lo,hi]
+const char *priornames[5]={"fixed", "uniform", "uniformint", "normal", "beta"};
+
+struct prior{
+  int type;
+  double a, b, lo, hi;
+};
+
+// A histogram of quantity q with nbins equal bins on [lo,hi), plus one
+// bin for values below lo and one for values at or above hi
+struct histspec{
+  int q;
+  double lo, hi;
+  int nbins;
+};
+
+// One configuration (read only once threads start)
+struct mcconfig{
+  long numexp; // number of experiments
+  int numthreads;
+  uint64_t seed;
+  prior pr[NUMVARS];
+  double slum2011, nonslum2011, tot2011; // 2011 populations
+  double slum2020, nonslum2020, tot2020; // 2020 populations
+  int initf[MAXSERIES], finalf[MAXSERIES], numseries; // fatality series
+  int numhist;
+  histspec hist[MAXHIST];
+  int numquant;
+  double quant[MAXQUANT];
+  int outfd; // binary output (-1 if none)
+};
+
+// Sums and quantile estimators of one block, or of all the blocks
+struct mcblock{
+  tdigest td[NUMQ];
+  double sum[NUMQ], sumsq[NUMQ];
+};
+
+// Blocks finished but not yet merged, waiting for the blocks before them
+struct mcmerge{
+  std::mutex lock;
+  long next; // the next block to merge
+  std::map<long, mcblock> waiting;
+  mcblock all;
+};
+
+// Results from one thread
+struct mcthread{
+  const mcconfig *c;
+  int id, numthreads;
+  std::vector<long> histo[MAXHIST]; // nbins+2 entries each
+  mcmerge *mg;
+};
+
+int getline(FILE *fp, char s[], int lim)
+{
+  /* store a line as a string, including the terminal newline character */
+  int c=0, i;
+
+  for(i=0; i<lim-1 && (c=getc(fp))!=EOF && c!='\n';++i)
+    s[i] = c;
+  if (c == '\n') {
+    s[i] = c;
+    ++i;
+  }
+  s[i] = '\0';
+  return i;
+}
 
+int getnthblock(char *s, char *v, int len, int n){
+  // get the nth valid block (only spaces count as separators) from a string s and put it in v. Returns the next position in  s.
+  int i, j, k;
+  i=0, k=0;
+  if(len < 2){
+    fprintf(stderr, "ERROR in getnthblock in MumbaiIFR_MC.cc: third argument must be at least 2.\n");
+    return 0;
+  }
+  v[0] = '\0'; // in case we have an empty string, return an empty word.
+  while(s[k] != '\0'){
+    j=0;
+    while(isspace((int) s[k])) // skip space
+      k++;
+    for(i=0;i<n-1;i++){
+      while(s[k] != '\0' && !(isspace((int) s[k]))) // skip first word
+        k++;
+      while(isspace((int) s[k])) //skip space
+        k++;
+    }
+    while((j<len-1) && s[k] != '\0' && !(isspace((int) s[k]))){ // get the word
+      v[j++] = s[k++];
+    }
+    v[j++] = '\0';
+    if(j==len){
+      fprintf(stderr, "WARNING: in routine getnthblock in file MumbaiIFR_MC.cc: word is longer than maximum length.\n");
+    }
+    return k;
+  }
+  return 0;
+}
 
-#include <iostream>
-#include <random>
+// Lines can be long here (the fatality series)
+#define MAXLINE 2000
+
+// As in inf2.cc, except that fname==NULL means "no parameter file" (all defaults)
+int getoption(char *fname, const char optname[], int num, char v[], int max){
+  FILE *fd;
+  int len, j, flag=0;
+  char oneline[MAXLINE];
+  char modname[50];
+  v[0] = '\0';
+  if(!fname)
+    return -2;
+  if(!(fd=fopen(fname, "r"))){
+    fprintf(stderr, "FILE \"%s\" could not be opened for reading. EXITING.\n", fname);exit(0);
+  }
+  while((len = getline(fd, oneline, MAXLINE)) > 0){
+    j=0;
+    while((isspace((int) oneline[j])) || (oneline[j] == 13)){j++;}
+    if ((oneline[j] == '/') || (oneline[j] == '#') || (oneline[j] == '\n') || (oneline[j] == '\0')){} // comment/empty lines
+    else{
+      getnthblock(oneline, modname, 50, 1);
+      if(strcmp(modname, optname) == 0){
+        flag = 1;
+        getnthblock(oneline, modname, 50, num+1);
+        if((int)(strlen(modname)) < max-1)
+	  strcpy(v, modname);
+        else{
+	  fprintf(stderr, "ERROR in routine getoption: Option %s in file %s has value %s which is too long.\n", optname, fname, modname);
+	  v[0] = '\0';
+	  fclose(fd);
+	  return -1;
+        }
+        break;
+      }
+    }
+  }
+  fclose(fd);
+  if(flag==0){
+    fprintf(stderr, "WARNING in routine getoption: Option %s could not be found in file %s. Setting to default value.\n", optname, fname);
+    v[0] = '\0';
+    return -2;
+  }
+  return 0;
 
-// Real uniform distribution on [lend,rend] 
-double unif(double lend, double rend, std::default_random_engine & generator)
-{
-  static std::uniform_real_distribution<double> dist1;
-  return dist1(generator, std::uniform_real_distribution<double>::param_type(lend, rend));
 }
 
-// Integer uniform distribution on [lend,rend] 
-int unifi(int lend, int rend, std::default_random_engine & generator)
+// All lines starting with optname (for options which can be repeated)
+int getoptionlines(char *fname, const char optname[], char lines[][200], int maxlines){
+  FILE *fd;
+  int j, num=0;
+  char oneline[200];
+  char modname[50];
+  if(!fname)
+    return 0;
+  if(!(fd=fopen(fname, "r"))){
+    fprintf(stderr, "FILE \"%s\" could not be opened for reading. EXITING.\n", fname);exit(0);
+  }
+  while(getline(fd, oneline, 200) > 0){
+    j=0;
+    while((isspace((int) oneline[j])) || (oneline[j] == 13)){j++;}
+    if ((oneline[j] == '/') || (oneline[j] == '#') || (oneline[j] == '\n') || (oneline[j] == '\0')){} // comment/empty lines
+    else{
+      getnthblock(oneline, modname, 50, 1);
+      if(strcmp(modname, optname) == 0 && num<maxlines)
+	strcpy(lines[num++], oneline);
+    }
+  }
+  fclose(fd);
+  return num;
+}
+
+long getoptionl(char *fname, const char optname[], long defval, FILE *fd1){
+  char tempword[200];
+  long val;
+  if(getoption(fname, optname, 1, tempword, 200)!=0 || tempword[0]=='\0')
+    val=defval;
+  else
+    val=atol(tempword);
+  fprintf(fd1, "#%s %ld\n", optname, val);
+  return val;
+}
+
+double getoptionf(char *fname, const char optname[], double defval, FILE *fd1){
+  char tempword[200];
+  double val;
+  if(getoption(fname, optname, 1, tempword, 200)!=0 || tempword[0]=='\0')
+    val=defval;
+  else
+    val=atof(tempword);
+  fprintf(fd1, "#%s %.4f\n", optname, val);
+  return val;
+}
+
+// A prior, e.g. "slumprev uniform 0.45 0.62" or "slumprev beta 20 25 0.3 0.8"
+void getprior(char *fname, const char name[], prior *p, FILE *fd1){
+  char tempword[200];
+  int k;
+  if(getoption(fname, name, 1, tempword, 200)==0 && tempword[0]!='\0'){
+    for(k=0;k<5;k++){
+      if(strcmp(tempword, priornames[k])==0)
+	break;
+    }
+    if(k==5){
+      fprintf(stderr, "ERROR: unknown distribution \"%s\" for %s in file %s. EXITING.\n", tempword, name, fname);exit(0);
+    }
+    p->type=k;
+    if(p->type==PRIOR_NORMAL){p->lo=-HUGE_VAL;p->hi=HUGE_VAL;}
+    else if(p->type==PRIOR_BETA){p->lo=0.0;p->hi=1.0;}
+    getoption(fname, name, 2, tempword, 200);p->a=atof(tempword);
+    if(p->type!=PRIOR_FIXED){
+      getoption(fname, name, 3, tempword, 200);p->b=atof(tempword);
+    }
+    if(p->type==PRIOR_NORMAL || p->type==PRIOR_BETA){
+      if(getoption(fname, name, 4, tempword, 200)==0 && tempword[0]!='\0')
+	p->lo=atof(tempword);
+      if(getoption(fname, name, 5, tempword, 200)==0 && tempword[0]!='\0')
+	p->hi=atof(tempword);
+    }
+  }
+  fprintf(fd1, "#%s %s %.4f", name, priornames[p->type], p->a);
+  if(p->type!=PRIOR_FIXED)
+    fprintf(fd1, " %.4f", p->b);
+  if(p->type==PRIOR_NORMAL || p->type==PRIOR_BETA)
+    fprintf(fd1, " %.4f %.4f", p->lo, p->hi);
+  fprintf(fd1, "\n");
+}
+
+// A fatality series, e.g. "initf 5061 5129 5202 ..."
+int getseries(char *fname, const char name[], int series[], int numdef, FILE *fd1){
+  char tempword[200];
+  int num=0, i;
+  while(num<MAXSERIES && getoption(fname, name, num+1, tempword, 200)==0 && tempword[0]!='\0')
+    series[num++]=atoi(tempword);
+  if(num==0)
+    num=numdef;
+  fprintf(fd1, "#%s", name);
+  for(i=0;i<num;i++)
+    fprintf(fd1, " %d", series[i]);
+  fprintf(fd1, "\n");
+  return num;
+}
+
+//
+// Gamma distribution
+//
+
+double gamma(double shp, double scl, cbrng & generator)
 {
-  static std::uniform_int_distribution<int> dist1;
-  return dist1(generator, std::uniform_int_distribution<int>::param_type(lend, rend));
+  std::gamma_distribution<double> dist(shp, scl);
+  return dist(generator);
 }
 
-int main()
+//
+// normal distribution
+//
+
+double norml(double mean, double stdev, cbrng & generator)
 {
-  const int numexp=100000; // number of experiments
-  int totsteps=0;
-  // delay between prevalence & fatality estimate in IFR calculations
-  int delay; 
-  int delaymin=0, delaymax=27; // min and max values of "delay"
-  double slumprev; // slum prior infection at the time of the 1st survey
-  double slumprevmin=0.45, slumprevmax=0.62; // min and max values of "slumprev"
-  double nonslumprev; // nonslum prior infection at the time of the 1st survey
-  double nonslumprevmin=0.12, nonslumprevmax=0.2; // min and max values of "nonslumprev"
-  int fatalities; // Estimated COVID-19 fatalities during 2020
-  int fatalitiesmin=11000, fatalitiesmax=25000; // min and max values of "fatalities"
-  // 2011 slum, nonslum and total populations in the city
-  // from https://portal.mcgm.gov.in/irj/go/km/docs/documents/MCGM%20Department%20List/Public%20Health%20Department/Docs/Census%20FAQ%20%26%20Answer.pdf
-  double slum2011=6534460, nonslum2011=5907913, tot2011=12442373;
-  // 2020 slum, nonslum and total populations in the city
-  // total from https://portal.mcgm.gov.in/irj/portal/anonymous/qlvitalstatsreport?guest\_user=english
-  // slum and nonslum fractions assumed to be as in 2011
-  double slum2020, nonslum2020, tot2020=12875213;
-  // The fraction of reported COVID-19 fatalities after the second serosurvey but during 2020 which occurred in the slums
-  double postwave_slumfrac;
-  // min and max values of "postwave_slumfrac"
-  double postwave_slumfracmin=0.05, postwave_slumfracmax=0.35;
-  // fraction of recorded fatalities in the slums during Period 1, and variation in this (0.05=5%)
-  // Assumes 52\% of recorded fatalities came from the slums by the time of the serosurvey
-  // The 52% value is based on prevalence & naive IFR estimates in Malani et al
-  // A. Malani, D. Shah, G. Kang et al. Seroprevalence of SARS-CoV-2 in slums versus non-slums 
-  // in Mumbai, India. The Lancet Global Health, 9(2):e110–111, 2021
-  // i.e., (0.541*slum2020*0.00076)/(0.541*slum2020*0.00076+0.016*nonslum2020*0.00263) ~ 0.52
-  double P1_slumdeathsfrac, P1_slumdeathsfrac_mid=0.52, P1_slumdeathsfrac_var=0.05;
-  // total post-serosurvey deaths in 2020 (with delay taken into account)
-  int newdeaths;
-  // slum and nonslum naive IFR values inferred from 1st serosurvey data
-  double slumIFRmid, nonslumIFRmid;
-  // slum and nonslum naive IFR values post first serosurvey
-  double slumIFR, nonslumIFR;
-  // Variation allowed in "slumIFR" and "nonslumIFR" relative to "slumIFRmid" and "nonslumIFRmid"
-  // (0.1 = 10%)
-  double slumIFRvar=0.1, nonslumIFRvar=0.1;
-  // (sero)prevalence in the slums, nonslums and city as a whole by the end of 2020
-  double slumprevfinal, nonslumprevfinal, totprevfinal;
-  // IFR for the city as a whole during 2020
-  // (not divided into slum and nonslum IFR as we have no idea how undercounting varies between slums and nonslums)
-  double slumIFRfinal, nonslumIFRfinal, IFRfinal;
-  // csv file with data from experiments
-  FILE *fd=fopen("MumbaiIFRtmp.csv", "w");
-  FILE *fd1=fopen("Mumbaiprevhist.csv", "w");//for histograms
-  FILE *fd2=fopen("MumbaiIFRhist.csv", "w");//for histograms
-
-  int i,c;
-
-  // data for histograms on seroprevalence and IFR
-  int histoprev[20], histoIFR[20];
-
-  std::default_random_engine generator;
+  std::normal_distribution<double> dist(mean, stdev);
+  return dist(generator);
+}
 
-  // For random seeding
-  int timeint;
-  time_t timepoint;
+double sampleprior(const prior *p, cbrng & generator){
+  double x, y;
+  int k;
+  switch(p->type){
+  case PRIOR_UNIFORM:
+    return p->a+(p->b-p->a)*generator.u01();
+  case PRIOR_UNIFORMINT:
+    return p->a+floor(generator.u01()*(p->b-p->a+1.0));
+  case PRIOR_NORMAL:
+    for(k=0;k<MAXTRIES;k++){
+      x=norml(p->a, p->b, generator);
+      if(x>=p->lo && x<=p->hi)
+	return x;
+    }
+    return x<p->lo?p->lo:p->hi;
+  case PRIOR_BETA:
+    x=gamma(p->a, 1.0, generator);
+    y=gamma(p->b, 1.0, generator);
+    return p->lo+(p->hi-p->lo)*x/(x+y);
+  default:
+    return p->a;
+  }
+}
 
+// Read one configuration. fname==NULL gives the defaults.
+void readconfig(char *fname, mcconfig *c, uint64_t defseed, FILE *fd1){
+  char hlines[MAXHIST][200];
+  char tempword[200];
+  int i, k, n;
   //recorded fatalities 0 to 27 days after July 8 2020, according to MCGM bulletins
-  int initf[28]={5061,5129,5202,5241,5285,5332,5402,5464,5520,5582,5647,5711,5752,5814,5872,5927,5981,6033,6090,6129,6184,6244,6297,6350,6395,6444,6490,6546};
+  static const int initf[28]={5061,5129,5202,5241,5285,5332,5402,5464,5520,5582,5647,5711,5752,5814,5872,5927,5981,6033,6090,6129,6184,6244,6297,6350,6395,6444,6490,6546};
   //recorded fatalities 0 to 27 days after Jan 1 2020, according to MCGM bulletins
-  int finalf[28]={11125,11132,11135,11138,11147,11155,11162,11171,11180,11186,11195,11202,11210,11219,11227,11235,11242,11249,11257,11266,11276,11285,11293,11300,11307,11313,11319,11326};
+  static const int finalf[28]={11125,11132,11135,11138,11147,11155,11162,11171,11180,11186,11195,11202,11210,11219,11227,11235,11242,11249,11257,11266,11276,11285,11293,11300,11307,11313,11319,11326};
+  // default priors
+  // slum prior infection at the time of the 1st survey
+  prior defpr[NUMVARS]={{PRIOR_UNIFORM, 0.45, 0.62, 0, 0},
+			// nonslum prior infection at the time of the 1st survey
+			{PRIOR_UNIFORM, 0.12, 0.2, 0, 0},
+			// delay between prevalence & fatality estimate in IFR calculations (days)
+			{PRIOR_UNIFORMINT, 0, 27, 0, 0},
+			// Estimated COVID-19 fatalities during 2020
+			{PRIOR_UNIFORMINT, 11000, 25000, 0, 0},
+			// The fraction of reported COVID-19 fatalities after the second serosurvey but during 2020 which occurred in the slums
+			{PRIOR_UNIFORM, 0.05, 0.35, 0, 0},
+			// fraction of recorded fatalities in the slums during Period 1 (52% +/- 5%)
+			// The 52% value is based on prevalence & naive IFR estimates in Malani et al
+			// A. Malani, D. Shah, G. Kang et al. Seroprevalence of SARS-CoV-2 in slums versus non-slums
+			// in Mumbai, India. The Lancet Global Health, 9(2):e110–111, 2021
+			// i.e., (0.541*slum2020*0.00076)/(0.541*slum2020*0.00076+0.016*nonslum2020*0.00263) ~ 0.52
+			{PRIOR_UNIFORM, 0.95*0.52, 1.05*0.52, 0, 0},
+			// slum and nonslum naive IFR post survey relative to the values inferred from the 1st survey (+/- 10%)
+			{PRIOR_UNIFORM, 0.9, 1.1, 0, 0},
+			{PRIOR_UNIFORM, 0.9, 1.1, 0, 0}};
+
+  c->numexp=getoptionl(fname, "numexp", 100000, fd1);// number of experiments
+  if(c->numexp<1){
+    fprintf(stderr, "ERROR: numexp must be at least 1 (it is %ld). EXITING.\n", c->numexp);exit(0);
+  }
+  c->numthreads=(int)getoptionl(fname, "threads", (long)std::thread::hardware_concurrency(), fd1);
+  if(c->numthreads<1)
+    c->numthreads=1;
+  c->seed=(uint64_t)getoptionl(fname, "seed", (long)defseed, fd1);// same streams for all configurations by default
+
+  for(i=0;i<NUMVARS;i++){
+    c->pr[i]=defpr[i];
+    getprior(fname, varnames[i], &(c->pr[i]), fd1);
+  }
 
-  // Random seeding
-  timeint = time(&timepoint); 
-  srand(timeint);
-  generator.seed(timeint);
-
-  // initialise the histograms
-  for(i=0;i<20;i++){
-    histoprev[i]=0;histoIFR[i]=0;
-  }
-
-  //2020 slum and nonslum populations inferred from 2011 data
-  slum2020=slum2011/tot2011*tot2020;
-  nonslum2020=nonslum2011/tot2011*tot2020;
-
-  // Header in csv file
-  fprintf(fd, "slumprevfinal, nonslumprevfinal, totprevfinal, IFRfinal, slum naive (2020), nonslum naive (2020)\n");
-
-  // Run "numexps" experiments
-  for(totsteps=0;totsteps<numexp;totsteps++){
-    //choose slum seroprevalence from uniform distribution
-    slumprev=unif(slumprevmin, slumprevmax, generator);
-    //choose nonslum seroprevalence from uniform distribution
-    nonslumprev=unif(nonslumprevmin, nonslumprevmax, generator);
-    //choose delay from uniform distribution
-    delay=unifi(delaymin, delaymax, generator);
-    //choose fatalities from uniform distribution
-    fatalities=unifi(fatalitiesmin, fatalitiesmax, generator);
-    //choose fraction of postwave slum deaths from uniform distribution
-    postwave_slumfrac=unif(postwave_slumfracmin, postwave_slumfracmax, generator);
-    //choose fraction of recorded Period 1 deaths from the slums
-    P1_slumdeathsfrac=unif((1.0-P1_slumdeathsfrac_var)*P1_slumdeathsfrac_mid, (1.0+P1_slumdeathsfrac_var)*P1_slumdeathsfrac_mid, generator);
+  // 2011 slum, nonslum and total populations in the city
+  // from https://portal.mcgm.gov.in/irj/go/km/docs/documents/MCGM%20Department%20List/Public%20Health%20Department/Docs/Census%20FAQ%20%26%20Answer.pdf
+  c->slum2011=getoptionf(fname, "slum2011", 6534460, fd1);
+  c->nonslum2011=getoptionf(fname, "nonslum2011", 5907913, fd1);
+  c->tot2011=getoptionf(fname, "tot2011", 12442373, fd1);
+  // 2020 total population in the city
+  // from https://portal.mcgm.gov.in/irj/portal/anonymous/qlvitalstatsreport?guest\_user=english
+  c->tot2020=getoptionf(fname, "tot2020", 12875213, fd1);
+  //2020 slum and nonslum populations inferred from 2011 data (fractions assumed to be as in 2011)
+  c->slum2020=c->slum2011/c->tot2011*c->tot2020;
+  c->nonslum2020=c->nonslum2011/c->tot2011*c->tot2020;
+
+  // recorded fatalities "delay" days after the first survey, and after the end of 2020
+  for(i=0;i<28;i++){
+    c->initf[i]=initf[i];c->finalf[i]=finalf[i];
+  }
+  n=getseries(fname, "initf", c->initf, 28, fd1);
+  c->numseries=getseries(fname, "finalf", c->finalf, 28, fd1);
+  if(n!=c->numseries){
+    fprintf(stderr, "ERROR: the fatality series initf and finalf have different lengths (%d and %d). EXITING.\n", n, c->numseries);exit(0);
+  }
+  if(c->pr[V_DELAY].type!=PRIOR_FIXED && (c->pr[V_DELAY].a<0 || c->pr[V_DELAY].b>c->numseries-1))
+    fprintf(stderr, "WARNING: the prior on delay goes outside the fatality series (0 to %d days). Values will be clamped.\n", c->numseries-1);
+
+  // histograms, e.g. "hist IFRfinal 0.12 0.4 14"
+  n=getoptionlines(fname, "hist", hlines, MAXHIST);
+  c->numhist=0;
+  for(i=0;i<n;i++){
+    getnthblock(hlines[i], tempword, 50, 2);
+    for(k=0;k<NUMQ;k++){
+      if(strcmp(tempword, qnames[k])==0)
+	break;
+    }
+    if(k==NUMQ){
+      fprintf(stderr, "WARNING: histogram of unknown quantity \"%s\" ignored.\n", tempword);
+      continue;
+    }
+    c->hist[c->numhist].q=k;
+    getnthblock(hlines[i], tempword, 50, 3);c->hist[c->numhist].lo=atof(tempword);
+    getnthblock(hlines[i], tempword, 50, 4);c->hist[c->numhist].hi=atof(tempword);
+    getnthblock(hlines[i], tempword, 50, 5);c->hist[c->numhist].nbins=atoi(tempword);
+    if(c->hist[c->numhist].nbins<1 || !(c->hist[c->numhist].hi>c->hist[c->numhist].lo)){
+      fprintf(stderr, "WARNING: histogram of %s with invalid range or number of bins ignored.\n", qnames[k]);
+      continue;
+    }
+    c->numhist++;
+  }
+  if(c->numhist==0){//the histograms of earlier versions (2% bins)
+    c->hist[0].q=2;c->hist[0].lo=48;c->hist[0].hi=76;c->hist[0].nbins=14;
+    c->hist[1].q=3;c->hist[1].lo=0.12;c->hist[1].hi=0.40;c->hist[1].nbins=14;
+    c->numhist=2;
+  }
+  for(i=0;i<c->numhist;i++)
+    fprintf(fd1, "#hist %s %.4f %.4f %d\n", qnames[c->hist[i].q], c->hist[i].lo, c->hist[i].hi, c->hist[i].nbins);
+
+  // quantiles to report, e.g. "quantiles 0.025 0.5 0.975"
+  c->numquant=0;
+  while(c->numquant<MAXQUANT && getoption(fname, "quantiles", c->numquant+1, tempword, 200)==0 && tempword[0]!='\0')
+    c->quant[c->numquant++]=atof(tempword);
+  if(c->numquant==0){
+    c->quant[0]=0.025;c->quant[1]=0.25;c->quant[2]=0.5;c->quant[3]=0.75;c->quant[4]=0.975;
+    c->numquant=5;
+  }
+  fprintf(fd1, "#quantiles");
+  for(i=0;i<c->numquant;i++)
+    fprintf(fd1, " %.4f", c->quant[i]);
+  fprintf(fd1, "\n");
+}
 
+// Run the experiments firstexp to firstexp+num-1
+void runblock(const mcconfig *c, long firstexp, int num, mcthread *t, mcblock *bk){
+  double v[NUMVARS][BLOCKSIZE];
+  double out[NUMQ][BLOCKSIZE];
+  double initfd[BLOCKSIZE];
+  double slumIFRmid, nonslumIFRmid, slumIFR, nonslumIFR;
+  double outbuf[NUMQ*BLOCKSIZE];
+  double x, slum2020=c->slum2020, nonslum2020=c->nonslum2020, tot2020=c->tot2020;
+  int delay;
+  int b, k, h, bin;
+  // total fatalities post survey ("Period 2"), as in earlier versions measured from the start of the series
+  double newdeaths=c->finalf[0]-c->initf[0];
+  cbrng g;
+
+  // the sampled variables: experiment e uses stream e
+  for(b=0;b<num;b++){
+    g.seed(c->seed, firstexp+b);
+    for(k=0;k<NUMVARS;k++)
+      v[k][b]=sampleprior(&(c->pr[k]), g);
+    delay=(int)v[V_DELAY][b];
+    if(delay<0)
+      delay=0;
+    else if(delay>=c->numseries)
+      delay=c->numseries-1;
+    initfd[b]=c->initf[delay];
+  }
 
+  // The IFR and prevalence formulas. No branches, so the compiler can vectorise.
+  for(b=0;b<num;b++){
     // Estimated naive IFR in slums and nonslums at the time of the survey
     // Depends on estimated seroprevalences and the delay
-    slumIFRmid=P1_slumdeathsfrac*initf[delay]/(slumprev*slum2020 + P1_slumdeathsfrac*initf[delay]);
-    nonslumIFRmid=(1-P1_slumdeathsfrac)*initf[delay]/(nonslumprev*nonslum2020 + (1-P1_slumdeathsfrac)*initf[delay]);
-    //fprintf(stderr, "slumIFRmid=%.5f, nonslumIFRmid=%.5f\n", slumIFRmid, nonslumIFRmid);
-
-    // choose slum naive IFR post survey
-    slumIFR=unif((1.0-slumIFRvar)*slumIFRmid, (1.0+slumIFRvar)*slumIFRmid, generator);
+    slumIFRmid=v[V_P1_SLUMDEATHSFRAC][b]*initfd[b]/(v[V_SLUMPREV][b]*slum2020 + v[V_P1_SLUMDEATHSFRAC][b]*initfd[b]);
+    nonslumIFRmid=(1-v[V_P1_SLUMDEATHSFRAC][b])*initfd[b]/(v[V_NONSLUMPREV][b]*nonslum2020 + (1-v[V_P1_SLUMDEATHSFRAC][b])*initfd[b]);
 
-    // choose nonslum naive IFR post survey
-    nonslumIFR=unif((1.0-nonslumIFRvar)*nonslumIFRmid, (1.0+nonslumIFRvar)*nonslumIFRmid, generator);
-
-    // total fatalities post survey ("Period 2")
-    newdeaths=finalf[delaymin]-initf[delaymin];
+    // slum and nonslum naive IFR post survey
+    slumIFR=v[V_SLUMIFR_MULT][b]*slumIFRmid;
+    nonslumIFR=v[V_NONSLUMIFR_MULT][b]*nonslumIFRmid;
 
     // slum, nonslum, and city-wide prevalence by the end of 2020 (%)
     // final prevalence = Period 1 prevalence + added infections
-    slumprevfinal=(slumprev*slum2020 + postwave_slumfrac*newdeaths/slumIFR)/slum2020*100.0;
-    nonslumprevfinal=(nonslumprev*nonslum2020 + (1-postwave_slumfrac)*newdeaths/nonslumIFR)/nonslum2020*100.0;
-    totprevfinal=(slumprev*slum2020+nonslumprev*nonslum2020+(1.0-postwave_slumfrac)*newdeaths/nonslumIFR+postwave_slumfrac*newdeaths/slumIFR)/tot2020*100.0;
+    out[0][b]=(v[V_SLUMPREV][b]*slum2020 + v[V_POSTWAVE_SLUMFRAC][b]*newdeaths/slumIFR)/slum2020*100.0;
+    out[1][b]=(v[V_NONSLUMPREV][b]*nonslum2020 + (1-v[V_POSTWAVE_SLUMFRAC][b])*newdeaths/nonslumIFR)/nonslum2020*100.0;
+    out[2][b]=(v[V_SLUMPREV][b]*slum2020+v[V_NONSLUMPREV][b]*nonslum2020+(1.0-v[V_POSTWAVE_SLUMFRAC][b])*newdeaths/nonslumIFR+v[V_POSTWAVE_SLUMFRAC][b]*newdeaths/slumIFR)/tot2020*100.0;
 
     // IFR at the end of 2020 (%) ["fatalities" in the denominator
     // makes a marginal difference but added for completeness]
-    IFRfinal=fatalities/(totprevfinal*tot2020/100.0 + fatalities)*100.0;
+    out[3][b]=v[V_FATALITIES][b]/(out[2][b]*tot2020/100.0 + v[V_FATALITIES][b])*100.0;
+
+    // slum and nonslum naive IFR (2020), per 10000
+    out[4][b]=(v[V_P1_SLUMDEATHSFRAC][b]*initfd[b] + v[V_POSTWAVE_SLUMFRAC][b]*newdeaths)/out[0][b]*10000.0/slum2020;
+    out[5][b]=((1-v[V_P1_SLUMDEATHSFRAC][b])*initfd[b] + (1-v[V_POSTWAVE_SLUMFRAC][b])*newdeaths)/out[1][b]*10000.0/nonslum2020;
+  }
 
-    // print
-    fprintf(fd, "%.4e, %.4e, %.4e, %.4e, %.4e, %.4e\n", slumprevfinal, nonslumprevfinal, totprevfinal, IFRfinal, (P1_slumdeathsfrac*initf[delay] + postwave_slumfrac*newdeaths)/slumprevfinal*10000.0/slum2020, ((1-P1_slumdeathsfrac)*initf[delay] + (1-postwave_slumfrac)*newdeaths)/nonslumprevfinal*10000.0/nonslum2020);
+  for(k=0;k<NUMQ;k++){
+    for(b=0;b<num;b++){
+      bk->sum[k]+=out[k][b];bk->sumsq[k]+=out[k][b]*out[k][b];
+      bk->td[k].add(out[k][b]);
+    }
+  }
 
-    //The histograms
-    c=int((totprevfinal - 46.0)/2.0);
-    if(c>0 && c<=14)
-      histoprev[c]++;
-    else if(c<=0)
-      histoprev[0]++;
-    else if(c>14)
-      histoprev[15]++;
+  //The histograms
+  for(h=0;h<c->numhist;h++){
+    for(b=0;b<num;b++){
+      x=out[c->hist[h].q][b];
+      if(x!=x)//NaN
+	continue;
+      if(x<c->hist[h].lo)
+	bin=0;
+      else if(x>=c->hist[h].hi)
+	bin=c->hist[h].nbins+1;
+      else{
+	bin=1+(int)((x-c->hist[h].lo)/(c->hist[h].hi-c->hist[h].lo)*c->hist[h].nbins);
+	if(bin>c->hist[h].nbins)
+	  bin=c->hist[h].nbins;
+      }
+      t->histo[h][bin]++;
+    }
+  }
 
-    c=int((100.0*IFRfinal - 10.0)/2.0);
-    if(c>0 && c<=14)
-      histoIFR[c]++;
-    else if(c<=0)
-      histoIFR[0]++;
-    else if(c>14)
-      histoIFR[15]++;
+  if(c->outfd>=0){//binary output: each block goes in its own place in the file
+    for(b=0;b<num;b++){
+      for(k=0;k<NUMQ;k++)
+	outbuf[NUMQ*b+k]=out[k][b];
+    }
+    if(pwrite(c->outfd, outbuf, (size_t)num*NUMQ*sizeof(double), (off_t)firstexp*NUMQ*sizeof(double))!=(ssize_t)(num*NUMQ*sizeof(double)))
+      fprintf(stderr, "WARNING: failed to write experiments %ld to %ld to the binary output file.\n", firstexp, firstexp+num-1);
+  }
+}
 
+// Merge block bl, and any blocks after it that were waiting for it
+void mergeblock(mcmerge *mg, long bl, mcblock &bk){
+  std::lock_guard<std::mutex> guard(mg->lock);
+  int k;
+  mg->waiting[bl]=std::move(bk);
+  while(!mg->waiting.empty() && mg->waiting.begin()->first==mg->next){
+    mcblock &b=mg->waiting.begin()->second;
+    for(k=0;k<NUMQ;k++){
+      mg->all.td[k].merge(b.td[k]);
+      mg->all.sum[k]+=b.sum[k];mg->all.sumsq[k]+=b.sumsq[k];
+    }
+    mg->waiting.erase(mg->waiting.begin());
+    mg->next++;
   }
-  fprintf(fd, "\n");
+}
 
-  // print out the histograms
-  fprintf(fd1, "<=48,%.1f\n",(double)(histoprev[0])/numexp*100.0);
-  for(i=1;i<14;i++){
-    fprintf(fd1, "%d-%d,%.1f\n", 2*i+46, 2*i+48,(double)(histoprev[i])/numexp*100.0);
+// Thread t takes blocks t, t+numthreads, t+2*numthreads, ...
+void runthread(mcthread *t){
+  const mcconfig *c=t->c;
+  long numblocks=(c->numexp+BLOCKSIZE-1)/BLOCKSIZE;
+  long bl, first;
+  for(bl=t->id;bl<numblocks;bl+=t->numthreads){
+    mcblock bk=mcblock();
+    first=bl*BLOCKSIZE;
+    runblock(c, first, (int)(c->numexp-first<BLOCKSIZE?c->numexp-first:BLOCKSIZE), t, &bk);
+    mergeblock(t->mg, bl, bk);
   }
-  fprintf(fd1, ">74,%.1f\n", (double)(histoprev[15])/numexp*100.0);
+}
 
-  fprintf(fd1, "\n");
+// Run all the experiments of one configuration and write out the results
+void runconfig(mcconfig *c, const char outpfx[], FILE *fd){
+  char fname[300];
+  FILE *fd1, *fd2;
+  std::vector<mcthread> th;
+  std::vector<std::thread> workers;
+  std::vector<long> histo;
+  mcmerge mg;
+  double mean, SD;
+  int t, h, i, k;
+
+  mg.next=0;mg.all=mcblock();
+  th.resize(c->numthreads);
+  for(t=0;t<c->numthreads;t++){
+    th[t].c=c;th[t].id=t;th[t].numthreads=c->numthreads;th[t].mg=&mg;
+    for(h=0;h<c->numhist;h++)
+      th[t].histo[h].assign(c->hist[h].nbins+2, 0);
+  }
+  for(t=1;t<c->numthreads;t++)
+    workers.push_back(std::thread(runthread, &th[t]));
+  runthread(&th[0]);
+  for(t=0;t<(int)workers.size();t++)
+    workers[t].join();
+
+  // the histograms (percentages of all experiments)
+  snprintf(fname, sizeof(fname), "%s_hist", outpfx);
+  if(!(fd1=fopen(fname, "w"))){
+    fprintf(stderr, "FILE \"%s\" could not be opened for writing. EXITING.\n", fname);exit(0);
+  }
+  for(h=0;h<c->numhist;h++){
+    histo.assign(c->hist[h].nbins+2, 0);
+    for(t=0;t<c->numthreads;t++){
+      for(i=0;i<c->hist[h].nbins+2;i++)
+	histo[i]+=th[t].histo[h][i];
+    }
+    fprintf(fd1, "#%s\n", qnames[c->hist[h].q]);
+    fprintf(fd1, "<%g,%.1f\n", c->hist[h].lo, (double)(histo[0])/c->numexp*100.0);
+    for(i=1;i<=c->hist[h].nbins;i++)
+      fprintf(fd1, "%g-%g,%.1f\n", c->hist[h].lo+(c->hist[h].hi-c->hist[h].lo)*(i-1)/c->hist[h].nbins, c->hist[h].lo+(c->hist[h].hi-c->hist[h].lo)*i/c->hist[h].nbins, (double)(histo[i])/c->numexp*100.0);
+    fprintf(fd1, ">=%g,%.1f\n", c->hist[h].hi, (double)(histo[c->hist[h].nbins+1])/c->numexp*100.0);
+    fprintf(fd1, "\n");
+  }
+  fclose(fd1);
 
-  fprintf(fd2, "<=0.12,%.1f\n",(double)(histoIFR[0])/numexp*100.0);
-  for(i=1;i<14;i++){
-    fprintf(fd2, "%.2f-%.2f,%.1f\n", (double)(2*i+10)/100.0, (double)(2*i+12)/100.0,(double)(histoIFR[i])/numexp*100.0);
+  // the quantiles
+  snprintf(fname, sizeof(fname), "%s_quant", outpfx);
+  if(!(fd2=fopen(fname, "w"))){
+    fprintf(stderr, "FILE \"%s\" could not be opened for writing. EXITING.\n", fname);exit(0);
+  }
+  fprintf(fd2, "quantity\tmean\tSD\tSE");
+  for(i=0;i<c->numquant;i++)
+    fprintf(fd2, "\tq%g", c->quant[i]);
+  fprintf(fd2, "\n");
+  for(k=0;k<NUMQ;k++){
+    tdigest &td=mg.all.td[k];
+    mean=mg.all.sum[k]/c->numexp;SD=mg.all.sumsq[k];
+    SD=c->numexp>1?sqrt(fmax(0.0, (SD-c->numexp*mean*mean)/(c->numexp-1.0))):0.0;
+    fprintf(fd2, "%s\t%.6g\t%.6g\t%.6g", qnames[k], mean, SD, SD/sqrt((double)c->numexp));
+    for(i=0;i<c->numquant;i++)
+      fprintf(fd2, "\t%.6g", td.quantile(c->quant[i]));
+    fprintf(fd2, "\n");
+    if(k==3)
+      fprintf(fd, "IFRfinal: mean=%.6f, SE of mean=%.6f, median=%.6f\n", mean, SD/sqrt((double)c->numexp), td.quantile(0.5));
   }
-  fprintf(fd2, ">0.38,%.1f\n", (double)(histoIFR[15])/numexp*100.0);
+  fclose(fd2);
+}
 
+int main(int argc, char *argv[])
+{
+  const char *outprefix="Mumbai";
+  char outpfx[300], fname[320];
+  int numconfigs, k;
+  mcconfig c;
+  FILE *fd;
 
-  fclose(fd);fclose(fd1);fclose(fd2);
+  // For random seeding
+  int timeint;
+  time_t timepoint;
+
+  if(argc>=2)
+    outprefix=argv[1];
+  numconfigs=argc>=3?argc-2:1;
+
+  // Random seeding
+  timeint = time(&timepoint);
+
+  for(k=0;k<numconfigs;k++){
+    if(numconfigs>1)
+      snprintf(outpfx, sizeof(outpfx), "%s_%d", outprefix, k+1);
+    else
+      snprintf(outpfx, sizeof(outpfx), "%s", outprefix);
+    snprintf(fname, sizeof(fname), "%s_log", outpfx);
+    if(!(fd=fopen(fname, "w"))){
+      fprintf(stderr, "FILE \"%s\" could not be opened for writing. EXITING.\n", fname);exit(0);
+    }
+    readconfig(argc>=3?argv[k+2]:NULL, &c, (uint64_t)timeint, fd);
+    c.outfd=-1;
+    if(getoption(argc>=3?argv[k+2]:NULL, "binary_output", 1, fname, 200)==0 && atoi(fname)){
+      snprintf(fname, sizeof(fname), "%s_exps", outpfx);
+      if((c.outfd=open(fname, O_WRONLY|O_CREAT|O_TRUNC, 0644))<0){
+	fprintf(stderr, "FILE \"%s\" could not be opened for writing. EXITING.\n", fname);exit(0);
+      }
+    }
+    fprintf(stderr, "configuration %d: %ld experiments on %d threads\n", k+1, c.numexp, c.numthreads);
+    runconfig(&c, outpfx, fd);
+    fclose(fd);
+    if(c.outfd>=0)
+      close(c.outfd);
+  }
 
   return 0;
 }
@@ -27,6 +27,7 @@
 
 #include <limits>
 #include "TownVillage.h"
+#include "../gamstats.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
@@ -634,12 +635,14 @@ int intdecay(int max, int min, double halftime, int t){
 
 int main(int argc, char *argv[]){
   //for random seeding
-  int timeint;
+  int timeint, seed;
   time_t timepoint;
-  int i, ii, tmpi, j, m, r, cur, num_runs;//number of runs
+  int i, ii, k, tmpi, j, m, r, cur, num_runs;//number of runs
   double R0_town, R0_village, R0_townvillage;
   int flag;
   double trueR0_town,trueR0_village,actualR0;
+  gamstats st_town, st_village;//exact statistics of the number to infect
+  char dist_cache[200];//file keeping trueR0 values between launches
   int totdays;//total simulation length
   inf **infs=infar(0, MAXINFS-1);
   int init_infs;
@@ -720,6 +723,10 @@ int main(int argc, char *argv[]){
 
   // The level of herd immunity in each compartment: depends on effective rather than total populations
   double herdlevel_town=0, *herdlevel_village, hv;
+  // ... recomputed only for compartments whose numbers have changed (all of
+  // them at the start of a day, when effective populations may change)
+  int herdstale_all, herdstale_town, *herdstale_list, numherdstale;
+  char *herdstale_village;
   char paramfilename[200], outfilename[200], logfname[204];
   FILE *fd0, *fd1, *fd2, *fd3; //files to store output
   //FILE *fd3;
@@ -766,6 +773,7 @@ int main(int argc, char *argv[]){
 
   //options: general
   num_runs=getoptioni(paramfilename, "number_of_runs", 10, fd1);//model runs
+  seed=getoptioni(paramfilename, "seed", 0, fd1);//random seed (0: from the clock)
   numvillages=getoptioni(paramfilename, "numvillages", 100, fd1);//number of villages
   townprop=getoptionf(paramfilename, "townprop", 0.5, fd1);//fraction of total pop in town
   dthrate_town=getoptionf(paramfilename, "death_rate_town", 0.5, fd1);//death rate
@@ -774,6 +782,8 @@ int main(int argc, char *argv[]){
   R0_village=getoptionf(paramfilename, "R0_village", 2.8, fd1);//basic reproduction number village (approximately)
   R0_townvillage=getoptionf(paramfilename, "R0_townvillage", 0.8, fd1);
   infshp=getoptionf(paramfilename, "infshp", 0.1, fd1);//shape param
+  if(getoption(paramfilename, "dist_cache_file", 1, dist_cache, 200)!=0)//table of trueR0 values ("none": no table)
+    strcpy(dist_cache, "distcache");
   totdays=getoptioni(paramfilename, "totdays", 150, fd1);//total simulation length
   totpop=getoptionf(paramfilename, "population", 13000000, fd1);//population
 
@@ -868,6 +878,9 @@ int main(int argc, char *argv[]){
   totpop_village=(double *) malloc((size_t)(numvillages*sizeof(double)));
   effpop_village=(double *) malloc((size_t)(numvillages*sizeof(double)));
   herdlevel_village=(double *) malloc((size_t)(numvillages*sizeof(double)));
+  herdstale_village=(char *) calloc((size_t)numvillages, sizeof(char));
+  herdstale_list=(int *) malloc((size_t)(numvillages*sizeof(int)));
+  numherdstale=0;herdstale_town=0;herdstale_all=1;
   town_IR=(double *) malloc((size_t)(num_runs*sizeof(double)));
   village_IR=(double *) malloc((size_t)(num_runs*sizeof(double)));
   IR=(double *) malloc((size_t)(num_runs*sizeof(double)));
@@ -895,16 +908,14 @@ int main(int argc, char *argv[]){
   percdeath_village=dthrate_village*100.0/percill;
 
   //random seeding
-  timeint = time(&timepoint); /*convert time to an integer */
+  timeint = seed?seed:time(&timepoint); /*convert time to an integer */
   srand(timeint);
   generator.seed(timeint);//seeding for distribution generator
 
-  trueR0_town=0;trueR0_village=0;
-
-  for(i=0;i<1000000;i++){
-    trueR0_town+=round(gamma(infshp, infscl_town, generator))/1000000.0;
-    trueR0_village+=round(gamma(infshp, infscl_village, generator))/1000000.0;
-  }
+  //exact, from the gamma distribution (see gamstats.h)
+  cachedgammastats(dist_cache, R0_town, infshp, MAXDISCPROB-1, &st_town);
+  cachedgammastats(dist_cache, R0_village, infshp, MAXDISCPROB-1, &st_village);
+  trueR0_town=st_town.mean;trueR0_village=st_village.mean;
   fprintf(fd0, "trueR0_town=%.4f, trueR0_village=%.4f\n", trueR0_town, trueR0_village);
   fprintf(fd0, "run\tsteps\tactualR0\tavdthtime\tavrecovtime\tavtesttime\tavserotime\ttown_IR\tvillage_IR\tIR\n");
 
@@ -1043,6 +1054,7 @@ int main(int argc, char *argv[]){
       if(pd){
 	fprintf(stderr, "physical distancing = %.2f(towns), %.2f(villages), %.2f(mixed).\n", pdeff_town, pdeff_village, pdeff_mixed);
       }
+      herdstale_all=1;
 
       for(i=0;i<MAXINFS;i++){//for each infected person
 	if(inf_ages[i]>=0){//still being processed
@@ -1068,6 +1080,7 @@ int main(int argc, char *argv[]){
 		numinf_village_red[abs(inflist[i])]--;
 		reinf_vul_village++;
 	      }
+	      herdstale_all=1;
 	      numinf_red--;
 	    }
 	  }
@@ -1124,11 +1137,23 @@ int main(int argc, char *argv[]){
 	    numcurinf--;numrecovs++;
 	    avrecovtime=avrecovtime*((double)(numrecovs-1))/((double)(numrecovs))+(double)((infs[i])->age)/((double)(numrecovs));
 	  }
-	  else if(infs[i]->quar==0 && infs[i]->age<MAXAGE){//still being processed, not quarantined
-	    herdlevel_town=100.0*((double)numinf_town_red/(double)effpop_town);
-	    for(ii=0;ii<numvillages;ii++){
-	      herdlevel_village[ii]=100.0*((double)numinf_village_red[ii]/(double)effpop_village[ii]);
+	  else if(infs[i]->quar==0 && infs[i]->age<MAXAGE && infs[i]->infnums[infs[i]->age]>0){//still being processed, not quarantined, with infections due
+	    if(herdstale_all || herdstale_town)
+	      herdlevel_town=100.0*((double)numinf_town_red/(double)effpop_town);
+	    if(herdstale_all){
+	      for(ii=0;ii<numvillages;ii++){
+		herdlevel_village[ii]=100.0*((double)numinf_village_red[ii]/(double)effpop_village[ii]);
+	      }
 	    }
+	    else{
+	      for(k=0;k<numherdstale;k++){
+		ii=herdstale_list[k];
+		herdlevel_village[ii]=100.0*((double)numinf_village_red[ii]/(double)effpop_village[ii]);
+	      }
+	    }
+	    for(k=0;k<numherdstale;k++)
+	      herdstale_village[herdstale_list[k]]=0;
+	    herdstale_all=0;herdstale_town=0;numherdstale=0;
             for(j=0;j<infs[i]->infnums[infs[i]->age];j++){
 	      flag=0;
 	      //4 cases town-town, town-village, village-town, village-village
@@ -1185,6 +1210,12 @@ int main(int argc, char *argv[]){
 	      if(flag){
 		tmpi=create(infs, flag, infshp, infscltmp, inf_gam, inf_start, inf_end, inf_mid, inf_tm_shp, &numinf, &numinf_town, numinf_village, &numinf_red, &numinf_town_red, numinf_village_red, &numcurinf, &newinfs, &newinfs_town, newinfs_village, &numill, percill, percdeath_tmp, time_to_death, dist_on_death, time_to_recovery, dist_on_recovery, time_to_sero, dist_on_sero, quardate, quarp_tmp, dist_on_quardate, testp_tmp, testdelay, testdelay_shp, seromax, dist_on_seromax, serofinal, dist_on_serofinal, sero_time, sero_max, sero_final, sero_cur, inf_ages);
 		actualR0=actualR0*((double)(numinf-1))/((double)(numinf))+(double)((infs[tmpi])->numtoinf)/((double)(numinf));
+		if(flag==1)
+		  herdstale_town=1;
+		else if(!herdstale_village[flag-2]){
+		  herdstale_village[flag-2]=1;
+		  herdstale_list[numherdstale++]=flag-2;
+		}
 		//this will update to zero as they come later in the sequence
 		infs[tmpi]->age--;
 	      }
@@ -1304,7 +1335,7 @@ int main(int argc, char *argv[]){
 
   free_infar(infs, 0, MAXINFS-1);
   fclose(fd0);fclose(fd1);fclose(fd2);fclose(fd3);
-  free((char*)numinf_village);free((char*)numinf_village_red);free((char*)newinfs_village);free((char*)totpop_village);free((char*)effpop_village);free((char*)herdlevel_village);free((char*)town_IR);free((char*)village_IR);free((char*)IR);
+  free((char*)numinf_village);free((char*)numinf_village_red);free((char*)newinfs_village);free((char*)totpop_village);free((char*)effpop_village);free((char*)herdlevel_village);free((char*)herdstale_village);free((char*)herdstale_list);free((char*)town_IR);free((char*)village_IR);free((char*)IR);
   return 0;
 }
 
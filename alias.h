@@ -0,0 +1,99 @@
+/* Copyright (C) 2021, Murad Banaji
+ *
+ * This file is part of COVIDAGENT
+ *
+ * COVIDAGENT is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3,
+ * or (at your option) any later version.
+ *
+ * COVIDAGENT is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with COVIDAGENT: see the file COPYING.  If not, see
+ * <https://www.gnu.org/licenses/>
+
+ */
+
+// Sampling from a discrete distribution on 0..n-1 by the alias method
+// (A. J. Walker, 1977, in the form given by M. D. Vose, 1991).
+//
+// The table is built once from the probabilities, in O(n). Each draw then
+// takes one 64 bit random number and a single comparison, however long the
+// distribution: the top 32 bits choose a column, and the bottom 32 bits
+// choose between the column's own value and its alias.
+
+#ifndef ALIAS_H
+#define ALIAS_H
+
+#include <vector>
+#include "cbrng.h"
+
+class aliastable{
+
+ public:
+  int n;
+  std::vector<double> prob;//the probabilities (normalised)
+  std::vector<double> cut;//chance of keeping the column's own value
+  std::vector<int> alias;//the value otherwise
+
+  // w[0..num-1] are weights (not necessarily summing to 1). Weights must
+  // be non-negative with a positive total.
+  aliastable(const double w[], int num){
+    std::vector<double> q(num);
+    std::vector<int> small, large;
+    double tot=0;
+    int i, s, l;
+    n=num;
+    prob.resize(n);cut.resize(n);alias.resize(n);
+    for(i=0;i<n;i++)
+      tot+=w[i];
+    for(i=0;i<n;i++){
+      prob[i]=w[i]/tot;
+      q[i]=prob[i]*n;
+      if(q[i]<1.0)
+	small.push_back(i);
+      else
+	large.push_back(i);
+    }
+    while(!small.empty() && !large.empty()){
+      s=small.back();small.pop_back();
+      l=large.back();large.pop_back();
+      cut[s]=q[s];alias[s]=l;
+      q[l]=(q[l]+q[s])-1.0;
+      if(q[l]<1.0)
+	small.push_back(l);
+      else
+	large.push_back(l);
+    }
+    //what is left over has probability 1 up to rounding error
+    while(!large.empty()){
+      l=large.back();large.pop_back();
+      cut[l]=1.0;alias[l]=l;
+    }
+    while(!small.empty()){
+      s=small.back();small.pop_back();
+      cut[s]=1.0;alias[s]=s;
+    }
+  }
+
+  double mean() const{
+    double m=0;
+    int i;
+    for(i=0;i<n;i++)
+      m+=i*prob[i];
+    return m;
+  }
+
+  int draw(cbrng &g) const{
+    uint64_t x=g.next64();
+    int i=(int)(((x>>32)*(uint64_t)n)>>32);
+    return (double)(x&0xFFFFFFFFULL)*(1.0/4294967296.0)<cut[i]?i:alias[i];
+  }
+
+};
+
+#endif
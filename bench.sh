@@ -0,0 +1,100 @@
+#!/bin/sh
+# Benchmarks of the programs in this directory on fixed canonical
+# scenarios, all with fixed seeds:
+#
+#   inf2_sample      inf2.cc on params/sampleparams (tiny)
+#   inf2_basic2      inf2.cc on params/basicparams2 (two lockdowns, 10M
+#                    population, scaling)
+#   town_100         TownVillage on TownVillageParams01 with 100 villages
+#   town_10000       the same with 10,000 villages
+#   mumbai_1e5       MumbaiIFR_MC with 10^5 experiments
+#   mumbai_1e7       MumbaiIFR_MC with 10^7 experiments
+#
+# For each scenario the best of several runs is reported (see benchrun.cc):
+# wall time, user and system time, peak resident set size, the number of
+# allocations and bytes allocated, and a throughput: simulated person-days
+# per second for the agent based models (the sum over runs and days of the
+# number currently infected, column 4 of the output) and experiments per
+# second for MumbaiIFR_MC. The same figures go, tab separated with a header
+# line, to the results file. If a baseline results file (from an earlier
+# build) is given, wall times are compared with it, and any scenario more
+# than 10% slower is reported as a REGRESSION (exit status 1).
+#
+# Usage: ./bench.sh [results_file] [repeats] [baseline_file] [scenarios]
+# (default bench_results.tsv, 3 repeats, no baseline, all scenarios; the
+# scenarios are a space separated list of names, e.g. "inf2_sample town_100")
+
+RESULTS=${1:-bench_results.tsv}
+case $RESULTS in /*) ;; *) RESULTS=$(pwd)/$RESULTS;; esac
+REPEATS=${2:-3}
+BASELINE=$3
+SCENARIOS=${4:-"inf2_sample inf2_basic2 town_100 town_10000 mumbai_1e5 mumbai_1e7"}
+SRC=$(cd $(dirname $0) && pwd)
+DIR=$(mktemp -d)
+CXX=${CXX:-g++}
+FLAGS="-O2 -lm -std=gnu++11 -pthread"
+
+$CXX $FLAGS $SRC/inf2.cc -o $DIR/inf2 || exit 1
+$CXX $FLAGS $SRC/TownVillage/TownVillage.cc -o $DIR/TownVillage || exit 1
+$CXX -O3 -lm -std=gnu++11 -pthread $SRC/MumbaiIFR_MC.cc -o $DIR/MumbaiIFR_MC || exit 1
+$CXX -O2 $SRC/benchrun.cc -o $DIR/benchrun || exit 1
+if ! $CXX -O2 -shared -fPIC -DALLOC_SHIM $SRC/benchrun.cc -o $DIR/benchalloc.so -ldl 2>/dev/null; then
+  echo "WARNING: could not build the allocation counter; allocations not counted"
+  SHIM=-
+else
+  SHIM=$DIR/benchalloc.so
+fi
+
+# makeparams <base_file> <overrides>: the options in overrides come first,
+# so that they take precedence over those in the base file
+makeparams(){
+  printf "$2" > $DIR/params
+  cat $1 >> $DIR/params
+}
+
+# sum of column 4 over the data lines of an output file
+persondays(){
+  awk '!/^#/ && NF>=4 {s+=$4} END{printf "%.0f", s}' $1
+}
+
+printf "scenario\twall_s\tuser_s\tsys_s\tmaxrss_kb\tallocs\talloc_bytes\twork\twork_unit\trate\n" > $RESULTS
+cd $DIR
+for sc in $SCENARIOS; do
+  case $sc in
+    inf2_sample) makeparams $SRC/params/sampleparams "seed 1\n"; CMD="./inf2 params out"; UNIT=person_days;;
+    inf2_basic2) makeparams $SRC/params/basicparams2 "seed 1\n"; CMD="./inf2 params out"; UNIT=person_days;;
+    town_100) makeparams $SRC/TownVillage/TownVillageParams01 "seed 1\nnumvillages 100\n"; CMD="./TownVillage params out"; UNIT=person_days;;
+    town_10000) makeparams $SRC/TownVillage/TownVillageParams01 "seed 1\nnumvillages 10000\n"; CMD="./TownVillage params out"; UNIT=person_days;;
+    mumbai_1e5) makeparams $SRC/params/MumbaiIFRparams "numexp 100000\nseed 12345\n"; CMD="./MumbaiIFR_MC out params"; UNIT=experiments;;
+    mumbai_1e7) makeparams $SRC/params/MumbaiIFRparams "numexp 10000000\nseed 12345\n"; CMD="./MumbaiIFR_MC out params"; UNIT=experiments;;
+    *) echo "Unknown scenario $sc"; continue;;
+  esac
+  best=""
+  i=0
+  while [ $i -lt $REPEATS ]; do
+    line=$(./benchrun $SHIM $CMD)
+    if [ $? -ne 0 ]; then echo "ERROR: scenario $sc failed"; exit 1; fi
+    t=$(echo "$line" | cut -f1)
+    if [ -z "$best" ] || awk -v a=$t -v b=$(echo "$best" | cut -f1) 'BEGIN{exit !(a<b)}'; then best=$line; fi
+    i=$((i+1))
+  done
+  if [ $UNIT = experiments ]; then
+    work=$(awk '/^numexp/{print $2; exit}' params)
+  else
+    work=$(persondays out)
+  fi
+  printf "%s\t%s\t%s\t%s\n" $sc "$best" $work $UNIT | awk -F'\t' 'BEGIN{OFS="\t"} {print $0, sprintf("%.4g", $2>0?$8/$2:0)}' >> $RESULTS
+  tail -n 1 $RESULTS | awk -F'\t' '{printf "%-12s %8.3f s  %9d kB  %10s allocs  %11.4g %s/s\n", $1, $2, $5, $6, $10, $9}'
+  rm -f out*
+done
+cd - > /dev/null
+rm -rf $DIR
+
+if [ -n "$BASELINE" ]; then
+  awk -F'\t' 'NR==FNR {if(FNR>1) base[$1]=$2; next}
+    FNR>1 && ($1 in base) && base[$1]>0 {
+      r=$2/base[$1]; printf "%-12s %8.3f s vs %8.3f s (x%.2f)%s\n", $1, $2, base[$1], r, (r>1.1)?"  REGRESSION":"";
+      if(r>1.1) bad=1
+    }
+    END{exit bad}' $BASELINE $RESULTS || exit 1
+fi
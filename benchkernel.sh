@@ -0,0 +1,45 @@
+#!/bin/sh
+# Microbenchmark of the day kernel of inf2.cc: builds inf2.cc with the
+# specialised kernels (the default) and with the generic kernel, which
+# tests the options inside the loop (-DGENERIC_KERNEL), runs both on the
+# same parameter file and seed, checks that the output is identical and
+# reports the best of several timings.
+#
+# Usage: ./benchkernel.sh [parameter_file] [repeats] [seed]
+# (default params/basicparams2, 3 repeats, seed 1)
+
+PARAMS=${1:-params/basicparams2}
+REPEATS=${2:-3}
+SEED=${3:-1}
+DIR=$(mktemp -d)
+CXX=${CXX:-g++}
+FLAGS="-O2 -lm -std=gnu++11 -pthread"
+
+$CXX $FLAGS inf2.cc -o $DIR/special || exit 1
+$CXX $FLAGS -DGENERIC_KERNEL inf2.cc -o $DIR/generic || exit 1
+cat $PARAMS > $DIR/params
+echo "seed $SEED" >> $DIR/params
+
+for b in generic special; do
+  best=""
+  i=0
+  while [ $i -lt $REPEATS ]; do
+    t0=$(date +%s%N)
+    $DIR/$b $DIR/params $DIR/out_$b > /dev/null 2>&1
+    t1=$(date +%s%N)
+    t=$(( (t1-t0)/1000000 ))
+    if [ -z "$best" ] || [ $t -lt $best ]; then best=$t; fi
+    i=$((i+1))
+  done
+  eval best_$b=$best
+  echo "$b kernel: best of $REPEATS runs $best ms"
+done
+
+for f in "" _av _sync _sync1 _log; do
+  if ! cmp -s $DIR/out_generic$f $DIR/out_special$f; then
+    echo "ERROR: output file out$f differs between the kernels"
+    exit 1
+  fi
+done
+awk -v g=$best_generic -v s=$best_special 'BEGIN{printf "output identical; speedup %.2f\n", g/s}'
+rm -rf $DIR
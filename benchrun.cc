@@ -0,0 +1,139 @@
+/* Copyright (C) 2021, Murad Banaji
+ *
+ * This file is part of COVIDAGENT
+ *
+ * COVIDAGENT is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3,
+ * or (at your option) any later version.
+ *
+ * COVIDAGENT is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with COVIDAGENT: see the file COPYING.  If not, see
+ * <https://www.gnu.org/licenses/>
+
+ */
+
+// Runs one command and reports what it cost, for bench.sh.
+//
+// Compile with "g++ -O2 benchrun.cc -o benchrun" for the runner and with
+// "g++ -O2 -shared -fPIC -DALLOC_SHIM benchrun.cc -o benchalloc.so -ldl" for
+// the allocation counter, which is loaded into the command with LD_PRELOAD.
+//
+// Run with "./benchrun <allocation_counter.so|-> <command> [<args> ...]".
+// The command's own output goes to /dev/null, and one line is written to
+// stdout: wall time (s), user time (s), system time (s), peak resident set
+// size (kB), number of allocations (malloc, calloc, realloc and so also new)
+// and bytes allocated. With "-" in place of the counter, or if it cannot be
+// loaded, the last two are -1. The exit status is that of the command.
+
+#ifndef ALLOC_SHIM
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+int main(int argc, char *argv[]){
+  char countfile[]="/tmp/benchrun_XXXXXX";
+  struct timespec t0, t1;
+  struct rusage ru;
+  long allocs=-1, bytes=-1;
+  int status, fd, shim;
+  pid_t pid;
+  FILE *fdc;
+
+  if(argc<3){
+    fprintf(stderr, "Usage: %s <allocation_counter.so|-> <command> [<args> ...]\n", argv[0]);
+    exit(0);
+  }
+  shim=strcmp(argv[1], "-")!=0;
+  if(shim){
+    if((fd=mkstemp(countfile))<0){
+      fprintf(stderr, "ERROR: could not create a temporary file. EXITING.\n");
+      exit(0);
+    }
+    close(fd);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  if((pid=fork())==0){
+    fd=open("/dev/null", O_WRONLY);
+    dup2(fd, 1);dup2(fd, 2);close(fd);
+    if(shim){
+      setenv("LD_PRELOAD", argv[1], 1);
+      setenv("BENCH_ALLOC_FILE", countfile, 1);
+    }
+    execvp(argv[2], argv+2);
+    _exit(127);
+  }
+  wait4(pid, &status, 0, &ru);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  if(shim){
+    if((fdc=fopen(countfile, "r"))){
+      if(fscanf(fdc, "%ld %ld", &allocs, &bytes)!=2){allocs=-1;bytes=-1;}
+      fclose(fdc);
+    }
+    unlink(countfile);
+  }
+  printf("%.3f\t%.3f\t%.3f\t%ld\t%ld\t%ld\n", (t1.tv_sec-t0.tv_sec)+1e-9*(t1.tv_nsec-t0.tv_nsec), ru.ru_utime.tv_sec+1e-6*ru.ru_utime.tv_usec, ru.ru_stime.tv_sec+1e-6*ru.ru_stime.tv_usec, ru.ru_maxrss, allocs, bytes);
+  return WIFEXITED(status)?WEXITSTATUS(status):1;
+}
+
+#else
+
+// The allocation counter: counts calls and bytes and passes them on to
+// glibc's allocator. The totals are written at exit to the file named by
+// BENCH_ALLOC_FILE, without allocating.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+extern "C" {
+  void *__libc_malloc(size_t n);
+  void *__libc_calloc(size_t m, size_t n);
+  void *__libc_realloc(void *p, size_t n);
+
+  static unsigned long numalloc=0, numbytes=0;
+
+  void *malloc(size_t n){
+    __atomic_fetch_add(&numalloc, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&numbytes, n, __ATOMIC_RELAXED);
+    return __libc_malloc(n);
+  }
+
+  void *calloc(size_t m, size_t n){
+    __atomic_fetch_add(&numalloc, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&numbytes, m*n, __ATOMIC_RELAXED);
+    return __libc_calloc(m, n);
+  }
+
+  void *realloc(void *p, size_t n){
+    __atomic_fetch_add(&numalloc, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&numbytes, n, __ATOMIC_RELAXED);
+    return __libc_realloc(p, n);
+  }
+}
+
+__attribute__((destructor)) static void writecounts(){
+  char buf[64];
+  const char *fname=getenv("BENCH_ALLOC_FILE");
+  int fd, len;
+  if(!fname || (fd=open(fname, O_WRONLY|O_TRUNC))<0)
+    return;
+  len=snprintf(buf, sizeof(buf), "%lu %lu\n", numalloc, numbytes);
+  if(write(fd, buf, len)<0){}
+  close(fd);
+}
+
+#endif
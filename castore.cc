@@ -0,0 +1,173 @@
+/* Copyright (C) 2021, Murad Banaji
+ *
+ * This file is part of COVIDAGENT
+ *
+ * COVIDAGENT is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3,
+ * or (at your option) any later version.
+ *
+ * COVIDAGENT is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with COVIDAGENT: see the file COPYING.  If not, see
+ * <https://www.gnu.org/licenses/>
+
+ */
+
+// Views of a result store (see castore.h): writes the _av, _sync1, _sync
+// and _quant files which inf2.cc would have written for the same runs,
+// using the same routines, or with -i describes the store.
+//
+// Compile with "g++ -O2 -std=gnu++11 -pthread castore.cc -o castore" and
+// run with "./castore [-i] [-q <quantiles>] <store> [<output_file>]". The
+// files written are <output_file>_av etc., where <output_file> defaults to
+// the name of the store without "_store". The quantiles (exact) are a comma
+// separated list, by default those of inf2.cc; "-q none" for no _quant file.
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#define INF2_LIBRARY
+#include "inf2.cc"
+
+int main(int argc, char *argv[]){
+  int info=0, fd, i, m, r, totdata;
+  const char *storename;
+  char outname[300], fname[306];
+  struct stat st;
+  const char *base;
+  const castoreheader *h;
+  const int64_t *out, *delays, *roots, *data;
+  const double *weights;
+  int **realdata;
+  pointout o;
+  char defq[200]="";
+  const char *quantlist=defq, *c;
+  double v;
+
+  while(argc>1 && argv[1][0]=='-'){
+    if(!strcmp(argv[1], "-i"))
+      info=1;
+    else if(!strcmp(argv[1], "-q") && argc>2){
+      quantlist=argv[2];argc--;argv++;
+    }
+    else
+      break;
+    argc--;argv++;
+  }
+  if(argc<2){
+    fprintf(stderr, "Usage: castore [-i] [-q <quantiles>] <store> [<output_file>]\n");
+    exit(0);
+  }
+  for(i=0;i<(int)(sizeof(defquant)/sizeof(double));i++)
+    snprintf(defq+strlen(defq), 200-strlen(defq), "%s%g", i?",":"", defquant[i]);
+  storename=argv[1];
+  if((fd=open(storename, O_RDONLY))<0 || fstat(fd, &st)!=0 || st.st_size<(off_t)sizeof(castoreheader)){
+    fprintf(stderr, "ERROR: could not read the result store \"%s\". EXITING.\n", storename);
+    exit(0);
+  }
+  if((base=(const char *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0))==MAP_FAILED){
+    fprintf(stderr, "ERROR: could not map the result store \"%s\". EXITING.\n", storename);
+    exit(0);
+  }
+  h=(const castoreheader *)base;
+  if(memcmp(h->magic, CASTORE_MAGIC, 8) || h->version!=CASTORE_VERSION || h->cols!=CASTORE_COLS || h->datacols!=CASTORE_DATACOLS){
+    fprintf(stderr, "ERROR: \"%s\" is not a result store of version %d. EXITING.\n", storename, CASTORE_VERSION);
+    exit(0);
+  }
+  if(info){
+    printf("runs %ld (room for %ld, %ld written)\ndays %ld\ndata rows %ld\ncomplete %ld\nweighted %ld\n", (long)h->num_runs, (long)h->maxruns, (long)h->runsdone, (long)h->totdays, (long)h->totdata, (long)h->complete, (long)h->weighted);
+    return 0;
+  }
+  if(!h->complete || h->realoff+h->totdata*CASTORE_DATACOLS*(int64_t)sizeof(int64_t)>st.st_size){
+    fprintf(stderr, "ERROR: the result store \"%s\" is incomplete. EXITING.\n", storename);
+    exit(0);
+  }
+  out=(const int64_t *)(base+h->outoff);
+  delays=(const int64_t *)(base+h->delayoff);
+  weights=(const double *)(base+h->weightoff);
+  roots=(const int64_t *)(base+h->rootoff);
+  data=(const int64_t *)(base+h->realoff);
+
+  if(argc>2)
+    snprintf(outname, 300, "%s", argv[2]);
+  else{
+    snprintf(outname, 300, "%s", storename);
+    if(strlen(outname)>6 && !strcmp(outname+strlen(outname)-6, "_store"))
+      outname[strlen(outname)-6]=0;
+  }
+
+  //the output as inf2.cc holds it at the end of a set of parameters
+  o.num_runs=h->num_runs;o.totdays=h->totdays;o.keep=0;o.numextinct=0;
+  o.fdstore=NULL;
+  o.alloutput=imatrix(0, o.num_runs*o.totdays-1, 0, 9);
+  o.avoutput=dmatrix(0, o.totdays-1, 0, 12);
+  o.SEoutput=dmatrix(0, o.totdays-1, 0, 12);
+  o.delays=(int *)malloc((size_t) ((o.num_runs)*sizeof(int)));
+  o.weights=NULL;o.roots=NULL;
+  if(h->weighted){
+    o.weights=(double *)malloc((size_t) (o.num_runs*sizeof(double)));
+    o.roots=(int *)malloc((size_t) (o.num_runs*sizeof(int)));
+  }
+  for(r=0;r<o.num_runs;r++){
+    for(m=0;m<o.totdays;m++){
+      for(i=0;i<10;i++)
+	o.alloutput[r*o.totdays+m][i]=out[((int64_t)r*o.totdays+m)*CASTORE_COLS+i];
+    }
+    o.delays[r]=delays[r];
+    if(h->weighted){
+      o.weights[r]=weights[r];o.roots[r]=roots[r];
+    }
+  }
+  totdata=h->totdata;
+  realdata=imatrix(0, totdata, 0, 2);
+  for(m=0;m<totdata;m++){
+    for(i=0;i<3;i++)
+      realdata[m][i]=data[m*CASTORE_DATACOLS+i];
+  }
+
+  snprintf(fname, 306, "%s_av", outname);
+  o.fd5=openftowrite(fname);
+  snprintf(fname, 306, "%s_sync1", outname);
+  o.fd6=openftowrite(fname);
+  snprintf(fname, 306, "%s_sync", outname);
+  o.fd7=openftowrite(fname);
+  snprintf(fname, 306, "%s_quant", outname);
+  o.fdq=openftowrite(fname);
+  o.qmethod=0;//(exact)
+  o.numquant=0;
+  for(c=quantlist;c && *c && o.numquant<MAXQUANT;c=strchr(c, ',')?strchr(c, ',')+1:NULL){
+    v=atof(c);
+    if(v>0 && v<=1){
+      for(i=o.numquant;i>0 && o.quant[i-1]>v;i--)//keep them in order
+	o.quant[i]=o.quant[i-1];
+      o.quant[i]=v;
+      o.numquant++;
+    }
+  }
+  if(o.numquant==0){
+    fclose(o.fdq);remove(fname);o.fdq=NULL;
+  }
+  for(r=0;r<o.num_runs;r++)
+    writesyncrun(&o, r, realdata, totdata);
+  writeaverages(&o, realdata, totdata);
+  fclose(o.fd5);fclose(o.fd6);fclose(o.fd7);
+  if(o.fdq)
+    fclose(o.fdq);
+
+  free_imatrix(realdata, 0, totdata, 0, 2);
+  free_imatrix(o.alloutput, 0, o.num_runs*o.totdays-1, 0, 9);
+  free_dmatrix(o.avoutput, 0, o.totdays-1, 0, 9);
+  free_dmatrix(o.SEoutput, 0, o.totdays-1, 0, 9);
+  free((char *)o.delays);
+  if(h->weighted){
+    free((char *)o.weights);free((char *)o.roots);
+  }
+  munmap((void *)base, st.st_size);
+  close(fd);
+  return 0;
+}
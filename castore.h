@@ -0,0 +1,82 @@
+/* Copyright (C) 2021, Murad Banaji
+ *
+ * This file is part of COVIDAGENT
+ *
+ * COVIDAGENT is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3,
+ * or (at your option) any later version.
+ *
+ * COVIDAGENT is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with COVIDAGENT: see the file COPYING.  If not, see
+ * <https://www.gnu.org/licenses/>
+
+ */
+
+/* The layout of a result store, "<output_file>_store", written by inf2.cc
+ * with "result_store 1" (or 2). It holds the output of every run of a set of
+ * parameters in binary, to be memory mapped and read in place. All numbers
+ * are little endian. In order:
+ *
+ *   header    a castoreheader (128 bytes)
+ *   delays    int64[maxruns]: the day on which run r synchronised minus
+ *             sync_at_time, or 0 (as used for the _sync, _sync1 and _av files)
+ *   weights   double[maxruns]: the weight of each run (1 without importance
+ *             splitting)
+ *   roots     int64[maxruns]: the original run each run descends from (r
+ *             without importance splitting)
+ *   output    int64[num_runs][totdays][CASTORE_COLS], starting on a 4096 byte
+ *             boundary: the rows of the output file
+ *   realdata  int64[totdata][CASTORE_DATACOLS]: the data file (cases,
+ *             deaths, and the third column), written when the runs are done
+ *
+ * maxruns >= num_runs is the room that was left for runs. Each run is
+ * written as it finishes, and runsdone counted; complete is set once all
+ * runs (and realdata) are written. So with numpy, for instance:
+ *
+ *   h=numpy.fromfile(f, dtype='<i8', count=16)
+ *   out=numpy.memmap(f, dtype='<i8', mode='r', offset=h[OUTOFF],
+ *                    shape=(h[NUM_RUNS], h[TOTDAYS], h[COLS]))
+ *
+ * with the indices of the fields below (counting 8 byte words).
+ *
+ * Use the castore program to write the _av, _sync1 and _sync files from a
+ * store.
+ */
+
+#ifndef CASTORE_H
+#define CASTORE_H
+
+#include <stdint.h>
+
+#define CASTORE_MAGIC "CASTORE\0"
+#define CASTORE_VERSION 1
+#define CASTORE_COLS 10
+#define CASTORE_DATACOLS 3
+#define CASTORE_ALIGN 4096
+
+typedef struct{
+  char magic[8];      /* 0: CASTORE_MAGIC */
+  int64_t version;    /* 1 */
+  int64_t num_runs;   /* 2: runs in the output block */
+  int64_t maxruns;    /* 3: length of delays, weights and roots */
+  int64_t totdays;    /* 4 */
+  int64_t cols;       /* 5: CASTORE_COLS */
+  int64_t totdata;    /* 6: rows of realdata */
+  int64_t datacols;   /* 7: CASTORE_DATACOLS */
+  int64_t delayoff;   /* 8: byte offsets */
+  int64_t weightoff;  /* 9 */
+  int64_t rootoff;    /* 10 */
+  int64_t outoff;     /* 11 */
+  int64_t realoff;    /* 12 */
+  int64_t runsdone;   /* 13: runs written so far */
+  int64_t complete;   /* 14: 1 once everything has been written */
+  int64_t weighted;   /* 15: importance splitting (weights and roots matter)? */
+} castoreheader;
+
+#endif
@@ -0,0 +1,132 @@
+/* Copyright (C) 2021, Murad Banaji
+ *
+ * This file is part of COVIDAGENT
+ *
+ * COVIDAGENT is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3,
+ * or (at your option) any later version.
+ *
+ * COVIDAGENT is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with COVIDAGENT: see the file COPYING.  If not, see
+ * <https://www.gnu.org/licenses/>
+
+ */
+
+// Counter-based random number generation: the Philox4x32-10 generator of
+// J. K. Salmon, M. A. Moraes, R. O. Dror and D. E. Shaw, "Parallel random
+// numbers: as easy as 1, 2, 3", SC'11.
+//
+// The output is a pure function of (seed, stream, counter), so any number
+// of independent streams can be created without coordination (e.g. one per
+// thread or one per experiment), and a stream can be positioned anywhere
+// without generating the values before it. The whole state is a few
+// integers, so it can be copied or written to disk.
+
+#ifndef CBRNG_H
+#define CBRNG_H
+
+#include <stdint.h>
+
+#define PHILOX_M0 0xD2511F53U
+#define PHILOX_M1 0xCD9E8D57U
+#define PHILOX_W0 0x9E3779B9U
+#define PHILOX_W1 0xBB67AE85U
+
+// One Philox4x32-10 block: 128 bits of counter and 64 bits of key in,
+// 128 random bits out.
+inline void philox4x32(const uint32_t ctr[4], const uint32_t key[2], uint32_t out[4]){
+  uint32_t c0=ctr[0], c1=ctr[1], c2=ctr[2], c3=ctr[3];
+  uint32_t k0=key[0], k1=key[1];
+  uint64_t p0, p1;
+  int i;
+  for(i=0;i<10;i++){
+    p0=(uint64_t)PHILOX_M0*c0;
+    p1=(uint64_t)PHILOX_M1*c2;
+    c0=(uint32_t)(p1>>32)^c1^k0;
+    c1=(uint32_t)p1;
+    c2=(uint32_t)(p0>>32)^c3^k1;
+    c3=(uint32_t)p0;
+    k0+=PHILOX_W0;k1+=PHILOX_W1;
+  }
+  out[0]=c0;out[1]=c1;out[2]=c2;out[3]=c3;
+}
+
+// Convert 64 random bits to a double in [0,1) with 53 bits of precision
+inline double u64tou01(uint64_t x){
+  return (double)(x>>11)*(1.0/9007199254740992.0);
+}
+
+// Convert 64 random bits to a double in (0,1) (never 0 or 1: safe for logs)
+inline double u64tou01open(uint64_t x){
+  return ((double)(x>>11)+0.5)*(1.0/9007199254740992.0);
+}
+
+// A well mixed function of 64 bits (the splitmix64 finaliser), for deriving
+// stream numbers from other identifiers
+inline uint64_t mix64(uint64_t x){
+  x^=x>>30;x*=0xBF58476D1CE4E5B9ULL;
+  x^=x>>27;x*=0x94D049BB133111EBULL;
+  x^=x>>31;
+  return x;
+}
+
+// A stream of random numbers. "seed" is the key, "stream" the upper half of
+// the counter and "ctr" the lower half. Can be used as the generator
+// argument of the std:: distributions.
+class cbrng{
+
+ public:
+  typedef uint32_t result_type;
+  uint64_t key;//seed
+  uint64_t stream;//which stream
+  uint64_t ctr;//next block in the stream
+  uint32_t buf[4];//current block
+  int pos;//next unused word in buf (4 = empty)
+
+  cbrng(){seed(0, 0);}
+  cbrng(uint64_t s, uint64_t strm){seed(s, strm);}
+
+  void seed(uint64_t s, uint64_t strm){
+    key=s;stream=strm;ctr=0;pos=4;
+  }
+
+  // the block at position n of this stream (does not alter the state)
+  void block(uint64_t n, uint32_t out[4]) const{
+    uint32_t c[4], k[2];
+    c[0]=(uint32_t)n;c[1]=(uint32_t)(n>>32);
+    c[2]=(uint32_t)stream;c[3]=(uint32_t)(stream>>32);
+    k[0]=(uint32_t)key;k[1]=(uint32_t)(key>>32);
+    philox4x32(c, k, out);
+  }
+
+  result_type operator()(){
+    if(pos==4){
+      block(ctr++, buf);
+      pos=0;
+    }
+    return buf[pos++];
+  }
+
+  static result_type min(){return 0;}
+  static result_type max(){return 0xFFFFFFFFU;}
+
+  uint64_t next64(){
+    uint64_t hi=(*this)();
+    return (hi<<32)|(*this)();
+  }
+
+  // uniform on [0,1)
+  double u01(){return u64tou01(next64());}
+
+  // uniform on (0,1)
+  double u01open(){return u64tou01open(next64());}
+
+};
+
+#endif
@@ -0,0 +1,198 @@
+/* Copyright (C) 2021, Murad Banaji
+ *
+ * This file is part of COVIDAGENT
+ *
+ * COVIDAGENT is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3,
+ * or (at your option) any later version.
+ *
+ * COVIDAGENT is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with COVIDAGENT: see the file COPYING.  If not, see
+ * <https://www.gnu.org/licenses/>
+
+ */
+
+// The C interface of covidagent.h: the engine of inf2.cc (compiled here
+// without its main()) behind opaque handles. The parameter file reader and
+// the trueR0 table are shared, so they are used under a lock; runs only
+// touch their own state. Errors in the engine are thrown back here (see
+// engineerror) and reported by the return values, with ca_last_error.
+
+#define INF2_LIBRARY
+#include "inf2.cc"
+#include "covidagent.h"
+#include <mutex>
+
+std::mutex camutex;//for reading parameters
+int setthrows=(enginethrows=1);
+
+struct ca_params{
+  params p;
+  double trueR0;
+};
+
+struct ca_run{
+  runstate s;
+  int failed;//stopped by an error?
+};
+
+extern "C" {
+
+int ca_api_version(void){
+  return CA_API_VERSION;
+}
+
+const char *ca_last_error(void){
+  static thread_local char msg[300];
+  char *c;
+  snprintf(msg, 300, "%s", engineerrmsg);
+  if((c=strstr(msg, " EXITING."))!=NULL || (c=strchr(msg, '\n'))!=NULL)//(as a message, not the end of the program)
+    *c=0;
+  return msg;
+}
+
+ca_params *ca_params_new(const char *paramfile, int num, const char *const names[], const double values[]){
+  char fname[200];
+  int k;
+  ca_params *cp;
+  FILE *fd;
+  engineerrmsg[0]=0;
+  if(!paramfile || strlen(paramfile)>=200 || !(fd=fopen(paramfile, "r"))){
+    snprintf(engineerrmsg, 300, "could not read the parameter file");
+    return NULL;
+  }
+  fclose(fd);
+  if(num<0 || num>MAXOVERRIDES){
+    snprintf(engineerrmsg, 300, "too many options to override (maximum %d)", MAXOVERRIDES);
+    return NULL;
+  }
+  strcpy(fname, paramfile);
+  cp=new ca_params();//(zeroed, so freeparams is safe whenever we give up)
+  std::lock_guard<std::mutex> lock(camutex);
+  optwarn=0;
+  numoverrides=0;
+  try{
+    for(k=0;k<num;k++){
+      if(setoverride(names[k], values[k])<0){
+	snprintf(engineerrmsg, 300, "option name \"%.60s\" is too long", names[k]);
+	throw engineexception();
+      }
+    }
+    readparams(fname, &cp->p, NULL);
+    for(k=0;k<numoverrides;k++){//each override must be an option these parameters read
+      if(!overrides[k].used){
+	if(overrides[k].num!=1)
+	  snprintf(engineerrmsg, 300, "unknown option \"%s:%d\" (or not used with these parameters)", overrides[k].name, overrides[k].num);
+	else
+	  snprintf(engineerrmsg, 300, "unknown option \"%s\" (or not used with these parameters)", overrides[k].name);
+	throw engineexception();
+      }
+    }
+    numoverrides=0;
+    setupparams(&cp->p);
+    cp->trueR0=gettrueR0(&cp->p);
+  }
+  catch(engineexception &){
+    numoverrides=0;
+    freeparams(&cp->p);
+    delete cp;
+    return NULL;
+  }
+  return cp;
+}
+
+void ca_params_free(ca_params *p){
+  if(!p)
+    return;
+  freeparams(&p->p);
+  delete p;
+}
+
+int ca_params_totdays(const ca_params *p){
+  return p->p.totdays;
+}
+
+int ca_params_num_runs(const ca_params *p){
+  return p->p.num_runs;
+}
+
+double ca_params_trueR0(const ca_params *p){
+  return p->trueR0;
+}
+
+ca_run *ca_run_new(void){
+  ca_run *r=new ca_run;
+  allocstate(&r->s);
+  r->s.day=0;
+  r->failed=0;
+  return r;
+}
+
+void ca_run_free(ca_run *r){
+  if(!r)
+    return;
+  finishrun(&r->s);
+  freestate(&r->s);
+  delete r;
+}
+
+int ca_run_start(ca_run *r, const ca_params *p, uint64_t seed, uint64_t stream){
+  r->failed=0;
+  try{
+    startrun(&p->p, &r->s, seed, stream);
+  }
+  catch(engineexception &){
+    r->failed=1;
+    return -1;
+  }
+  return 0;
+}
+
+int ca_run_step(ca_run *r, const ca_params *p, int row[CA_NUMCOLS]){
+  if(r->failed)
+    return -1;
+  if(r->s.day>=p->p.totdays)
+    return 0;
+  try{
+    stepday(&p->p, &r->s, row);
+  }
+  catch(engineexception &){
+    r->failed=1;
+    return -1;
+  }
+  return 1;
+}
+
+void ca_run_summary(const ca_run *r, ca_summary *sum){
+  const runstate *s=&r->s;
+  sum->days=s->day;
+  sum->actualR0=s->actualR0;
+  sum->avdthtime=s->avdthtime;sum->avrecovtime=s->avrecovtime;
+  sum->avtesttime=s->avtesttime;sum->avserotime=s->avserotime;
+  sum->synced=s->syncflag;
+  sum->delay=s->syncflag?s->delay:0;
+  sum->extinct=s->extinct;
+}
+
+int ca_simulate(ca_run *r, const ca_params *p, uint64_t seed, uint64_t stream, ca_observer obs, void *user, ca_summary *sum){
+  int row[CA_NUMCOLS], k;
+  if(ca_run_start(r, p, seed, stream)<0)
+    return -1;
+  while((k=ca_run_step(r, p, row))>0){
+    if(obs && obs(user, row))
+      break;
+  }
+  if(k<0)
+    return -1;
+  if(sum)
+    ca_run_summary(r, sum);
+  return r->s.day;
+}
+
+}
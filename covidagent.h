@@ -0,0 +1,123 @@
+/* Copyright (C) 2021, Murad Banaji
+ *
+ * This file is part of COVIDAGENT
+ *
+ * COVIDAGENT is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3,
+ * or (at your option) any later version.
+ *
+ * COVIDAGENT is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with COVIDAGENT: see the file COPYING.  If not, see
+ * <https://www.gnu.org/licenses/>
+
+ */
+
+/* C interface to the engine of inf2.cc, for running simulations inside
+ * another program rather than through the command line program.
+ *
+ * Build the library with
+ *   g++ -O2 -std=gnu++11 -pthread -fPIC -shared covidagent.cc -o libcovidagent.so
+ * (or compile covidagent.cc into the calling program) and link C or C++
+ * code with -lcovidagent.
+ *
+ * A set of parameters is read from a parameter file, as for inf2.cc,
+ * optionally with some numerical options replaced. A run context holds
+ * the state of one run, and can be reused for any number of runs (of any
+ * sets of parameters). A run is started with a seed and a stream: the
+ * same seed and stream give the same run as run number <stream> of inf2.cc
+ * with that seed. Each day simulated gives the ten numbers of a line of
+ * inf2.cc's output file.
+ *
+ * Different run contexts can be used in different threads at the same
+ * time, with shared or separate parameters. Errors (in a parameter file,
+ * or a run outgrowing MAXINFS) don't end the program as they do for
+ * inf2.cc: the call returns NULL or -1, and ca_last_error gives the message.
+ * Warnings about options missing from parameter files are not printed.
+ */
+
+#ifndef COVIDAGENT_H
+#define COVIDAGENT_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CA_API_VERSION 2
+
+/* The columns of a day's output */
+#define CA_DAY 0
+#define CA_NUMINF 1
+#define CA_NEWINFS 2
+#define CA_NUMCURINF 3
+#define CA_NUMDEATHS 4
+#define CA_NEWDEATHS 5
+#define CA_NUMTEST 6
+#define CA_NEWTESTS 7
+#define CA_NUMINFECTIOUS 8
+#define CA_NUMSERO 9
+#define CA_NUMCOLS 10
+
+typedef struct ca_params ca_params;
+typedef struct ca_run ca_run;
+
+/* The end of a run */
+typedef struct{
+  int days; /* days simulated */
+  double actualR0;
+  double avdthtime, avrecovtime, avtesttime, avserotime;
+  int synced; /* synchronisation point reached? */
+  int delay; /* day of synchronisation minus sync_at_time (if synced) */
+  int extinct; /* day on which the run died out (-1 if it didn't) */
+} ca_summary;
+
+/* Called with the output of each day; return non-zero to stop the run */
+typedef int (*ca_observer)(void *user, const int row[CA_NUMCOLS]);
+
+int ca_api_version(void);
+
+/* The last error in this thread */
+const char *ca_last_error(void);
+
+/* Parameters from a file, with the options names[0..num-1] set to
+ * values[0..num-1] ("name:k" for the kth value on a line). NULL if the
+ * file can't be read, there are more than 50 options, an option name is
+ * too long (50 characters or more), an option is not one which these
+ * parameters read, or the parameters are in error. */
+ca_params *ca_params_new(const char *paramfile, int num, const char *const names[], const double values[]);
+void ca_params_free(ca_params *p);
+int ca_params_totdays(const ca_params *p);
+int ca_params_num_runs(const ca_params *p);
+double ca_params_trueR0(const ca_params *p);
+
+/* A run context (large: it has room for the maximum number of infected
+ * individuals, so reuse it) */
+ca_run *ca_run_new(void);
+void ca_run_free(ca_run *r);
+
+/* Start a run, creating the initial infections. Returns 0, or -1 on an
+ * error. */
+int ca_run_start(ca_run *r, const ca_params *p, uint64_t seed, uint64_t stream);
+/* Simulate the next day, with its output in row. Returns 0 once totdays
+ * days have been simulated (row is then untouched), 1 otherwise, or -1 on
+ * an error (the run is then over; start another). */
+int ca_run_step(ca_run *r, const ca_params *p, int row[CA_NUMCOLS]);
+void ca_run_summary(const ca_run *r, ca_summary *sum);
+
+/* A whole run: start, then step to the end (or until obs, if not NULL,
+ * returns non-zero). Returns the number of days simulated, and fills sum
+ * if not NULL, or -1 on an error. */
+int ca_simulate(ca_run *r, const ca_params *p, uint64_t seed, uint64_t stream, ca_observer obs, void *user, ca_summary *sum);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,428 @@
+/* Copyright (C) 2021, Murad Banaji
+ *
+ * This file is part of COVIDAGENT
+ *
+ * COVIDAGENT is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3,
+ * or (at your option) any later version.
+ *
+ * COVIDAGENT is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with COVIDAGENT: see the file COPYING.  If not, see
+ * <https://www.gnu.org/licenses/>
+
+ */
+
+// A simulation server: stays resident with a pool of threads, each with its
+// own run context (see covidagent.h), and answers requests to simulate with
+// some options of a base parameter file replaced.
+//
+// Compile with "g++ -O2 -std=gnu++11 -pthread covidagentd.cc -o covidagentd".
+// Run with "./covidagentd <parameter_file> [<socket>|-] [threads]": requests
+// are read from connections to the Unix domain socket <socket>, or with "-"
+// (the default) from stdin, with replies to stdout. threads defaults to 1.
+//
+// A request is one line of JSON, e.g.
+//   {"id": 7, "overrides": {"R0": 3.2, "lockdown_at_inf": 500}, "runs": 10}
+// with the optional fields
+//   id         echoed in every reply to the request (a number or string)
+//   overrides  options to replace, with numerical values ("name:k" for the
+//              kth value on a line, as for ABC parameters); an option which
+//              the parameter file's settings don't read is an error
+//   seed       the seed (default: that of the parameter file, or the time
+//              at startup)
+//   runs       number of runs (default number_of_runs), at most 100000
+//   first_run  the first run's stream (default 0): run r uses stream r, so
+//              results are those of inf2.cc with the same seed
+// Numbers must be finite JSON numbers, and seed, runs and first_run
+// non-negative integers.
+//   days       0 for no per-day output (default 1)
+// Replies are lines of JSON, written as they are produced:
+//   {"id":7,"run":0,"row":[day,numinf,newinfs,numcurinf,numdeaths,newdeaths,numtest,newtests,numinfectious,numsero]}
+//   {"id":7,"run":0,"summary":{"actualR0":...,"synced":...,"delay":...,"extinct":...}}
+//   {"id":7,"done":1,"runs":10,"trueR0":...,"seconds":...}
+// or {"id":7,"error":"..."} (with "run" if a run stopped on an error, which
+// ends the request). Replies to different requests on one
+// connection may be interleaved, line by line.
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include "covidagent.cc" // (after the standard headers: inf2.cc defines max)
+
+#define MAXREQUEST 65536 // longest request line
+#define MAXREQRUNS 100000 // most runs in one request
+
+// A connection (or stdin/stdout): replies are written whole lines at a
+// time
+struct connection{
+  int in, out;
+  std::mutex m;
+  connection(int i, int o){in=i;out=o;}
+  ~connection(){if(in>2) close(in);}
+};
+
+void sendline(connection *c, const std::string &s){
+  size_t done=0;
+  ssize_t k;
+  std::lock_guard<std::mutex> lock(c->m);
+  while(done<s.size()){
+    if((k=send(c->out, s.data()+done, s.size()-done, MSG_NOSIGNAL))<0 && errno==ENOTSOCK)
+      k=write(c->out, s.data()+done, s.size()-done);
+    if(k<=0)//gone away
+      return;
+    done+=k;
+  }
+}
+
+struct request{
+  std::string id;//as sent
+  std::vector<std::string> names;
+  std::vector<double> values;
+  int hasseed;
+  uint64_t seed;
+  int runs, first, days;
+};
+
+//
+// Reading requests: JSON objects whose values are numbers, strings,
+// true/false/null or (for "overrides") objects of numbers
+//
+
+void skipspace(const char *&c){
+  while(isspace((unsigned char)*c))
+    c++;
+}
+
+// a quoted string (simple escapes only)
+int readjstring(const char *&c, std::string &s){
+  s.clear();
+  if(*c!='"')
+    return 0;
+  for(c++;*c && *c!='"';c++){
+    if(*c=='\\' && c[1])
+      c++;
+    s+=*c;
+  }
+  if(*c!='"')
+    return 0;
+  c++;
+  return 1;
+}
+
+// s quoted for JSON
+std::string jquote(const std::string &s){
+  std::string q="\"";
+  char buf[8];
+  for(size_t k=0;k<s.size();k++){
+    if(s[k]=='"' || s[k]=='\\'){
+      q+='\\';q+=s[k];
+    }
+    else if((unsigned char)s[k]<0x20){
+      snprintf(buf, 8, "\\u%04x", (unsigned char)s[k]);
+      q+=buf;
+    }
+    else
+      q+=s[k];
+  }
+  return q+"\"";
+}
+
+int jdigit(char x){
+  return x>='0' && x<='9';
+}
+
+// a finite number in JSON's syntax (so no nan, inf or hex)
+int readjnumber(const char *&c, double *v){
+  const char *e=c;
+  if(*e=='-')
+    e++;
+  if(*e=='0')
+    e++;
+  else if(jdigit(*e)){
+    while(jdigit(*e)) e++;
+  }
+  else
+    return 0;
+  if(*e=='.'){
+    if(!jdigit(*++e))
+      return 0;
+    while(jdigit(*e)) e++;
+  }
+  if(*e=='e' || *e=='E'){
+    e++;
+    if(*e=='+' || *e=='-')
+      e++;
+    if(!jdigit(*e))
+      return 0;
+    while(jdigit(*e)) e++;
+  }
+  if(isalnum((unsigned char)*e) || *e=='.')//(e.g. 0x10 or 01)
+    return 0;
+  *v=strtod(c, NULL);
+  if(!std::isfinite(*v))//out of range
+    return 0;
+  c=e;
+  return 1;
+}
+
+// a whole number from 0 to max
+int jcount(double v, double max){
+  return v>=0 && v<=max && v==floor(v);
+}
+
+int parserequest(const char *line, request *rq, std::string &err){
+  const char *c=line, *start;
+  std::string key, name;
+  double v;
+  rq->id="null";rq->hasseed=0;rq->seed=0;rq->runs=-1;rq->first=0;rq->days=1;
+  rq->names.clear();rq->values.clear();
+  skipspace(c);
+  if(*c++!='{'){err="not a JSON object";return 0;}
+  skipspace(c);
+  while(*c && *c!='}'){
+    if(!readjstring(c, key)){err="expected a key";return 0;}
+    skipspace(c);
+    if(*c++!=':'){err="expected ':'";return 0;}
+    skipspace(c);
+    if(key=="overrides"){
+      if(*c++!='{'){err="overrides must be an object";return 0;}
+      skipspace(c);
+      while(*c && *c!='}'){
+	if(!readjstring(c, name)){err="expected an option name";return 0;}
+	if(name.substr(0, name.find(':')).size()>=50){err="option name "+name.substr(0, 50)+"... is too long";return 0;}
+	skipspace(c);
+	if(*c++!=':'){err="expected ':'";return 0;}
+	skipspace(c);
+	if(!readjnumber(c, &v)){err="option "+name+" must have a numerical value";return 0;}
+	if(rq->names.size()==MAXOVERRIDES){err="too many overrides";return 0;}
+	rq->names.push_back(name);rq->values.push_back(v);
+	skipspace(c);
+	if(*c==',') c++;
+	skipspace(c);
+      }
+      if(*c++!='}'){err="unterminated overrides";return 0;}
+    }
+    else if(key=="id"){
+      start=c;
+      if(*c=='"'){
+	if(!readjstring(c, name)){err="bad id";return 0;}
+      }
+      else if(!readjnumber(c, &v)){err="id must be a number or string";return 0;}
+      rq->id=std::string(start, c-start);
+    }
+    else if(*c=='"'){//(unknown key with a string value)
+      if(!readjstring(c, name)){err="bad string";return 0;}
+    }
+    else if(!strncmp(c, "true", 4) || !strncmp(c, "null", 4)){
+      v=(*c=='t');c+=4;
+      if(key=="days") rq->days=(int)v;
+    }
+    else if(!strncmp(c, "false", 5)){
+      c+=5;
+      if(key=="days") rq->days=0;
+    }
+    else{
+      if(!readjnumber(c, &v)){err="bad value for "+key;return 0;}
+      if(key=="seed"){
+	if(!jcount(v, 18446744073709549568.0)){err="seed must be an integer from 0 to 2^64-2048";return 0;}
+	rq->hasseed=1;rq->seed=(uint64_t)v;
+      }
+      else if(key=="runs"){
+	if(!jcount(v, MAXREQRUNS)){err="runs must be an integer from 0 to "+std::to_string(MAXREQRUNS);return 0;}
+	rq->runs=(int)v;
+      }
+      else if(key=="first_run"){
+	if(!jcount(v, INT_MAX-MAXREQRUNS)){err="first_run must be an integer from 0 to "+std::to_string(INT_MAX-MAXREQRUNS);return 0;}
+	rq->first=(int)v;
+      }
+      else if(key=="days") rq->days=(v!=0);
+    }
+    skipspace(c);
+    if(*c==',') c++;
+    skipspace(c);
+  }
+  if(*c!='}'){err="unterminated object";return 0;}
+  return 1;
+}
+
+//
+// The work queue and the workers
+//
+
+struct job{
+  std::shared_ptr<connection> conn;
+  request rq;
+};
+
+std::deque<job> jobs;
+std::mutex jobmutex;
+std::condition_variable jobready, jobsdone;
+int busy=0;//workers with a job
+char baseparams[200];
+uint64_t baseseed;
+
+void dojob(ca_run *r, job &jb){
+  request &rq=jb.rq;
+  ca_params *p;
+  ca_summary sm;
+  int row[CA_NUMCOLS], k, runs, i, st;
+  char buf[400];
+  struct timespec t0, t1;
+  std::vector<const char *> names;
+  std::string line;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for(k=0;k<(int)rq.names.size();k++)
+    names.push_back(rq.names[k].c_str());
+  if(!(p=ca_params_new(baseparams, rq.names.size(), names.empty()?NULL:&names[0], rq.values.empty()?NULL:&rq.values[0]))){
+    sendline(jb.conn.get(), "{\"id\":"+rq.id+",\"error\":"+jquote(ca_last_error())+"}\n");
+    return;
+  }
+  runs=rq.runs>=0?rq.runs:ca_params_num_runs(p);
+  if(runs<0 || runs>MAXREQRUNS){//(number_of_runs from the parameters)
+    snprintf(buf, 400, "number_of_runs must be from 0 to %d", MAXREQRUNS);
+    sendline(jb.conn.get(), "{\"id\":"+rq.id+",\"error\":"+jquote(buf)+"}\n");
+    ca_params_free(p);
+    return;
+  }
+  for(k=rq.first;k<rq.first+runs;k++){
+    st=ca_run_start(r, p, rq.hasseed?rq.seed:baseseed, k);
+    while(st>=0 && (st=ca_run_step(r, p, row))>0){
+      if(rq.days){
+	line="{\"id\":"+rq.id;
+	snprintf(buf, 400, ",\"run\":%d,\"row\":[%d", k, row[0]);
+	line+=buf;
+	for(i=1;i<CA_NUMCOLS;i++){
+	  snprintf(buf, 400, ",%d", row[i]);
+	  line+=buf;
+	}
+	line+="]}\n";
+	sendline(jb.conn.get(), line);
+      }
+    }
+    if(st<0){//the engine stopped: report it and give up on the request
+      snprintf(buf, 400, ",\"run\":%d,\"error\":", k);
+      sendline(jb.conn.get(), "{\"id\":"+rq.id+buf+jquote(ca_last_error())+"}\n");
+      ca_params_free(p);
+      return;
+    }
+    ca_run_summary(r, &sm);
+    snprintf(buf, 400, ",\"run\":%d,\"summary\":{\"actualR0\":%.4f,\"avdthtime\":%.4f,\"avrecovtime\":%.4f,\"avtesttime\":%.4f,\"avserotime\":%.4f,\"synced\":%d,\"delay\":%d,\"extinct\":%d}}\n", k, sm.actualR0, sm.avdthtime, sm.avrecovtime, sm.avtesttime, sm.avserotime, sm.synced, sm.delay, sm.extinct);
+    sendline(jb.conn.get(), "{\"id\":"+rq.id+buf);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  snprintf(buf, 400, ",\"done\":1,\"runs\":%d,\"trueR0\":%.4f,\"seconds\":%.6f}\n", runs, ca_params_trueR0(p), (t1.tv_sec-t0.tv_sec)+1e-9*(t1.tv_nsec-t0.tv_nsec));
+  sendline(jb.conn.get(), "{\"id\":"+rq.id+buf);
+  ca_params_free(p);
+}
+
+void worker(){
+  ca_run *r=ca_run_new();//kept warm between requests
+  while(1){
+    std::unique_lock<std::mutex> lock(jobmutex);
+    jobready.wait(lock, []{return !jobs.empty();});
+    job jb=jobs.front();
+    jobs.pop_front();
+    busy++;
+    lock.unlock();
+    dojob(r, jb);
+    lock.lock();
+    busy--;
+    if(jobs.empty() && busy==0)
+      jobsdone.notify_all();
+  }
+}
+
+// Read requests from a connection until it closes
+void reader(std::shared_ptr<connection> conn){
+  std::string pending, err;
+  char buf[4096];
+  ssize_t k;
+  size_t nl;
+  request rq;
+  while((k=read(conn->in, buf, sizeof(buf)))>0){
+    pending.append(buf, k);
+    while((nl=pending.find('\n'))!=std::string::npos){
+      std::string line=pending.substr(0, nl);
+      pending.erase(0, nl+1);
+      if(line.find_first_not_of(" \t\r")==std::string::npos)
+	continue;
+      if(!parserequest(line.c_str(), &rq, err)){
+	sendline(conn.get(), "{\"id\":"+rq.id+",\"error\":"+jquote(err)+"}\n");
+	continue;
+      }
+      std::lock_guard<std::mutex> lock(jobmutex);
+      jobs.push_back(job{conn, rq});
+      jobready.notify_one();
+    }
+    if(pending.size()>MAXREQUEST){
+      sendline(conn.get(), "{\"id\":null,\"error\":\"request too long\"}\n");
+      pending.clear();
+    }
+  }
+}
+
+int main(int argc, char *argv[]){
+  int numthreads=1, k, sock, fd;
+  const char *where=argc>2?argv[2]:"-";
+  char tempword[200];
+  struct sockaddr_un addr;
+  FILE *fdp;
+
+  if(argc<2){
+    fprintf(stderr, "Usage: %s <parameter_file> [<socket>|-] [threads]\n", argv[0]);
+    exit(0);
+  }
+  if(strlen(argv[1])>=200 || !(fdp=fopen(argv[1], "r"))){
+    fprintf(stderr, "ERROR: could not read parameter file \"%s\". EXITING.\n", argv[1]);
+    exit(0);
+  }
+  fclose(fdp);
+  strcpy(baseparams, argv[1]);
+  if(argc>3 && (numthreads=atoi(argv[3]))<1)
+    numthreads=1;
+  optwarn=0;
+  baseseed=(uint64_t)time(NULL);
+  if(getoption(baseparams, "seed", 1, tempword, 200)==0)
+    baseseed=(uint64_t)atoi(tempword);
+  signal(SIGPIPE, SIG_IGN);
+
+  for(k=0;k<numthreads;k++)
+    std::thread(worker).detach();
+
+  if(!strcmp(where, "-")){//stdin: finish when it ends and the work is done
+    reader(std::make_shared<connection>(0, 1));
+    std::unique_lock<std::mutex> lock(jobmutex);
+    jobsdone.wait(lock, []{return jobs.empty() && busy==0;});
+    _exit(0);//(the workers are still waiting for jobs; replies are unbuffered)
+  }
+
+  if(strlen(where)>=sizeof(addr.sun_path)){
+    fprintf(stderr, "ERROR: socket name \"%s\" is too long. EXITING.\n", where);
+    exit(0);
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family=AF_UNIX;
+  strcpy(addr.sun_path, where);
+  unlink(where);
+  if((sock=socket(AF_UNIX, SOCK_STREAM, 0))<0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr))<0 || listen(sock, 16)<0){
+    fprintf(stderr, "ERROR: could not listen on socket \"%s\". EXITING.\n", where);
+    exit(0);
+  }
+  fprintf(stderr, "listening on %s with %d threads\n", where, numthreads);
+  while(1){
+    if((fd=accept(sock, NULL, NULL))<0)
+      continue;
+    std::thread(reader, std::make_shared<connection>(fd, fd)).detach();
+  }
+  return 0;
+}
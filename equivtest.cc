@@ -0,0 +1,348 @@
+/* Copyright (C) 2021, Murad Banaji
+ *
+ * This file is part of COVIDAGENT
+ *
+ * COVIDAGENT is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3,
+ * or (at your option) any later version.
+ *
+ * COVIDAGENT is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with COVIDAGENT: see the file COPYING.  If not, see
+ * <https://www.gnu.org/licenses/>
+
+ */
+
+// Are two versions of the engine statistically equivalent? Compares the
+// runs in two output files of inf2.cc (or several such files joined
+// together, e.g. from different seeds; see equivtest.sh): the reference and
+// the candidate. For each of numinf, numdeaths, numtest and numsero on each
+// of a number of days, and for the delay to the synchronisation point, the
+// values over the runs are compared by two-sample Kolmogorov-Smirnov and
+// Anderson-Darling tests. The results are reported in a table, and the
+// candidate passes if no test rejects equality of the distributions after
+// a Holm-Bonferroni correction for the number of tests.
+//
+// The Kolmogorov-Smirnov p-value is the asymptotic one (Numerical Recipes,
+// section 14.3). The Anderson-Darling test is the k-sample test of F. W.
+// Scholz and M. A. Stephens ("K-sample Anderson-Darling tests", JASA, 1987)
+// in its form for data with ties, which are common here; the p-value is
+// interpolated from their critical values (and beyond the table
+// extrapolated, so only roughly right). With very few distinct values (e.g. small death counts) the
+// Kolmogorov-Smirnov test is conservative and the Anderson-Darling test
+// slightly liberal.
+//
+// Compile with "g++ -O2 -lm -std=gnu++11 equivtest.cc -o equivtest".
+// Run with "./equivtest <reference_output> <candidate_output> [alpha] [days]"
+// where alpha is the overall significance level (default 0.01) and days a
+// comma separated list of days (default: five days spread over the run).
+// The exit status is 0 if the candidate passes, 1 if it fails and 2 on
+// error.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#define MAXDAYS 100 // maximum number of days compared
+#define NUMCOLS 10 // columns of the output file
+
+// the quantities compared (columns of the output file)
+#define NUMQ 4
+const int qcols[NUMQ]={1, 4, 6, 9};
+const char *qnames[NUMQ]={"numinf", "numdeaths", "numtest", "numsero"};
+
+typedef std::vector<int> dayrow;
+typedef std::vector<dayrow> runout;
+
+// The runs in an output file, and the synchronisation options from its
+// header
+struct outfile{
+  std::vector<runout> runs;
+  double sync_at_test, sync_at_death, sync_at_inf, sync_at_time;
+};
+
+// One comparison
+struct testresult{
+  char name[50];
+  int n1, n2;
+  double mean1, mean2;
+  double D, pKS;//Kolmogorov-Smirnov
+  double T, pAD;//Anderson-Darling (standardised statistic)
+  int constant;//all values the same: nothing to test
+};
+
+void readoutfile(const char fname[], outfile *o){
+  FILE *fd;
+  char line[1000], name[100];
+  double val;
+  int i, n;
+  int v[NUMCOLS];
+  if(!(fd=fopen(fname, "r"))){
+    fprintf(stderr, "ERROR: could not open \"%s\". EXITING.\n", fname);
+    exit(2);
+  }
+  o->sync_at_test=-1;o->sync_at_death=-1;o->sync_at_inf=-1;o->sync_at_time=-1;
+  while(fgets(line, 1000, fd)){
+    if(line[0]=='#'){//options used
+      if(sscanf(line+1, "%99s %lf", name, &val)==2){
+	if(!strcmp(name, "sync_at_test")) o->sync_at_test=val;
+	else if(!strcmp(name, "sync_at_death")) o->sync_at_death=val;
+	else if(!strcmp(name, "sync_at_inf")) o->sync_at_inf=val;
+	else if(!strcmp(name, "sync_at_time")) o->sync_at_time=val;
+      }
+      continue;
+    }
+    n=sscanf(line, "%d %d %d %d %d %d %d %d %d %d", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8], &v[9]);
+    if(n!=NUMCOLS)//blank line between runs
+      continue;
+    if(v[0]==0 || o->runs.empty())//day 0 starts a run
+      o->runs.push_back(runout());
+    dayrow row(NUMCOLS);
+    for(i=0;i<NUMCOLS;i++)
+      row[i]=v[i];
+    o->runs.back().push_back(row);
+  }
+  fclose(fd);
+  if(o->runs.empty()){
+    fprintf(stderr, "ERROR: no runs in \"%s\". EXITING.\n", fname);
+    exit(2);
+  }
+}
+
+// The delay to the synchronisation point, as in inf2.cc (-1: not reached)
+int syncdelay(const outfile *o, const runout &r){
+  size_t m;
+  for(m=0;m<r.size();m++){
+    if((o->sync_at_test>0 && r[m][6]>=o->sync_at_test) || (o->sync_at_death>0 && r[m][4]>=o->sync_at_death) || (o->sync_at_inf>0 && r[m][1]>=o->sync_at_inf))
+      return (int)(m-o->sync_at_time);
+  }
+  return -1;
+}
+
+// Kolmogorov's Q(lambda)
+double probks(double lambda){
+  double a2=-2.0*lambda*lambda, fac=2.0, sum=0.0, term, termbf=0.0;
+  int j;
+  for(j=1;j<=100;j++){
+    term=fac*exp(a2*j*j);
+    sum+=term;
+    if(fabs(term)<=0.001*termbf || fabs(term)<=1.0e-8*sum)
+      return sum;
+    fac=-fac;
+    termbf=fabs(term);
+  }
+  return 1.0;//failed to converge (lambda near 0)
+}
+
+// Two-sample Kolmogorov-Smirnov (x and y sorted): statistic D and p-value
+void kstest(const std::vector<double> &x, const std::vector<double> &y, double *D, double *p){
+  size_t i=0, j=0;
+  double v, d, ne;
+  *D=0;
+  while(i<x.size() && j<y.size()){
+    v=x[i]<y[j]?x[i]:y[j];
+    while(i<x.size() && x[i]==v) i++;//all ties at once
+    while(j<y.size() && y[j]==v) j++;
+    d=fabs((double)i/x.size()-(double)j/y.size());
+    if(d>*D) *D=d;
+  }
+  ne=sqrt((double)x.size()*y.size()/(x.size()+y.size()));
+  *p=probks((ne+0.12+0.11/ne)*(*D));
+}
+
+// Two-sample Anderson-Darling (Scholz and Stephens, version for ties; x and
+// y sorted): standardised statistic T and p-value
+void adtest(const std::vector<double> &x, const std::vector<double> &y, double *T, double *p){
+  const std::vector<double> *smp[2]={&x, &y};
+  std::vector<double> z(x);
+  double N=x.size()+y.size(), A2=0, inner, lj, Bj, Mij, fij, H, h, g, a, b, c, d, sigmasq, hcs;
+  double crit[7], sig[7]={0.25, 0.1, 0.05, 0.025, 0.01, 0.005, 0.001};
+  const double b0[7]={0.675, 1.281, 1.645, 1.96, 2.326, 2.573, 3.085};
+  const double b1[7]={-0.245, 0.25, 0.678, 1.149, 1.822, 2.364, 3.615};
+  const double b2[7]={-0.105, -0.305, -0.362, -0.391, -0.396, -0.345, -0.154};
+  double S[5]={0, 0, 0, 0, 0}, R[3]={0, 0, 0}, M[3][3], det, q[3], u, lg;
+  size_t left, right, i, k;
+  int s, e, col;
+  z.insert(z.end(), y.begin(), y.end());
+  std::sort(z.begin(), z.end());
+  for(s=0;s<2;s++){
+    inner=0;
+    for(left=0;left<z.size();left=right){//each distinct value
+      for(right=left;right<z.size() && z[right]==z[left];right++);
+      lj=right-left;
+      Bj=left+lj/2.0;
+      Mij=std::upper_bound(smp[s]->begin(), smp[s]->end(), z[left])-smp[s]->begin();
+      fij=Mij-(std::lower_bound(smp[s]->begin(), smp[s]->end(), z[left])-smp[s]->begin());
+      Mij-=fij/2.0;
+      d=Bj*(N-Bj)-N*lj/4.0;
+      if(d>0)
+	inner+=lj/N*(N*Mij-Bj*smp[s]->size())*(N*Mij-Bj*smp[s]->size())/d;
+    }
+    A2+=inner/smp[s]->size();
+  }
+  A2*=(N-1.0)/N;
+
+  //standardise (k=2 samples)
+  H=1.0/x.size()+1.0/y.size();
+  hcs=0;g=0;
+  for(i=0;i+2<N;i++){//1/(N-1), 1/(N-2), ..., 1/2
+    hcs+=1.0/(N-1-i);
+    g+=hcs/(i+2);
+  }
+  h=hcs+1.0;
+  a=(4*g-6)+(10-6*g)*H;
+  b=(2*g-4)*4+8*h*2+(2*g-14*h-4)*H-8*h+4*g-6;
+  c=(6*h+2*g-2)*4+(4*h-4*g+6)*2+(2*h-6)*H+4*h;
+  d=(2*h+6)*4-4*h*2;
+  sigmasq=(a*N*N*N+b*N*N+c*N+d)/((N-1.0)*(N-2.0)*(N-3.0));
+  *T=(A2-1.0)/sqrt(sigmasq);
+
+  //p-value: quadratic least squares fit of log(significance) against the
+  //critical values (m=1)
+  for(e=0;e<7;e++){
+    crit[e]=b0[e]+b1[e]+b2[e];
+    lg=log(sig[e]);u=1;
+    for(k=0;k<5;k++){
+      S[k]+=u;
+      if(k<3) R[k]+=u*lg;
+      u*=crit[e];
+    }
+  }
+  for(k=0;k<3;k++)
+    for(col=0;col<3;col++)
+      M[k][col]=S[k+col];
+  det=M[0][0]*(M[1][1]*M[2][2]-M[1][2]*M[2][1])-M[0][1]*(M[1][0]*M[2][2]-M[1][2]*M[2][0])+M[0][2]*(M[1][0]*M[2][1]-M[1][1]*M[2][0]);
+  for(col=0;col<3;col++){//Cramer's rule
+    double Mc[3][3];
+    for(k=0;k<3;k++)
+      for(e=0;e<3;e++)
+	Mc[k][e]=(e==col)?R[k]:M[k][e];
+    q[col]=(Mc[0][0]*(Mc[1][1]*Mc[2][2]-Mc[1][2]*Mc[2][1])-Mc[0][1]*(Mc[1][0]*Mc[2][2]-Mc[1][2]*Mc[2][0])+Mc[0][2]*(Mc[1][0]*Mc[2][1]-Mc[1][1]*Mc[2][0]))/det;
+  }
+  if(*T<crit[0])
+    *p=sig[0];//(at least)
+  else if(*T>crit[6])//beyond the table the fit turns back up: extrapolate log(p) linearly
+    *p=sig[6]*exp((log(sig[6])-log(sig[5]))/(crit[6]-crit[5])*(*T-crit[6]));
+  else
+    *p=exp(q[0]+q[1]*(*T)+q[2]*(*T)*(*T));
+  if(*p>sig[0])
+    *p=sig[0];
+}
+
+void compare(std::vector<double> x, std::vector<double> y, const char *name, testresult *t){
+  size_t i;
+  strncpy(t->name, name, 49);t->name[49]=0;
+  t->n1=x.size();t->n2=y.size();
+  t->mean1=0;t->mean2=0;
+  for(i=0;i<x.size();i++) t->mean1+=x[i]/x.size();
+  for(i=0;i<y.size();i++) t->mean2+=y[i]/y.size();
+  t->D=0;t->pKS=1;t->T=0;t->pAD=1;t->constant=0;
+  if(x.size()<2 || y.size()<2){//too few runs
+    t->constant=1;
+    return;
+  }
+  std::sort(x.begin(), x.end());std::sort(y.begin(), y.end());
+  if(x.front()==x.back() && y.front()==y.back() && x.front()==y.front()){
+    t->constant=1;
+    return;
+  }
+  kstest(x, y, &t->D, &t->pKS);
+  adtest(x, y, &t->T, &t->pAD);
+}
+
+int main(int argc, char *argv[]){
+  outfile ref, cand;
+  std::vector<testresult> res;
+  std::vector<double> x, y, pv;
+  int days[MAXDAYS], numdays=0, totdays, d, q, k, failed=0, numtests;
+  size_t r, i;
+  double alpha=0.01;
+  char name[50], *tok;
+  testresult t;
+
+  if(argc<3){
+    fprintf(stderr, "Usage: %s <reference_output> <candidate_output> [alpha] [days]\n", argv[0]);
+    exit(2);
+  }
+  readoutfile(argv[1], &ref);
+  readoutfile(argv[2], &cand);
+  if(argc>3)
+    alpha=atof(argv[3]);
+  totdays=ref.runs[0].size();
+  for(r=0;r<ref.runs.size();r++)
+    if((int)ref.runs[r].size()<totdays) totdays=ref.runs[r].size();
+  for(r=0;r<cand.runs.size();r++)
+    if((int)cand.runs[r].size()<totdays) totdays=cand.runs[r].size();
+  if(argc>4){
+    for(tok=strtok(argv[4], ",");tok && numdays<MAXDAYS;tok=strtok(NULL, ",")){
+      d=atoi(tok);
+      if(d<0 || d>=totdays){
+	fprintf(stderr, "ERROR: day %d is outside the runs (0 to %d). EXITING.\n", d, totdays-1);
+	exit(2);
+      }
+      days[numdays++]=d;
+    }
+  }
+  else{
+    for(k=1;k<=5;k++)
+      days[numdays++]=(k*(totdays-1))/5;
+  }
+
+  for(q=0;q<NUMQ;q++){
+    for(k=0;k<numdays;k++){
+      x.clear();y.clear();
+      for(r=0;r<ref.runs.size();r++) x.push_back(ref.runs[r][days[k]][qcols[q]]);
+      for(r=0;r<cand.runs.size();r++) y.push_back(cand.runs[r][days[k]][qcols[q]]);
+      snprintf(name, 50, "%s day %d", qnames[q], days[k]);
+      compare(x, y, name, &t);
+      res.push_back(t);
+    }
+  }
+  if(ref.sync_at_test>0 || ref.sync_at_death>0 || ref.sync_at_inf>0){//the delay, over the runs which reach the synchronisation point
+    x.clear();y.clear();
+    for(r=0;r<ref.runs.size();r++)
+      if((d=syncdelay(&ref, ref.runs[r]))>=0) x.push_back(d);
+    for(r=0;r<cand.runs.size();r++)
+      if((d=syncdelay(&cand, cand.runs[r]))>=0) y.push_back(d);
+    compare(x, y, "delay", &t);
+    res.push_back(t);
+  }
+
+  //Holm-Bonferroni over all the p-values
+  for(i=0;i<res.size();i++){
+    if(!res[i].constant){
+      pv.push_back(res[i].pKS);pv.push_back(res[i].pAD);
+    }
+  }
+  numtests=pv.size();
+  std::sort(pv.begin(), pv.end());
+  double cutoff=-1;//p-values at or below this reject
+  for(i=0;i<pv.size();i++){
+    if(pv[i]>alpha/(numtests-i))
+      break;
+    cutoff=pv[i];
+  }
+
+  printf("reference: %s (%d runs)\ncandidate: %s (%d runs)\n", argv[1], (int)ref.runs.size(), argv[2], (int)cand.runs.size());
+  printf("quantity\tn_ref\tn_cand\tmean_ref\tmean_cand\tKS_D\tKS_p\tAD_T\tAD_p\tresult\n");
+  for(i=0;i<res.size();i++){
+    const testresult &u=res[i];
+    if(u.constant)
+      printf("%s\t%d\t%d\t%.4g\t%.4g\t-\t-\t-\t-\t%s\n", u.name, u.n1, u.n2, u.mean1, u.mean2, u.n1<2 || u.n2<2?"too few":"constant");
+    else{
+      k=(u.pKS<=cutoff || u.pAD<=cutoff);
+      failed+=k;
+      printf("%s\t%d\t%d\t%.4g\t%.4g\t%.4f\t%.4g\t%.3f\t%.4g\t%s\n", u.name, u.n1, u.n2, u.mean1, u.mean2, u.D, u.pKS, u.T, u.pAD, k?"FAIL":"pass");
+    }
+  }
+  printf("%s: %d of %d quantities differ (%d tests, Holm-Bonferroni at level %g)\n", failed?"FAIL":"PASS", failed, (int)res.size(), numtests, alpha);
+  return failed?1:0;
+}
@@ -0,0 +1,63 @@
+#!/bin/sh
+# Statistical equivalence of two versions of inf2.cc (see equivtest.cc).
+# Runs the reference and the candidate on each parameter file with seeds
+# 1 to <seeds>, pools the runs, and compares the distributions of numinf,
+# numdeaths, numtest, numsero and the delay to the synchronisation point.
+# The reference and candidate are executables, or source files (ending in
+# .cc), which are compiled, with the headers in this directory.
+#
+# Usage: ./equivtest.sh <reference> <candidate> [seeds] [runs] [parameter_files...]
+# (default 10 seeds of 20 runs each, on params/sampleparams and
+# params/basicparams2). The significance level can be set with ALPHA
+# (default 0.01), and compiler flags with FLAGS. The exit status is 0 if
+# the candidate passes on every parameter file.
+#
+# E.g. to check the working copy against the last commit:
+#   git show HEAD:inf2.cc > /tmp/inf2_ref.cc
+#   ./equivtest.sh /tmp/inf2_ref.cc inf2.cc
+
+if [ $# -lt 2 ]; then
+  echo "Usage: $0 <reference> <candidate> [seeds] [runs] [parameter_files...]"
+  exit 2
+fi
+REF=$1
+CAND=$2
+SEEDS=${3:-10}
+RUNS=${4:-20}
+shift 2; [ $# -gt 0 ] && shift; [ $# -gt 0 ] && shift
+PARAMS=${@:-"params/sampleparams params/basicparams2"}
+ALPHA=${ALPHA:-0.01}
+SRC=$(cd $(dirname $0) && pwd)
+DIR=$(mktemp -d)
+CXX=${CXX:-g++}
+FLAGS=${FLAGS:-"-O2 -lm -std=gnu++11 -pthread"}
+
+# engine <source_or_binary> <name>: the executable for a version
+engine(){
+  case $1 in
+    *.cc) $CXX $FLAGS -I$SRC $1 -o $DIR/$2 || exit 2;;
+    *) cp $1 $DIR/$2 || exit 2;;
+  esac
+}
+engine $REF ref
+engine $CAND cand
+$CXX -O2 -lm -std=gnu++11 $SRC/equivtest.cc -o $DIR/equivtest || exit 2
+
+status=0
+for pf in $PARAMS; do
+  echo "== $pf: $SEEDS seeds of $RUNS runs"
+  rm -f $DIR/out_ref $DIR/out_cand
+  s=1
+  while [ $s -le $SEEDS ]; do
+    printf "seed $s\nnumber_of_runs $RUNS\n" > $DIR/params #(options which come first take precedence)
+    cat $pf >> $DIR/params
+    for e in ref cand; do
+      (cd $DIR && ./$e params o_$e > /dev/null 2>&1) || { echo "ERROR: $e failed on $pf"; exit 2; }
+      cat $DIR/o_$e >> $DIR/out_$e
+    done
+    s=$((s+1))
+  done
+  $DIR/equivtest $DIR/out_ref $DIR/out_cand $ALPHA || status=1
+done
+rm -rf $DIR
+exit $status
@@ -0,0 +1,122 @@
+/* Copyright (C) 2021, Murad Banaji
+ *
+ * This file is part of COVIDAGENT
+ *
+ * COVIDAGENT is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3,
+ * or (at your option) any later version.
+ *
+ * COVIDAGENT is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with COVIDAGENT: see the file COPYING.  If not, see
+ * <https://www.gnu.org/licenses/>
+
+ */
+
+// Exact statistics of the number each individual infects when it is
+// gamma distributed: N=min(round(X), cap) with X gamma (shape, scale) and
+// cap=MAXDISCPROB-1. Since P(N>=k)=P(X>=k-1/2) for 1<=k<=cap, the moments
+// are finite sums of values of the regularised upper incomplete gamma
+// function Q, which is computed by its series or continued fraction
+// (as in Numerical Recipes, section 6.2).
+//
+// Results can be kept in a small text file, one line per (R0, shape, cap),
+// so that repeated launches just look them up.
+
+#ifndef GAMSTATS_H
+#define GAMSTATS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define GAMSTATS_EPS 1e-15
+#define GAMSTATS_ITMAX 1000
+
+// Q(a,x)=Gamma(a,x)/Gamma(a), for a>0, x>=0
+inline double gammaQ(double a, double x){
+  double sum, del, ap, b, c, d, h, an, lpre;
+  int i;
+  if(x<=0)
+    return 1.0;
+  lpre=-x+a*log(x)-lgamma(a);
+  if(x<a+1.0){//series for P(a,x)
+    ap=a;sum=del=1.0/a;
+    for(i=0;i<GAMSTATS_ITMAX;i++){
+      ap+=1.0;del*=x/ap;sum+=del;
+      if(fabs(del)<fabs(sum)*GAMSTATS_EPS)
+	break;
+    }
+    return 1.0-sum*exp(lpre);
+  }
+  //continued fraction for Q(a,x) (modified Lentz)
+  b=x+1.0-a;c=1.0/1e-300;d=1.0/b;h=d;
+  for(i=1;i<=GAMSTATS_ITMAX;i++){
+    an=-i*(i-a);b+=2.0;
+    d=an*d+b;if(fabs(d)<1e-300) d=1e-300;
+    c=b+an/c;if(fabs(c)<1e-300) c=1e-300;
+    d=1.0/d;del=d*c;h*=del;
+    if(fabs(del-1.0)<GAMSTATS_EPS)
+      break;
+  }
+  return exp(lpre)*h;
+}
+
+struct gamstats{
+  double mean;//the true R0
+  double sd;
+  double p0;//chance of infecting nobody
+  double pcap;//chance of being capped at cap
+};
+
+// Statistics of min(round(X), cap), X gamma with mean R0 and shape shp
+inline void roundedgammastats(double R0, double shp, int cap, gamstats *st){
+  double scl=R0/shp, q, m=0, m2=0;
+  int k;
+  st->p0=1.0-gammaQ(shp, 0.5/scl);
+  st->pcap=0;
+  for(k=1;k<=cap;k++){
+    q=gammaQ(shp, (k-0.5)/scl);//P(N>=k)
+    m+=q;m2+=(2*k-1)*q;
+    if(k==cap)
+      st->pcap=q;
+    if(q<1e-300)
+      break;
+  }
+  st->mean=m;
+  st->sd=m2>m*m?sqrt(m2-m*m):0;
+}
+
+// As roundedgammastats, but first looking in the table in file fname
+// (fname NULL or "none": no table). New values are appended to the table.
+// Returns 1 if the values came from the table.
+inline int cachedgammastats(const char *fname, double R0, double shp, int cap, gamstats *st){
+  FILE *fd;
+  double r, s;
+  int c;
+  gamstats e;
+  if(fname && strcmp(fname, "none") && (fd=fopen(fname, "r"))){
+    while(fscanf(fd, "%lf %lf %d %lf %lf %lf %lf", &r, &s, &c, &e.mean, &e.sd, &e.p0, &e.pcap)==7){
+      if(r==R0 && s==shp && c==cap){
+	fclose(fd);
+	*st=e;
+	return 1;
+      }
+    }
+    fclose(fd);
+  }
+  roundedgammastats(R0, shp, cap, st);
+  if(fname && strcmp(fname, "none") && (fd=fopen(fname, "a"))){//no table is not an error
+    fprintf(fd, "%.17g %.17g %d %.17g %.17g %.17g %.17g\n", R0, shp, cap, st->mean, st->sd, st->p0, st->pcap);
+    fclose(fd);
+  }
+  return 0;
+}
+
+#endif
@@ -18,9 +18,14 @@
 
  */
 
+#include <stdint.h>
+
 #define MAXAGE 25
 #define MAXDISCPROB 120
 
+class cbrng;
+class aliastable;
+
 class inf{
 
  protected:
@@ -39,6 +44,7 @@ class inf{
   int recov_time;
   int sero_time;//time to seroconversion (currently can't be longer than lifespan)
   int lastop_time;// when can it be destroyed?
+  uint64_t gid;//genealogical identity (inf2.cc)
 
   //constructors, etc
 
@@ -47,4 +53,13 @@ class inf{
   void setinftimes(int rmin, int rmax);//uniform distribution
   void setinftimes(double alpha, double beta);//gamma distribution
 
+  //as above, drawing from a given random number stream (inf2.cc)
+  inf(int orgnum, int P[], int maxP, cbrng &g);
+  inf(int orgnum, int ntoinf);//number to infect given
+  inf(int orgnum, const aliastable &A, cbrng &g);//alias method
+  inf(int orgnum, double alpha, double beta, cbrng &g);
+  void setinftimes(int rmin, int rmax, cbrng &g);
+  void setinftimes(double alpha, double beta, cbrng &g);
+  void setinftimes(const double t[]);//given times
+
 };
@@ -26,14 +26,28 @@
 
 
 #include "inf.h"
+#include "cbrng.h"
+#include "alias.h"
+#include "batchrng.h"
+#include "gamstats.h"
+#include "castore.h"
+#include "tdigest.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <math.h>
 #include <time.h> // random seeding
 #include <ctype.h>
 #include <string.h>
+#include <limits.h>
 #include <iostream>
 #include <random>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <string>
+#include <unistd.h> // fsync, truncate
 
 // Maximum number of infected individuals - memory limit?
 #define MAXINFS 10000000
@@ -42,8 +56,37 @@
 
 //Externally declared (bad practice I know!)
 
-int inflist[MAXINFS]; //For book-keeping free spaces in list
-std::default_random_engine generator;
+// Values which take precedence over those in the parameter file (used to
+// set the parameters of ABC particles). "num" is the position of the value
+// on the line, so e.g. "popleak:2" overrides the second lockdown's popleak.
+#define MAXOVERRIDES 50
+struct paramoverride{
+  char name[50];
+  int num;
+  char val[50];
+  int used;//asked for since it was set?
+};
+paramoverride overrides[MAXOVERRIDES];
+int numoverrides=0;
+int optwarn=1;//warn about options missing from the parameter file?
+
+// Errors in the engine end the program, except under the C interface
+// (covidagent.cc sets enginethrows), where they are thrown back to the
+// caller with the message kept in engineerrmsg
+int enginethrows=0;
+thread_local char engineerrmsg[300];
+struct engineexception{};
+
+void engineerror(const char *fmt, ...){
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(engineerrmsg, 300, fmt, ap);
+  va_end(ap);
+  fprintf(stderr, "%s", engineerrmsg);
+  if(enginethrows)
+    throw engineexception();
+  exit(0);
+}
 
 int getline(FILE *fp, char s[], int lim)
 {
@@ -87,12 +130,12 @@ int getnthblock(char *s, char *v, int len, int n){
     while(isspace((int) s[k])) // skip space
       k++;
     for(i=0;i<n-1;i++){
-      while(!(isspace((int) s[k]))) // skip first word 
+      while(s[k] && !(isspace((int) s[k]))) // skip first word (stopping at the end of a last line without a newline)
         k++;
       while(isspace((int) s[k])) //skip space
         k++;
     }
-    while((j<len-1) && !(isspace((int) s[k]))){ // get the word
+    while((j<len-1) && s[k] && !(isspace((int) s[k]))){ // get the word
       v[j++] = s[k++];
     }
     v[j++] = '\0';
@@ -107,14 +150,14 @@ int getnthblock(char *s, char *v, int len, int n){
 FILE *openftowrite(const char fname[]){
   FILE *fd;
   if(!(fd=fopen(fname, "w"))){
-    fprintf(stderr, "FILE \"%s\" could not be opened for writing. EXITING.\n", fname);exit(0);
+    engineerror("FILE \"%s\" could not be opened for writing. EXITING.\n", fname);
   }
   return fd;
 } 
 FILE *openftoread(const char fname[]){
   FILE *fd;
   if(!(fd=fopen(fname, "r"))){
-    fprintf(stderr, "FILE \"%s\" could not be opened for reading. EXITING.\n", fname);exit(0);
+    engineerror("FILE \"%s\" could not be opened for reading. EXITING.\n", fname);
   }
   return fd;
 } 
@@ -142,8 +185,7 @@ int readDataFile(const char fname[], int **data, int max){
     }
   }
   if(numlines>=max){
-    fprintf(stderr, "Data file \"%s\" too long to be read. EXITING.\n", fname);
-    exit(0);
+    engineerror("Data file \"%s\" too long to be read. EXITING.\n", fname);
   }
 
   fclose(fd);
@@ -152,15 +194,72 @@ int readDataFile(const char fname[], int **data, int max){
 
 }
 
+// A distribution of the number to infect: one probability (or weight) per
+// line, for 0, 1, 2, ... Returns the number of values.
+int readOffspringFile(const char fname[], double w[], int max){
+  FILE *fd;
+  int lim=1000;
+  char oneline[lim];
+  char val[50];
+  int num=0, len;
+  double tot=0;
 
-int getoption(char *fname, const char optname[], int num, char v[], int max){
+  fd=openftoread(fname);
+  while((len = getline(fd, oneline, lim)) > 0){
+    if ((oneline[0] == '#') || (oneline[0] == '/') || (oneline[0] == '\n') || (oneline[0] == '\0')){} // comment/empty lines
+    else{
+      if(num>=max){
+	engineerror("Offspring file \"%s\" has more than %d values. EXITING.\n", fname, max);
+      }
+      getnthblock(oneline, val, 50, 1);
+      w[num]=atof(val);
+      if(w[num]<0){
+	engineerror("Negative probability in offspring file \"%s\". EXITING.\n", fname);
+      }
+      tot+=w[num];
+      num++;
+    }
+  }
+  fclose(fd);
+  if(!(tot>0)){
+    engineerror("Offspring file \"%s\" has no positive probabilities. EXITING.\n", fname);
+  }
+  return num;
+}
+
+// The parameter file is read once and kept in memory: runs with many
+// sets of parameters (ABC, sweeps) call getoption() very many times.
+std::vector<std::string> optlines;
+char optfname[200]="";
+
+void loadoptions(char *fname){
   FILE *fd;
-  int len, j, flag=0;
   char oneline[200];
-  char modname[50];
-  int lim=200;
+  if(strcmp(fname, optfname)==0)
+    return;
   fd = openftoread(fname);
-  while((len = getline(fd, oneline, lim)) > 0){
+  optlines.clear();
+  while(getline(fd, oneline, 200) > 0)
+    optlines.push_back(oneline);
+  fclose(fd);
+  strncpy(optfname, fname, 199);optfname[199]='\0';
+}
+
+int getoption(char *fname, const char optname[], int num, char v[], int max){
+  int j, flag=0;
+  size_t l;
+  char oneline[200];
+  char modname[50];
+  for(j=0;j<numoverrides;j++){
+    if(overrides[j].num==num && strcmp(overrides[j].name, optname)==0){
+      strcpy(v, overrides[j].val);
+      overrides[j].used=1;
+      return 0;
+    }
+  }
+  loadoptions(fname);
+  for(l=0;l<optlines.size();l++){
+    strcpy(oneline, optlines[l].c_str());
     j=0;
     while((isspace((int) oneline[j])) || (oneline[j] == 13)){j++;}
     if ((oneline[j] == '/') || (oneline[j] == '\n') || (oneline[j] == '\0')){} // comment/empty lines
@@ -174,16 +273,15 @@ int getoption(char *fname, const char optname[], int num, char v[], int max){
         else{
 	  fprintf(stderr, "ERROR in routine getoption: Option %s in file %s has value %s which is too long.\n", optname, fname, modname);
 	  v[0] = '\0';
-	  fclose(fd);
 	  return -1;
         }
         break;
       }
     }
   }
-  fclose(fd);
   if(flag==0){
-    fprintf(stderr, "WARNING in routine getoption: Option %s could not be found in file %s. Setting to default value.\n", optname, fname);
+    if(optwarn)
+      fprintf(stderr, "WARNING in routine getoption: Option %s could not be found in file %s. Setting to default value.\n", optname, fname);
     v[0] = '\0';
     return -2;
   }
@@ -198,7 +296,8 @@ int getoptioni(char *fname, const char optname[], int defval, FILE *fd1){
     val=defval;
   else
     val=atoi(tempword);
-  fprintf(fd1, "#%s %d\n", optname, val);
+  if(fd1)
+    fprintf(fd1, "#%s %d\n", optname, val);
   return val;
 }
 
@@ -209,7 +308,8 @@ int getoption2i(char *fname, const char optname[], int defval, FILE *fd1){
     val=defval;
   else
     val=atoi(tempword);
-  fprintf(fd1, "#%s %d\n", optname, val);
+  if(fd1)
+    fprintf(fd1, "#%s %d\n", optname, val);
   return val;
 }
 
@@ -220,7 +320,8 @@ float getoptionf(char *fname, const char optname[], float defval, FILE *fd1){
     val=defval;
   else
     val=atof(tempword);
-  fprintf(fd1, "#%s %.4f\n", optname, val);
+  if(fd1)
+    fprintf(fd1, "#%s %.4f\n", optname, val);
   return val;
 }
 
@@ -231,23 +332,118 @@ float getoption2f(char *fname, const char optname[], float defval, FILE *fd1){
     val=defval;
   else
     val=atof(tempword);
-  fprintf(fd1, "#%s %.4f\n", optname, val);
+  if(fd1)
+    fprintf(fd1, "#%s %.4f\n", optname, val);
   return val;
 }
 
 
-int randnum(int max){
-  return rand()%max;
+// All lines starting with optname (for options which can be repeated)
+int getoptionlines(char *fname, const char optname[], char lines[][200], int maxlines){
+  int j, num=0;
+  size_t l;
+  char oneline[200];
+  char modname[50];
+  loadoptions(fname);
+  for(l=0;l<optlines.size();l++){
+    strcpy(oneline, optlines[l].c_str());
+    j=0;
+    while((isspace((int) oneline[j])) || (oneline[j] == 13)){j++;}
+    if ((oneline[j] == '/') || (oneline[j] == '\n') || (oneline[j] == '\0')){} // comment/empty lines
+    else{
+      getnthblock(oneline, modname, 50, 1);
+      if(strcmp(modname, optname) == 0 && num<maxlines)
+	strcpy(lines[num++], oneline);
+    }
+  }
+  return num;
+}
+
+// Override an option. "name:2" refers to the second value on the line.
+// Returns -1 (doing nothing) if the name is too long.
+int setoverride(const char name[], double val){
+  int j, num=1;
+  char nm[50];
+  const char *c;
+  size_t len=strlen(name);
+  if((c=strchr(name, ':'))!=NULL)
+    len=c-name;
+  if(len>=50){
+    fprintf(stderr, "ERROR: option name \"%s\" is too long to override.\n", name);
+    return -1;
+  }
+  memcpy(nm, name, len);nm[len]='\0';
+  if(c)
+    num=atoi(c+1);
+  for(j=0;j<numoverrides;j++){
+    if(overrides[j].num==num && strcmp(overrides[j].name, nm)==0)
+      break;
+  }
+  if(j==numoverrides){
+    if(numoverrides==MAXOVERRIDES){
+      engineerror("ERROR: too many parameter overrides (maximum %d). EXITING.\n", MAXOVERRIDES);
+    }
+    numoverrides++;
+  }
+  strcpy(overrides[j].name, nm);
+  overrides[j].num=num;
+  snprintf(overrides[j].val, 50, "%.10g", val);
+  overrides[j].used=0;
+  return 0;
 }
 
-int randpercentage(double perc){// to 1 d.p. Casting to int is flooring
+
+// true with probability perc% (to 1 d.p.), given u uniform on [0,1)
+int u01percentage(double perc, double u){
   int intperc=(int)(10.0*perc);
   //fprintf(stderr, "%d\n", intperc);
-  if (randnum(1000)<intperc)
+  if ((int)(u*1000)<intperc)
     return 1;
   return 0;
 }
 
+int randnum(int max, cbrng & generator){
+  return (int)(generator.u01()*max);
+}
+
+int randpercentage(double perc, cbrng & generator){// to 1 d.p. Casting to int is flooring
+  return u01percentage(perc, generator.u01());
+}
+
+// Exact samplers
+
+// Number of failures before the first success in trials with chance prob
+// of success: lets rare events be skipped to directly
+int geomskip(double prob, cbrng & generator){
+  double x;
+  if(prob>=1.0)
+    return 0;
+  if(prob<=0.0)
+    return INT_MAX;
+  x=floor(log(generator.u01open())/log1p(-prob));
+  return x<INT_MAX?(int)x:INT_MAX;
+}
+
+// Binomial(n, prob) by inversion of u uniform on [0,1) (n is small)
+int u01binomial(int n, double prob, double u){
+  double q, r, f, cdf;
+  int k=0;
+  if(prob<=0.0 || n<=0)
+    return 0;
+  if(prob>=1.0)
+    return n;
+  if(prob>0.5)//so that (1-prob)^n can't underflow
+    return n-u01binomial(n, 1.0-prob, 1.0-u);
+  q=1.0-prob;r=prob/q;
+  f=pow(q, n);cdf=f;
+  while(u>=cdf && k<n){
+    f*=r*(n-k)/(k+1);
+    k++;
+    cdf+=f;
+  }
+  return k;
+}
+
 
 
 long factorial(int x){
@@ -307,19 +503,18 @@ double binom(int n, int param){
       return 0.0;
   }
   else{
-    fprintf(stderr, "ERROR - invalid parameter in binom. EXITING.\n");
-    exit(0);
+    engineerror("ERROR - invalid parameter in binom. EXITING.\n");
   }
   return 0.0;
 }
 
 //Choose from binomial distribution (even parameter up to 6)
-int choosefrombin(int param){
+int choosefrombin(int param, cbrng & generator){
   int r;
   int tot;
   if(param==0)
     return 0;
-  r=randnum(1000)+1; //1 to 1000
+  r=randnum(1000, generator)+1; //1 to 1000
   tot=(int)(1000.0*binom(3,param));
   if(r<tot)
     return -3;
@@ -371,8 +566,8 @@ int *discGeom(double lamb, int max){
 }
 
 //Sample from a distribution with (cast to integers out of 1000)
-int choosefromdist(int P[], int totP){//P has totp+1 entries
-  int r=randnum(1000)+1; //1 to 1000
+int choosefromdist(int P[], int totP, cbrng & generator){//P has totp+1 entries
+  int r=randnum(1000, generator)+1; //1 to 1000
   int ct=totP;
   while(ct>0){
     if(r<P[ct])
@@ -387,40 +582,41 @@ int choosefromdist(int P[], int totP){//P has totp+1 entries
 // Gamma distribution
 //
 
-double gamma(double shp, double scl, std::default_random_engine & generator)
+// Distributions are local, so carry no state between calls: all the
+// random state of a run is in its cbrng.
+
+double gamma(double shp, double scl, cbrng & generator)
 {
-  static std::gamma_distribution<double> dist;
-  return dist(generator, std::gamma_distribution<double>::param_type(shp, scl));
+  std::gamma_distribution<double> dist(shp, scl);
+  return dist(generator);
 }
 
 //
 // Uniform distribution
 //
 
-double unif(double lend, double rend, std::default_random_engine & generator)
+double unif(double lend, double rend, cbrng & generator)
 {
-  static std::uniform_real_distribution<double> dist1;
-  return dist1(generator, std::uniform_real_distribution<double>::param_type(lend, rend));
+  return lend+(rend-lend)*generator.u01();
 }
 
 //
 // uniform distribution on integers
 //
 
-int unifi(int lend, int rend, std::default_random_engine & generator)
+int unifi(int lend, int rend, cbrng & generator)
 {
-  static std::uniform_int_distribution<int> dist1;
-  return dist1(generator, std::uniform_int_distribution<int>::param_type(lend, rend));
+  return lend+(int)(generator.u01()*(rend-lend+1));
 }
 
 //
 // normal distribution
 //
 
-double norml(double mean, double stdev, std::default_random_engine & generator)
+double norml(double mean, double stdev, cbrng & generator)
 {
-  static std::normal_distribution<double> dist1;
-  return dist1(generator, std::normal_distribution<double>::param_type(mean, stdev));
+  std::normal_distribution<double> dist1(mean, stdev);
+  return dist1(generator);
 }
 
 
@@ -438,16 +634,34 @@ double norml(double mean, double stdev, std::default_random_engine & generator)
 // range of values
 
 //In case of any user-defined distribution
-inf::inf(int orgnum, int P[], int maxP){
+inf::inf(int orgnum, int P[], int maxP, cbrng &generator){
+  age = 0;
+  ill = 0;
+  quar = 0;
+  num = orgnum;
+  numtoinf=choosefromdist(P, maxP, generator);
+}
+
+//number to infect given
+inf::inf(int orgnum, int ntoinf){
+  age = 0;
+  ill = 0;
+  quar = 0;
+  num = orgnum;
+  numtoinf=ntoinf;
+}
+
+//from an alias table
+inf::inf(int orgnum, const aliastable &A, cbrng &generator){
   age = 0;
   ill = 0;
   quar = 0;
   num = orgnum;
-  numtoinf=choosefromdist(P, maxP);
+  numtoinf=A.draw(generator);
 }
 
 //in case of gamma distribution
-inf::inf(int orgnum, double shp, double scl){
+inf::inf(int orgnum, double shp, double scl, cbrng &generator){
   age = 0;
   ill = 0;
   quar = 0;
@@ -460,7 +674,7 @@ inf::inf(int orgnum, double shp, double scl){
 
 
 // Set the times at which infection occurs: uniform distribution C++ generator
-void inf::setinftimes(int rmin, int rmax){
+void inf::setinftimes(int rmin, int rmax, cbrng &generator){
   int i; 
   for(i=0;i<numtoinf;i++){
     inftimes[i]=unifi(rmin, rmax, generator);
@@ -468,8 +682,24 @@ void inf::setinftimes(int rmin, int rmax){
   }
 }
 
+// Set the infection times from t[0..numtoinf-1] (e.g. gamma variates)
+void inf::setinftimes(const double t[]){
+  int i; 
+  int num;
+  for(i=0;i<numtoinf;i++){
+    num = int(round(t[i]));
+    if(num>0 && num<MAXAGE)
+      inftimes[i]=num;
+    else if(num>=MAXAGE)
+      inftimes[i]=MAXAGE-1;
+    else
+      inftimes[i]=1;
+    (infnums[inftimes[i]])++;
+  }
+}
+
 //Set the times at which infection occurs: gamma distribution
-void inf::setinftimes(double shp, double scl){
+void inf::setinftimes(double shp, double scl, cbrng &generator){
   int i; 
   int num;
   for(i=0;i<numtoinf;i++){
@@ -487,7 +717,7 @@ void inf::setinftimes(double shp, double scl){
 // The first available position in the list
 int firstfreepos(int *inflist, int maxinfs){
   int i;
-  for(i=0;i<MAXINFS;i++){
+  for(i=0;i<maxinfs;i++){
     if(inflist[i]==0)
       return i;
   }
@@ -574,746 +804,3112 @@ void free_dmatrix(double **m, long nrl, long nrh, long ncl, long nch){
 }
 
 
-int nextpos=0;// only needed if not freeing
-
-int create(inf *infs[], int gamswtch, double alpha, double beta, int P[], int maxP, int inf_gam, int inf_start, int inf_end, double inf_mid, double inf_tm_shp, int *numinf, int *numcurinf, int *newinfs, int *numill, double percill, double percdeath, double time_to_death, double dist_on_death, double time_to_recovery, double dist_on_recovery, double time_to_sero, double dist_on_sero, double quardate, double quarp, double dist_on_quardate, double testp, double testdelay, double testdelay_shp){
-  int i=firstfreepos(inflist, MAXINFS);
-  //int i=nextpos++;
-  int j;
-  double inf_scl=inf_mid/inf_tm_shp;
-  if(i==-1){//no more space
-    fprintf(stderr, "Ran out of space in list - you can consider resetting MAXINFS. EXITING.\n");
-    exit(0);
-  }
-  if(!gamswtch)
-    infs[i] = new inf(i, P, maxP);
-  else
-    infs[i] = new inf(i, alpha, beta);
-  (*numinf)++;(*numcurinf)++;(*newinfs)++;
-
-  if(dist_on_sero>=0)//discrete simple
-    infs[i]->sero_time=(int)time_to_sero+choosefrombin((int)dist_on_sero);
-  else//normal dist., -dist_on_sero=stdev
-    infs[i]->sero_time=int(round(norml(time_to_sero, -dist_on_sero, generator)));
-
-  for(j=0;j<MAXAGE;j++){//number to infect at time j
-    infs[i]->infnums[j]=0;
-  }
-  // who falls ill?
-  // Currently unused - left in for potential use
-  if(randpercentage(percill)){
-    if(randpercentage(percdeath)){
-      infs[i]->ill=-1;//falls ill and dies
-      if(dist_on_death>=0)//discrete simple
-	infs[i]->dth_time=(int)time_to_death+choosefrombin((int)dist_on_death);
-      else//normally distributed, -dist_on_death=stdev
-	infs[i]->dth_time=int(round(norml(time_to_death, -dist_on_death, generator)));
-
-    }
-    else{
-      infs[i]->ill=1;//falls ill but recovers
-      if(dist_on_recovery>=0)
-	infs[i]->recov_time=(int)time_to_recovery+choosefrombin((int)dist_on_recovery);
-      else{//normal dist, -dist_on_recovery=stdev
-	infs[i]->recov_time=int(round(norml(time_to_recovery, -dist_on_recovery, generator)));
-	// if(infs[i]->recov_time>MAXAGE)
-	//   fprintf(stderr, "recov_time=%d\n", infs[i]->recov_time);
-      }
-    }
-    (*numill)++;
-    //fprintf(stderr, "ill=%d\n", infs[i]->ill);
-  }
-  else{//won't fall ill
-    if(dist_on_recovery>=0)
-      infs[i]->recov_time=(int)time_to_recovery+choosefrombin((int)dist_on_recovery);
-    else//normal dist, -dist_on_recovery=stdev
-      infs[i]->recov_time=int(round(norml(time_to_recovery, -dist_on_recovery, generator)));
-  }
-
-  infs[i]->quardt=100;infs[i]->testdt=100;//default no quarantining/testing
-  if(randpercentage(quarp)){//to quarantine?
-    if(dist_on_quardate>=0)
-      infs[i]->quardt=(int)quardate+choosefrombin((int)dist_on_quardate);
-    else
-      infs[i]->quardt=int(round(norml(quardate, -dist_on_quardate, generator)));
-
-    if(randpercentage(testp)){// to test?
-      if(testdelay==0 || testdelay_shp<0)
-	infs[i]->testdt=infs[i]->quardt + testdelay;//testing on fixed day after quarantine date
-      else//testing delay follows a gamma distribution
-	infs[i]->testdt=infs[i]->quardt+int(round(gamma(testdelay_shp, testdelay/testdelay_shp, generator)));
-    }
-  }
-
-  //last operation (one greater than last operation)
-  if(infs[i]->ill==-1){//dies (last op. is testing or death)
-    infs[i]->lastop_time=infs[i]->dth_time;
-    if(infs[i]->testdt!=100 && infs[i]->testdt > infs[i]->lastop_time)
-      infs[i]->lastop_time=infs[i]->testdt;
-  }
-  else{//recovers (last op. is testing, death or seroconversion)
-    infs[i]->lastop_time=infs[i]->recov_time;
-    if(infs[i]->testdt!=100 && infs[i]->testdt > infs[i]->lastop_time)
-      infs[i]->lastop_time=infs[i]->testdt;
-    if(infs[i]->sero_time > infs[i]->lastop_time)
-      infs[i]->lastop_time=infs[i]->sero_time;
-  }
-  (infs[i]->lastop_time)++;
-
-  //set infection times
-  if(inf_gam)//gamma distributed
-    infs[i]->setinftimes(inf_tm_shp, inf_scl);
-  else
-    infs[i]->setinftimes(inf_start, inf_end);
-  
-  inflist[i]=1;
-  return i;
 
-}
 
-void die(inf *a){//clear list position and delete
-  inflist[a->num]=0;
-  delete a;
-  return;
-}
+#define MAXTARGETS 10
+#define MAXQUANT 20
+const double defquant[]={0.025, 0.25, 0.5, 0.75, 0.975};//quantiles over runs written by default
+#define MAXSPLITS 10
+#define MAXINTERVENTIONS 20
 
+// An intervention, such as a lockdown. Interventions form a timeline: each
+// starts on the first day on which any of its triggers is reached, once the
+// one before it has started (and replaces it), and lasts len days.
+struct intervention{
+  int at_day, at_inf, at_test, at_dth;//triggers (-1: not used)
+  int after;//trigger: days after the previous intervention started (-1: not used)
+  int len;
+  float infectible_proportion;//of the total population, on its first day
+  float pdeff;//effectiveness of physical distancing during it
+  double popleak;//leak into infectible population on its days popleak_start_day to popleak_end_day
+  int popleak_start_day, popleak_end_day;
+  double *effpop;//effective population on each of its days (set by setupparams)
+};
 
+// the columns of the output
+const char *colnames[10]={"day", "numinf", "newinfs", "numcurinf", "numdeaths", "newdeaths", "numtest", "newtests", "numinfectious", "numsero"};
 
-int main(int argc, char *argv[]){
-  int timeint;
-  time_t timepoint;
-  int i, tmpi, j, m, r, cur, num_runs;//number of runs
-  int maxP;
-  double R0;
-  double trueR0,actualR0;
-  int *P;
-  int totdays;//total simulation length
-  inf **infs=infar(0, MAXINFS-1);
-  int init_infs;
-  double avdthtime, avrecovtime, avtesttime, avserotime;
-  int numdeaths, newdeaths, numrecovs;
+// All the model parameters
+struct params{
+  int num_runs;//number of runs
   float dthrate;//percentage. A key parameter
   int geometric;//geometric or poisson or gamma? (geometric = 1, poisson = 0, gamma = -1)
-  int gamswtch=0;
-  // in case of gamma distribution
-  double infscl=1.0;//scale for num to infect distribution
-  double infshp;//shape for num to infect distribution
-  int numinf;//number infected (cumulative)
-  int numcurinf;//number currently infected
-  int numcurinfold=0;
-  int numinfectious;// number in the infectious window
-  int newinfs; // number of new infections this time step. 
-  int numquar;//number quarantined (cumulative)
-  int numtest,newtests;//number tested (cumulative) and new
-  int numill;//number ill (cumulative)
-  int numsero;//cumulative seroconversion
-  double percill;//percentage who fall (seriously) ill
-  double percdeath;//percentage of ill who die
-  //physical distancing?
-  int haspd;//boolean
-  int pd_at_dth;//pd starts at nth death
-  int pd_at_test;//pd starts at nth tested infection
-  int pd_at_inf;//pd starts at nth infection
-  float pdeff1;//effectiveness of physical distancing
-  float pdeff;//effectiveness of physical distancing. E.g. 40% - removes 2 in 5 contacts
-  int pd;//physical distancing is occurring
+  int numoffprob;//if positive, the number to infect follows offprob[0..numoffprob-1] instead
+  double offprob[MAXDISCPROB+1];
+  int quantised_offspring;//sample from the old tables of integers out of 1000?
+  int quantised_percentages;//chances to 0.1% only, one draw per person for death (as in earlier versions)?
+  int independent_transmissions;//are an individual's infections on a day prevented independently, or all or none?
+  int batched_sampling;//normal and gamma variates by the ziggurat and Marsaglia-Tsang methods, in batches?
+  int herd_update;//herd immunity level: 0 for each infector, 1 once a day, 2 for each infection (sequential depletion)
+  double R0;
+  double infshp;//shape for num to infect distribution (gamma distribution)
+  char dist_cache[200];//file keeping trueR0 values between launches
+  int totdays;//total simulation length
+  double totpop;// total population (only relevant if herd=1)
   int inf_gam;//to gamma distribute infection times or not
   int inf_start, inf_end; //start and end of infective window
   double inf_mid, inf_tm_shp; // mean and shape parameter if gamma distributed
   double time_to_death, time_to_recovery, time_to_sero;//self explanatory
   double dist_on_death, dist_on_recovery, dist_on_sero;//binomial distributions: values 0,2,4,6
+  int init_infs;
+  int herd;//herd immunity?
   double quarp;//percentage who get quarantined
   double testp;//percentage *of those quarantined* who are tested
   double quardate;//Currently assume all tests occur on a particular day in the infection cycle. Only those tested are quarantined. India: 10? UK: 12?
   double dist_on_quardate;//distribution on quardate
   double testdelay, testdelay_shp;
 
-  double totpop;// total population (only relevant if herd=1)
-  double effpop;//effective population (only relevant if herd=1)
-
   int haslockdown;//lockdown?
-  int lockdownlen, lockdown2len;//length of lockdown
-  int lockdownday, lockdown2day, lockdown2startday;//how many days into lockdown?
-  float pdeff_lockdown, pdeff_lockdown2;//effectiveness of physical distancing post lockdown
   int lockdown_at_dth;//The lockdown begins after the death number lockdown_at_dth. UK ~200, India ~10
   int lockdown_at_test;//The lockdown begins after test number lockdown_at_test.
   int lockdown_at_inf;//The lockdown begins after infection number lockdown_at_inf.
-
-  double popleak, popleak2;//leak into effective population post lockdown (an absolute value at the moment)
-  int popleak_start_day=0, popleak2_start_day=0, popleak_end_day, popleak2_end_day;
+  int lockdownlen, lockdown2len;//length of lockdown
+  int lockdown2startday;
   float infectible_proportion, infectible_proportion2;//default infectible proportion at lockdown
+  float pdeff_lockdown, pdeff_lockdown2;//effectiveness of physical distancing post lockdown
+  double popleak, popleak2;//leak into effective population post lockdown (an absolute value at the moment)
+  int popleak_start_day, popleak2_start_day, popleak_end_day, popleak2_end_day;
+  int numiv;
+  intervention iv[MAXINTERVENTIONS];//"intervention" lines, or the lockdowns above
 
-  int herd;//herd immunity?
-  double herdlevel=0;
-  char paramfilename[200], outfilename[200], endfname[206], logfname[204], datafilename[200];
-  char tempword[200];
-  FILE *fd, *fd1, *fd5, *fd6, *fd7; //files to store output
-  int **alloutput;//to store all the simulation output
-  double **avoutput, **SEoutput;//to store average, SE of output, synchronised
-  double tmpSD;
-  int *delays, totsims, maxdel;
-  //FILE *fd3;
+  //physical distancing?
+  int haspd;//boolean
+  int pd_at_dth;//pd starts at nth death
+  int pd_at_test;//pd starts at nth tested infection
+  int pd_at_inf;//pd starts at nth infection
+  float pdeff1;//effectiveness of physical distancing
 
   //For the purposes of synchronising with data
-  int syncflag=0;
   int sync_at_test;//at test number
   int sync_at_death;//at death number
   int sync_at_inf;//at infection number
   int sync_at_time;
-  int syncclock=0;//start counting after synchronisation
 
-  //These parameters are relevant if we want to 
-  //run simulations upto or a certain number of days
-  //beyond a particular death trigger
-  //Currently hard-wired in, to avoid overloading parameter files
-  int topresent=0;//only simulate to a fixed day namely "presentday" days after "trigger_dths" deaths or "trigger_infs" infections
-  int trigger_dths=1;//Number of deaths which trigger the clock. Not for synchronisation
-  int trigger_infs=0;//Number of infections which trigger the clock. Not for synchronisation
-  int startinfs, endinfs;
-  int presentday=1;//Number of days to run after trigger
-  int startclock=0;//The clock
+  int scale_at_infs;
 
-  //for doubling times
-  int totdoubling=0;
-  double avdoubling=0;
-  double avinfs, avdths;//average infections and deaths at trigger point
+  int crn;//common random numbers?
 
-  //
-  int multiplier=1;
-  int dynmultiply;//dynamic to speed up computation
-  int cur_exp=1;
-  int scale_at_infs;
+  //adaptive number of runs: stop once the relative SE of each target output is below target_rse
+  double target_rse;
+  int min_runs;//num_runs is the maximum
+  int numtargets;
+  int targetcol[MAXTARGETS];//which output
+  int targetday[MAXTARGETS];//value on this day, or the peak if -1
 
-  //data file
-  int maxdat=1000, totdata=0;
-  int **realdata=imatrix(0, maxdat-1, 0, 2);
+  //importance splitting: runs are copied on reaching these infection numbers
+  int numsplits;
+  int splitlevels[MAXSPLITS];//increasing
+  int split_factor;//copies made at each level
 
+  //derived quantities (set by setupparams)
+  int gamswtch;
+  double infscl;//scale for num to infect distribution
+  int maxP;
+  int *P;//old style table (cumulative, out of 1000)
+  aliastable *offspring;//distribution of the number to infect (if not gamma)
+  gamstats infstats;//exact statistics of the number to infect (gamma case, set by gettrueR0)
+  double percill;//percentage who fall (seriously) ill
+  double percdeath;//percentage of ill who die
+  double pdie, pillrec;//chance of dying, and of falling ill for those who don't die
+  int dynmultiply;//dynamic to speed up computation
 
-  if(argc < 2){
-    fprintf(stderr, "ERROR: you must provide a parameter file name. You may also provide an output file name.\n");
-    exit(0);
-  }
-  strncpy (paramfilename, argv[1], sizeof(paramfilename));
-  if(argc>=3)
-    strncpy (outfilename, argv[2], sizeof(outfilename));
-  else
-    strcpy(outfilename, "data1/tmp");//default output file
+  int result_store;//write the binary store of all output (1), and none of the _av, _sync1 and _sync files (2)?
+  int numquant;
+  double quant[MAXQUANT];//quantiles over runs for the _quant file, increasing (none: no file)
+  int quantile_method;//0: exact, 1: streaming estimates (t-digests)
+  int sync_file;//write the _sync file?
 
-  fd1=openftowrite(outfilename); //tab separated output
-  strcpy(endfname, outfilename);strcat(endfname, "_av");
-  fd5=openftowrite(endfname); //tab separated output - average values
-  strcpy(endfname, outfilename);strcat(endfname, "_sync1");
-  fd6=openftowrite(endfname); //tab separated output - average values
-  strcpy(endfname, outfilename);strcat(endfname, "_sync");
-  fd7=openftowrite(endfname); //tab separated output - values after synchronisation
+  int verbose;//progress to stderr?
+};
 
-  strcpy(logfname, outfilename);strcat(logfname, "_log");
-  fd=openftowrite(logfname); //log file
+// Read the parameters from a parameter file (and any overrides). The
+// values used are recorded in fd1 unless it is NULL.
+void readparams(char *paramfilename, params *p, FILE *fd1){
+  char tempword[200];
 
   //options: general
-  num_runs=getoptioni(paramfilename, "number_of_runs", 10, fd1);//model runs
-  dthrate=getoptionf(paramfilename, "death_rate", 0.5, fd1);//death rate
-  geometric=getoptioni(paramfilename, "geometric", 0, fd1);//default is Poisson distribution
-  R0=getoptionf(paramfilename, "R0", 3.5, fd1);//basic reproduction number (approximately)
-  infshp=getoptionf(paramfilename, "infshp", 0.1, fd1);//shape param
-  totdays=getoptioni(paramfilename, "totdays", 150, fd1);//total simulation length
-  totpop=getoptionf(paramfilename, "population", 66000000, fd1);//population
-  inf_gam=getoptioni(paramfilename, "inf_gam", 0, fd1);//use gamma distribution for infection times? Default is no
-  inf_start=getoptioni(paramfilename, "inf_start", 2, fd1);//start of infective window
-  inf_end=getoptioni(paramfilename, "inf_end", 9, fd1);//end of infective window
+  p->num_runs=getoptioni(paramfilename, "number_of_runs", 10, fd1);//model runs
+  p->dthrate=getoptionf(paramfilename, "death_rate", 0.5, fd1);//death rate
+  p->geometric=getoptioni(paramfilename, "geometric", 0, fd1);//default is Poisson distribution
+  p->R0=getoptionf(paramfilename, "R0", 3.5, fd1);//basic reproduction number (approximately)
+  p->infshp=getoptionf(paramfilename, "infshp", 0.1, fd1);//shape param
+  if(getoption(paramfilename, "dist_cache_file", 1, p->dist_cache, 200)!=0)//table of trueR0 values ("none": no table)
+    strcpy(p->dist_cache, "distcache");
+  if(fd1)
+    fprintf(fd1, "#dist_cache_file %s\n", p->dist_cache);
+  p->numoffprob=0;
+  if(getoption(paramfilename, "offspring_file", 1, tempword, 200)==0){//distribution of the number to infect from a file
+    p->numoffprob=readOffspringFile(tempword, p->offprob, MAXDISCPROB+1);
+    if(fd1)
+      fprintf(fd1, "#offspring_file %s\n", tempword);
+  }
+  p->quantised_offspring=getoptioni(paramfilename, "quantised_offspring", 0, fd1);//old style tables?
+  p->quantised_percentages=getoptioni(paramfilename, "quantised_percentages", 0, fd1);//old style chances?
+  p->independent_transmissions=getoptioni(paramfilename, "independent_transmissions", 0, fd1);
+  p->batched_sampling=getoptioni(paramfilename, "batched_sampling", 1, fd1);
+  p->herd_update=getoptioni(paramfilename, "herd_update", 0, fd1);
+  p->totdays=getoptioni(paramfilename, "totdays", 150, fd1);//total simulation length
+  p->totpop=getoptionf(paramfilename, "population", 66000000, fd1);//population
+  p->inf_gam=getoptioni(paramfilename, "inf_gam", 0, fd1);//use gamma distribution for infection times? Default is no
+  p->inf_start=getoptioni(paramfilename, "inf_start", 2, fd1);//start of infective window
+  p->inf_end=getoptioni(paramfilename, "inf_end", 9, fd1);//end of infective window
   // if infection times are gamma distributed
-  inf_mid=getoptionf(paramfilename, "inf_mid", 6, fd1);//mean infection time
-  inf_tm_shp=getoptionf(paramfilename, "inf_tm_shp", 4, fd1);//shape parameter for infection time
-
-  time_to_death=getoptionf(paramfilename, "time_to_death", 17, fd1);//survival time
-  dist_on_death=getoptionf(paramfilename, "dist_on_death", -3, fd1);//distribution on time_to_death. Default = none
-  time_to_recovery=getoptionf(paramfilename, "time_to_recovery", 20, fd1);//recovery time
-  dist_on_recovery=getoptionf(paramfilename, "dist_on_recovery", -2, fd1);//distribution on time_to_recovery
-  time_to_sero=getoptionf(paramfilename, "time_to_sero", 14, fd1);//seroconversion time
-  dist_on_sero=getoptionf(paramfilename, "dist_on_sero", -3, fd1);//distribution on time_to_sero
-
-  init_infs=getoptioni(paramfilename, "initial_infections", 10, fd1);//initial number infected
-  herd=getoptioni(paramfilename, "herd", 1, fd1);//herd immunity?
+  p->inf_mid=getoptionf(paramfilename, "inf_mid", 6, fd1);//mean infection time
+  p->inf_tm_shp=getoptionf(paramfilename, "inf_tm_shp", 4, fd1);//shape parameter for infection time
+
+  p->time_to_death=getoptionf(paramfilename, "time_to_death", 17, fd1);//survival time
+  p->dist_on_death=getoptionf(paramfilename, "dist_on_death", -3, fd1);//distribution on time_to_death. Default = none
+  p->time_to_recovery=getoptionf(paramfilename, "time_to_recovery", 20, fd1);//recovery time
+  p->dist_on_recovery=getoptionf(paramfilename, "dist_on_recovery", -2, fd1);//distribution on time_to_recovery
+  p->time_to_sero=getoptionf(paramfilename, "time_to_sero", 14, fd1);//seroconversion time
+  p->dist_on_sero=getoptionf(paramfilename, "dist_on_sero", -3, fd1);//distribution on time_to_sero
+
+  p->init_infs=getoptioni(paramfilename, "initial_infections", 10, fd1);//initial number infected
+  if(p->init_infs<0 || p->init_infs>=MAXINFS)
+    engineerror("ERROR: initial_infections must be between 0 and %d. EXITING.\n", MAXINFS-1);
+  p->herd=getoptioni(paramfilename, "herd", 1, fd1);//herd immunity?
   //options: quarantine and testing
-  quarp=getoptionf(paramfilename, "percentage_quarantined", 4, fd1);//percentage of infecteds who are quarantined
-  testp=getoptionf(paramfilename, "percentage_tested", 100, fd1);//the percentage *of those quarantined* who are tested
+  p->quarp=getoptionf(paramfilename, "percentage_quarantined", 4, fd1);//percentage of infecteds who are quarantined
+  p->testp=getoptionf(paramfilename, "percentage_tested", 100, fd1);//the percentage *of those quarantined* who are tested
   if(getoption(paramfilename, "quardate", 1, tempword, 200)==0)
-    quardate=getoptionf(paramfilename, "quardate", 12, fd1);//mean date of testing and quarantining
+    p->quardate=getoptionf(paramfilename, "quardate", 12, fd1);//mean date of testing and quarantining
   else//legacy
-    quardate=getoptionf(paramfilename, "testdate", 12, fd1);//mean date of testing and quarantining
+    p->quardate=getoptionf(paramfilename, "testdate", 12, fd1);//mean date of testing and quarantining
   if(getoption(paramfilename, "dist_on_quardate", 1, tempword, 200)==0)
-    dist_on_quardate=getoptionf(paramfilename, "dist_on_quardate", -3, fd1);//distribution on quarantine date
+    p->dist_on_quardate=getoptionf(paramfilename, "dist_on_quardate", -3, fd1);//distribution on quarantine date
   else//legacy
-    dist_on_quardate=getoptionf(paramfilename, "dist_on_testdate", -3, fd1);//distribution on quarantine date
-  testdelay=getoptionf(paramfilename, "testdelay", 0, fd1);//mean delay from quarantining to testing
-  testdelay_shp=getoptionf(paramfilename, "testdelay_shp", -1, fd1);//distribution on delay between quarantining and testing
+    p->dist_on_quardate=getoptionf(paramfilename, "dist_on_testdate", -3, fd1);//distribution on quarantine date
+  p->testdelay=getoptionf(paramfilename, "testdelay", 0, fd1);//mean delay from quarantining to testing
+  p->testdelay_shp=getoptionf(paramfilename, "testdelay_shp", -1, fd1);//distribution on delay between quarantining and testing
   //options: lockdown
-  haslockdown=getoptioni(paramfilename, "haslockdown", 0, fd1);//lockdown?
+  p->haslockdown=getoptioni(paramfilename, "haslockdown", 0, fd1);//lockdown?
 
   if(getoption(paramfilename, "lockdown_at_dth", 1, tempword, 200)==0)
-    lockdown_at_dth=getoptioni(paramfilename, "lockdown_at_dth", -1, fd1);//lockdown at nth death
+    p->lockdown_at_dth=getoptioni(paramfilename, "lockdown_at_dth", -1, fd1);//lockdown at nth death
   else//legacy
-    lockdown_at_dth=getoptioni(paramfilename, "lockdth", -1, fd1);//lockdown at nth death
-  lockdown_at_test=getoptioni(paramfilename, "lockdown_at_test", -1, fd1);//lockdown at nth test
-  lockdown_at_inf=getoptioni(paramfilename, "lockdown_at_inf", -1, fd1);//lockdown at nth test
-  lockdownlen=getoptioni(paramfilename, "lockdownlen", 0, fd1);//length of lockdown
-  infectible_proportion=getoptionf(paramfilename, "infectible_proportion", 0.05555, fd1);
-  pdeff_lockdown=getoptionf(paramfilename, "pdeff_lockdown", 60, fd1);//effectiveness of physical distancing after lockdown
-  popleak=getoptionf(paramfilename, "popleak", 0, fd1);//leak into infectible population per day
-  popleak_start_day=getoptioni(paramfilename, "popleak_start_day", 0, fd1);//when does the infectible population start to grow? The nth day of lockdown
-  popleak_end_day=getoptioni(paramfilename, "popleak_end_day", 1000, fd1);//when does the infectible population end growing? Default is never.
-
-  if(haslockdown==2){
-    lockdown2startday=getoptioni(paramfilename, "lockdown2startday", 0, fd1);//start day of second lockdown
-    lockdown2len=getoption2i(paramfilename, "lockdownlen", 0, fd1);//length of lockdown
-    infectible_proportion2=getoption2f(paramfilename, "infectible_proportion", 0.05555, fd1);
-    pdeff_lockdown2=getoption2f(paramfilename, "pdeff_lockdown", 60, fd1);//effectiveness of physical distancing after lockdown
-    popleak2=getoption2f(paramfilename, "popleak", 0, fd1);//leak into infectible population per day
-    popleak2_start_day=getoption2i(paramfilename, "popleak_start_day", 0, fd1);//when does the infectible population start to grow? The nth day of lockdown
-    popleak2_end_day=getoption2i(paramfilename, "popleak_end_day", 1000, fd1);//when does the infectible population end growing? Default is never.
+    p->lockdown_at_dth=getoptioni(paramfilename, "lockdth", -1, fd1);//lockdown at nth death
+  p->lockdown_at_test=getoptioni(paramfilename, "lockdown_at_test", -1, fd1);//lockdown at nth test
+  p->lockdown_at_inf=getoptioni(paramfilename, "lockdown_at_inf", -1, fd1);//lockdown at nth test
+  p->lockdownlen=getoptioni(paramfilename, "lockdownlen", 0, fd1);//length of lockdown
+  p->infectible_proportion=getoptionf(paramfilename, "infectible_proportion", 0.05555, fd1);
+  p->pdeff_lockdown=getoptionf(paramfilename, "pdeff_lockdown", 60, fd1);//effectiveness of physical distancing after lockdown
+  p->popleak=getoptionf(paramfilename, "popleak", 0, fd1);//leak into infectible population per day
+  p->popleak_start_day=getoptioni(paramfilename, "popleak_start_day", 0, fd1);//when does the infectible population start to grow? The nth day of lockdown
+  p->popleak_end_day=getoptioni(paramfilename, "popleak_end_day", 1000, fd1);//when does the infectible population end growing? Default is never.
+
+  p->lockdown2startday=0;p->lockdown2len=0;p->infectible_proportion2=0.05555;p->pdeff_lockdown2=60;
+  p->popleak2=0;p->popleak2_start_day=0;p->popleak2_end_day=1000;
+  if(p->haslockdown==2){
+    p->lockdown2startday=getoptioni(paramfilename, "lockdown2startday", 0, fd1);//start day of second lockdown
+    p->lockdown2len=getoption2i(paramfilename, "lockdownlen", 0, fd1);//length of lockdown
+    p->infectible_proportion2=getoption2f(paramfilename, "infectible_proportion", 0.05555, fd1);
+    p->pdeff_lockdown2=getoption2f(paramfilename, "pdeff_lockdown", 60, fd1);//effectiveness of physical distancing after lockdown
+    p->popleak2=getoption2f(paramfilename, "popleak", 0, fd1);//leak into infectible population per day
+    p->popleak2_start_day=getoption2i(paramfilename, "popleak_start_day", 0, fd1);//when does the infectible population start to grow? The nth day of lockdown
+    p->popleak2_end_day=getoption2i(paramfilename, "popleak_end_day", 1000, fd1);//when does the infectible population end growing? Default is never.
+  }
+
+  //the intervention timeline: "intervention <triggers> <days> <pdeff> <infectible_proportion> [<popleak> [<popleak_start_day> [<popleak_end_day>]]]"
+  //where <triggers> is e.g. "inf=800" or "day=40,death=100" (day, inf, test,
+  //death, or after=n: n days after the previous intervention started)
+  p->numiv=0;
+  {
+    char ivlines[MAXINTERVENTIONS][200], word[200], *t;
+    int n=getoptionlines(paramfilename, "intervention", ivlines, MAXINTERVENTIONS), k, j;
+    intervention *v;
+    for(k=0;k<n;k++){
+      v=&(p->iv[p->numiv]);
+      v->at_day=-1;v->at_inf=-1;v->at_test=-1;v->at_dth=-1;v->after=-1;
+      v->len=0;v->pdeff=60;v->infectible_proportion=1;
+      v->popleak=0;v->popleak_start_day=0;v->popleak_end_day=1000;
+      for(j=2;j<=8;j++){
+	getnthblock(ivlines[k], word, 200, j);
+	if(!word[0] || word[0]=='/')
+	  break;
+	if(j==2){
+	  for(t=strtok(word, ",");t;t=strtok(NULL, ",")){
+	    if(!strncmp(t, "day=", 4)) v->at_day=atoi(t+4);
+	    else if(!strncmp(t, "inf=", 4)) v->at_inf=atoi(t+4);
+	    else if(!strncmp(t, "test=", 5)) v->at_test=atoi(t+5);
+	    else if(!strncmp(t, "death=", 6)) v->at_dth=atoi(t+6);
+	    else if(!strncmp(t, "after=", 6)) v->after=atoi(t+6);
+	    else{
+	      engineerror("ERROR: unknown trigger \"%s\" for an intervention (use day=, inf=, test=, death= or after=). EXITING.\n", t);
+	    }
+	  }
+	}
+	else if(j==3) v->len=atoi(word);
+	else if(j==4) v->pdeff=atof(word);
+	else if(j==5) v->infectible_proportion=atof(word);
+	else if(j==6) v->popleak=atof(word);
+	else if(j==7) v->popleak_start_day=atoi(word);
+	else v->popleak_end_day=atoi(word);
+      }
+      if(v->len<=0 || (v->at_day<0 && v->at_inf<=0 && v->at_test<=0 && v->at_dth<=0 && v->after<0)){
+	engineerror("ERROR: the intervention \"%s\" needs a trigger and a length. EXITING.\n", strtok(ivlines[k], "\n"));
+      }
+      p->numiv++;
+    }
+  }
+  if(p->numiv==0 && p->haslockdown){//the lockdowns above, as a timeline
+    intervention l1, l2;
+    l1.at_day=-1;l1.at_inf=p->lockdown_at_inf;l1.at_test=p->lockdown_at_test;l1.at_dth=p->lockdown_at_dth;l1.after=-1;
+    l1.len=p->lockdownlen;l1.pdeff=p->pdeff_lockdown;l1.infectible_proportion=p->infectible_proportion;
+    l1.popleak=p->popleak;l1.popleak_start_day=p->popleak_start_day;l1.popleak_end_day=p->popleak_end_day;
+    l2.at_day=-1;l2.at_inf=-1;l2.at_test=-1;l2.at_dth=-1;l2.after=p->lockdown2startday;
+    l2.len=p->lockdown2len;l2.pdeff=p->pdeff_lockdown2;l2.infectible_proportion=p->infectible_proportion2;
+    l2.popleak=p->popleak2;l2.popleak_start_day=p->popleak2_start_day;l2.popleak_end_day=p->popleak2_end_day;
+    if(p->haslockdown==2 && l2.len>0 && (l1.len<=0 || l2.after<=0)){//lockdown 2 counted from the start of the run
+      l2.at_day=l2.after>0?l2.after:0;l2.after=-1;
+      p->iv[p->numiv++]=l2;
+    }
+    if(l1.len>0 && (l1.at_inf>0 || l1.at_test>0 || l1.at_dth>0)){
+      p->iv[p->numiv++]=l1;
+      if(p->haslockdown==2 && l2.len>0 && l2.after>0)
+	p->iv[p->numiv++]=l2;
+    }
+  }
+  {
+    int k;
+    char trig[200];
+    intervention *v;
+    for(k=0;k<p->numiv && fd1;k++){
+      v=&(p->iv[k]);
+      trig[0]=0;
+      if(v->at_day>=0) snprintf(trig+strlen(trig), 200-strlen(trig), ",day=%d", v->at_day);
+      if(v->at_inf>0) snprintf(trig+strlen(trig), 200-strlen(trig), ",inf=%d", v->at_inf);
+      if(v->at_test>0) snprintf(trig+strlen(trig), 200-strlen(trig), ",test=%d", v->at_test);
+      if(v->at_dth>0) snprintf(trig+strlen(trig), 200-strlen(trig), ",death=%d", v->at_dth);
+      if(v->after>=0) snprintf(trig+strlen(trig), 200-strlen(trig), ",after=%d", v->after);
+      fprintf(fd1, "#intervention %s %d %.4f %.4f %.4f %d %d\n", trig+1, v->len, v->pdeff, v->infectible_proportion, v->popleak, v->popleak_start_day, v->popleak_end_day);
+    }
   }
 
   //options: physical distancing
-  haspd=getoptioni(paramfilename, "physical_distancing", 0, fd1);//physical distancing?
+  p->haspd=getoptioni(paramfilename, "physical_distancing", 0, fd1);//physical distancing?
 
   if(getoption(paramfilename, "pd_at_dth", 1, tempword, 200)==0)
-    pd_at_dth=getoptioni(paramfilename, "pd_at_dth", -1, fd1);//physical distancing at nth death
+    p->pd_at_dth=getoptioni(paramfilename, "pd_at_dth", -1, fd1);//physical distancing at nth death
   else//legacy
-    pd_at_dth=getoptioni(paramfilename, "pddth", -1,fd1);//physical distancing at nth death
-  pd_at_test=getoptioni(paramfilename, "pd_at_test", -1,fd1);//physical distancing at nth recorded infection
-  pd_at_inf=getoptioni(paramfilename, "pd_at_inf", -1,fd1);//physical distancing at nth infection
-  pdeff1=getoptionf(paramfilename, "pdeff1", 30, fd1);//effectiveness of physical distancing
+    p->pd_at_dth=getoptioni(paramfilename, "pddth", -1,fd1);//physical distancing at nth death
+  p->pd_at_test=getoptioni(paramfilename, "pd_at_test", -1,fd1);//physical distancing at nth recorded infection
+  p->pd_at_inf=getoptioni(paramfilename, "pd_at_inf", -1,fd1);//physical distancing at nth infection
+  p->pdeff1=getoptionf(paramfilename, "pdeff1", 30, fd1);//effectiveness of physical distancing
 
   //synchronisation with data
-  sync_at_test=getoptionf(paramfilename, "sync_at_test", -1, fd1);//for synchronisation
-  sync_at_inf=getoptionf(paramfilename, "sync_at_inf", -1, fd1);//for synchronisation
-  sync_at_death=getoptionf(paramfilename, "sync_at_death", -1, fd1);//for synchronisation
-  sync_at_time=getoptionf(paramfilename, "sync_at_time", -1, fd1);//for synchronisation
+  p->sync_at_test=getoptionf(paramfilename, "sync_at_test", -1, fd1);//for synchronisation
+  p->sync_at_inf=getoptionf(paramfilename, "sync_at_inf", -1, fd1);//for synchronisation
+  p->sync_at_death=getoptionf(paramfilename, "sync_at_death", -1, fd1);//for synchronisation
+  p->sync_at_time=getoptionf(paramfilename, "sync_at_time", -1, fd1);//for synchronisation
   // dynamic speeding up. Set to -1 for no speeding up
-  scale_at_infs=getoptioni(paramfilename, "scale_at_infs", 50000,fd1);//default is to begin scaling at the 50000th infection
-
-  if (getoption(paramfilename, "datafile", 1, datafilename, 200)==0){
-    totdata=readDataFile(datafilename, realdata, maxdat);
+  p->scale_at_infs=getoptioni(paramfilename, "scale_at_infs", 50000,fd1);//default is to begin scaling at the 50000th infection
+  // individuals draw from their own random number streams?
+  p->crn=getoptioni(paramfilename, "common_random_numbers", 0, fd1);
+  // binary store of the output (see castore.h)
+  p->result_store=getoptioni(paramfilename, "result_store", 0, fd1);
+  // quantiles over runs, e.g. "quantiles 0.05 0.5 0.95" ("quantiles none":
+  // no _quant file), found exactly (0) or estimated as runs end (1)
+  {
+    char val[50];
+    int k, j;
+    double v;
+    p->numquant=0;
+    if(getoption(paramfilename, "quantiles", 1, val, 50)==-2){//not set
+      p->numquant=sizeof(defquant)/sizeof(double);
+      for(k=0;k<p->numquant;k++)
+	p->quant[k]=defquant[k];
+    }
+    for(k=1;k<=MAXQUANT && getoption(paramfilename, "quantiles", k, val, 50)==0 && val[0] && val[0]!='/';k++){
+      v=atof(val);
+      if(v<=0 || v>1)//(ignored)
+	continue;
+      for(j=p->numquant;j>0 && p->quant[j-1]>v;j--)//keep them in order
+	p->quant[j]=p->quant[j-1];
+      p->quant[j]=v;
+      p->numquant++;
+    }
+    if(fd1){
+      fprintf(fd1, "#quantiles");
+      for(k=0;k<p->numquant;k++)
+	fprintf(fd1, " %g", p->quant[k]);
+      fprintf(fd1, "%s\n", p->numquant?"":" none");
+    }
   }
+  p->quantile_method=getoptioni(paramfilename, "quantile_method", 0, fd1);
+  // the _sync file repeats all the output, so can be turned off
+  p->sync_file=getoptioni(paramfilename, "sync_file", 1, fd1);
+
+  //adaptive number of runs
+  p->target_rse=getoptionf(paramfilename, "target_rse", 0, fd1);
+  p->min_runs=p->num_runs;p->numtargets=0;
+  if(p->target_rse>0){
+    char tlines[MAXTARGETS][200], name[50];
+    int n=getoptionlines(paramfilename, "target_output", tlines, MAXTARGETS), k, c;
+    p->min_runs=getoptioni(paramfilename, "min_runs", 10, fd1);
+    if(p->min_runs<2)
+      p->min_runs=2;
+    for(k=0;k<n;k++){
+      getnthblock(tlines[k], name, 50, 2);
+      for(c=1;c<10;c++){
+	if(strcmp(name, colnames[c])==0 || (strncmp(name, "peak_", 5)==0 && strcmp(name+5, colnames[c])==0))
+	  break;
+      }
+      if(c==10){
+	engineerror("ERROR: unknown target_output \"%s\". EXITING.\n", name);
+      }
+      p->targetcol[p->numtargets]=c;
+      if(strncmp(name, "peak_", 5)==0)
+	p->targetday[p->numtargets]=-1;
+      else{
+	getnthblock(tlines[k], name, 50, 3);
+	p->targetday[p->numtargets]=name[0]?atoi(name):p->totdays-1;//default: the last day
+	if(p->targetday[p->numtargets]<0 || p->targetday[p->numtargets]>=p->totdays)
+	  p->targetday[p->numtargets]=p->totdays-1;
+      }
+      if(fd1)
+	fprintf(fd1, "#target_output %s%s %d\n", p->targetday[p->numtargets]<0?"peak_":"", colnames[c], p->targetday[p->numtargets]);
+      p->numtargets++;
+    }
+    if(p->numtargets==0){//default: deaths on the last day
+      p->targetcol[0]=4;p->targetday[0]=p->totdays-1;p->numtargets=1;
+      if(fd1)
+	fprintf(fd1, "#target_output %s %d\n", colnames[4], p->targetday[0]);
+    }
+  }
+
+  //importance splitting
+  p->numsplits=0;p->split_factor=1;
+  {
+    char slines[MAXSPLITS][200], val[50];
+    int n=getoptionlines(paramfilename, "split_at_inf", slines, MAXSPLITS), k, j, v;
+    for(k=0;k<n;k++){
+      getnthblock(slines[k], val, 50, 2);
+      v=atoi(val);
+      if(v<=0)
+	continue;
+      for(j=p->numsplits;j>0 && p->splitlevels[j-1]>v;j--)//keep them in order
+	p->splitlevels[j]=p->splitlevels[j-1];
+      p->splitlevels[j]=v;
+      p->numsplits++;
+    }
+    if(p->numsplits>0){
+      p->split_factor=getoptioni(paramfilename, "split_factor", 2, fd1);
+      if(p->split_factor<2)
+	p->split_factor=2;
+      for(k=0;k<p->numsplits && fd1;k++)
+	fprintf(fd1, "#split_at_inf %d\n", p->splitlevels[k]);
+    }
+  }
+
+  p->P=NULL;p->offspring=NULL;
+  for(int k=0;k<p->numiv;k++)
+    p->iv[k].effpop=NULL;
+  p->verbose=0;
+}
+
+// Quantities which follow from the parameters
+void setupparams(params *p){
+  if(p->scale_at_infs>0)
+    p->dynmultiply=1;
+  else
+    p->dynmultiply=0;
+
+  //gamma distribution on individual R0 values
+  p->gamswtch=(p->geometric==-1 && p->numoffprob==0)?1:0;
+  p->infscl=p->R0/p->infshp;
+  p->infstats.mean=-1;//not yet known
+
+  //How is the number to infect distributed? How to truncate?
+  if(p->geometric==1){p->maxP=2*p->R0*(p->R0+1)<MAXDISCPROB?(int)(2*p->R0*(p->R0+1)):MAXDISCPROB;p->P=discGeom(p->R0, p->maxP);}//geometric (2 SD)
+  else{p->maxP=3*p->R0<MAXDISCPROB?(int)(3*p->R0):MAXDISCPROB;p->P=discPois(p->R0, p->maxP);}//Poisson (three SD)
+
+  //Full precision, sampled by the alias method. The tail beyond maxP goes
+  //to maxP, as in the old tables
+  p->offspring=NULL;
+  if(p->numoffprob>0){
+    p->maxP=p->numoffprob-1;
+    p->offspring=new aliastable(p->offprob, p->numoffprob);
+  }
+  else if(!p->gamswtch && !p->quantised_offspring){
+    double w[MAXDISCPROB+1], tail=1.0;
+    int k;
+    for(k=0;k<p->maxP;k++){
+      w[k]=(p->geometric==1)?Geom(p->R0, k):Pois(p->R0, k);
+      tail-=w[k];
+    }
+    w[p->maxP]=tail>0?tail:0;
+    p->offspring=new aliastable(w, p->maxP+1);
+  }
+
+  p->percill=20.0;//percentage of people who fall quite ill (not currently used - for hospitalisations data?)
+  p->percdeath=p->dthrate*100.0/p->percill;
+  p->pdie=(p->percill/100.0)*(p->percdeath/100.0);
+  if(p->pdie>1.0)
+    p->pdie=1.0;
+  p->pillrec=p->pdie<1.0?(p->percill/100.0)*(1.0-p->percdeath/100.0)/(1.0-p->pdie):0.0;
+
+  //the effective population on each day of each intervention
+  for(int k=0;k<p->numiv;k++){
+    intervention *v=&(p->iv[k]);
+    int j, n=v->len;
+    v->effpop=(double *)malloc((size_t) (n*sizeof(double)));
+    v->effpop[0]=p->totpop;
+    v->effpop[0]*=v->infectible_proportion;//effective infectible population drops
+    for(j=1;j<n;j++){
+      v->effpop[j]=v->effpop[j-1];
+      if(j>=v->popleak_start_day && j<=v->popleak_end_day)
+	v->effpop[j]+=v->popleak;//leak into infectible population
+    }
+  }
+}
+
+void freeparams(params *p){
+  if(p->P)
+    free((char *) p->P);
+  p->P=NULL;
+  if(p->offspring)
+    delete p->offspring;
+  p->offspring=NULL;
+  for(int k=0;k<p->numiv;k++){
+    if(p->iv[k].effpop)
+      free((char *) p->iv[k].effpop);
+    p->iv[k].effpop=NULL;
+  }
+}
+
+
+// true with chance perc%, given u uniform on [0,1). Exact unless
+// quantised_percentages is set
+int pcchance(const params *p, double perc, double u){
+  if(p->quantised_percentages)
+    return u01percentage(perc, u);
+  return u<perc/100.0;
+}
+
+// pcchance with the chance already worked out: pass=perc/100
+inline int pcpass(const params *p, double perc, double pass, double u){
+  if(p->quantised_percentages)
+    return u01percentage(perc, u);
+  return u<pass;
+}
+
+// The state of one model run: the population store, the counters, the
+// lockdown state and the random number stream. Runs in different threads
+// each have their own.
+struct runstate{
+  inf **infs;
+  int *inflist; //For book-keeping free spaces in list
+  cbrng gen;
+  int day;//the next day to be simulated
+  int numinf;//number infected (cumulative)
+  int numcurinf;//number currently infected
+  int numcurinfold;
+  int numinfectious;// number in the infectious window
+  int newinfs; // number of new infections this time step.
+  int numquar;//number quarantined (cumulative)
+  int numtest,newtests;//number tested (cumulative) and new
+  int numill;//number ill (cumulative)
+  int numsero;//cumulative seroconversion
+  int numdeaths, newdeaths, numrecovs;
+  double actualR0, avdthtime, avrecovtime, avtesttime, avserotime;
+  int ivnum, ivday;//interventions started, and days since the last one started
+  double effpop;//effective population (only relevant if herd=1)
+  double herdlevel;
+  int pd;//physical distancing is occurring
+  float pdeff;//effectiveness of physical distancing. E.g. 40% - removes 2 in 5 contacts
+  int syncflag;//synchronisation point reached?
+  int delay;//day of synchronisation minus sync_at_time
+  int cur_exp, multiplier;//dynamic rescaling
+  int nlive;//individuals in the store
+  int hiwater;//no individuals at or above this position
+  int firstfree;//no free positions below this one
+  int extinct;//day on which the run died out (-1 if it hasn't)
+  int deathskip;//people to be created before the next who dies (-1: not yet drawn)
+  int illskip;//likewise for those who don't die, before the next who falls ill
+  varbatch normals;//standard normal variates (batched_sampling)
+  varbatch gammas[3];//unit scale gamma variates: numbers to infect, infection times, testing delays
+};
+
+void allocstate(runstate *s){
+  int i;
+  s->infs=infar(0, MAXINFS-1);
+  s->inflist=(int *)malloc((size_t) (MAXINFS*sizeof(int)));
+  if (!s->inflist) fprintf(stderr, "allocation failure in allocstate()\n");
+  for(i=0;i<MAXINFS;i++){s->inflist[i]=0;}//empty
+  s->nlive=0;s->hiwater=0;s->firstfree=0;
+}
+
+void emptybatches(runstate *s){
+  int k;
+  emptybatch(&s->normals);
+  for(k=0;k<3;k++)
+    emptybatch(&s->gammas[k]);
+}
+
+void freestate(runstate *s){
+  free_infar(s->infs, 0, MAXINFS-1);
+  free((char *) s->inflist);
+}
+
+
+// In common random numbers mode each individual has their own random
+// number stream, keyed by a genealogical identity: the kth initial
+// infection of run r, or the kth potential infectee of a given individual
+// (counting those prevented by interventions). The same individual then
+// has the same characteristics in runs with different interventions.
+// Blocks from CRNDAY on give the individual's daily chances (block
+// CRNDAY+age), chances at rescaling (block CRNRESCALE+cur_exp) and the
+// chance of a potential infectee escaping herd immunity (block CRNHERD,
+// with herd_update 2).
+#define CRNDAY (1ULL<<32)
+#define CRNRESCALE (1ULL<<33)
+#define CRNHERD (1ULL<<34)
+
+uint64_t rootid(uint64_t run, int k){
+  return mix64(mix64(run)+(uint64_t)(k+1));
+}
+
+uint64_t childid(uint64_t parent, int k){
+  return mix64(parent+0x9E3779B97F4A7C15ULL*(uint64_t)(k+1));
+}
+
+// word w of block n of the stream of the individual with identity id, as a
+// uniform number on [0,1)
+double crnidu01(const runstate *s, uint64_t id, uint64_t n, int w){
+  uint32_t out[4];
+  cbrng g(s->gen.key, id);
+  g.block(n, out);
+  return out[w]*(1.0/4294967296.0);
+}
+
+double crnu01(const runstate *s, const inf *a, uint64_t n, int w){
+  return crnidu01(s, a->gid, n, w);
+}
+
+// The day's loop over individuals and create() are templates on the options
+// which are fixed for a run or a day: gamma distributed numbers to infect
+// (GAM), gamma distributed infection times (INFGAM), herd immunity (HERD),
+// physical distancing in force (PD) and weighted individuals after
+// rescaling (WEIGHTED). Each combination gets its own loop without tests
+// of these options. A template argument of RUNTIME instead tests the
+// option as it goes; compile with -DGENERIC_KERNEL to use only that
+// version (for comparison).
+#define RUNTIME 2
+#define POLICY(T, val) ((T)==RUNTIME?(val):(T))
+
+// Profiling (compile with -DPROFILE): the time spent in each phase of the
+// simulation and counts of events, per day, per run and per set of
+// parameters, written to "<output_file>_prof". Timers nest, and time is
+// charged only to the innermost phase. Events count individuals, without
+// the weights from rescaling. The state is kept per thread, so that it is
+// not part of runstate (or the checkpoints).
+#define PH_RESCALE 0 // the rescaling sweep
+#define PH_POLICY 1 // lockdown and physical distancing
+#define PH_PERSON 2 // the individuals' progress (other than creations)
+#define PH_CREATE 3 // creating new infecteds
+#define PH_OUTPUT 4 // writing output
+#define NUMPHASES 5
+#define EV_CREATE 0 // individuals created
+#define EV_DEATH 1 // deaths
+#define EV_TRIAL 2 // infections due, before distancing and herd immunity
+#define EV_REJPD 3 // ... prevented by physical distancing
+#define EV_REJHERD 4 // ... prevented by herd immunity
+#define EV_REJBOTH 5 // ... prevented by the two together (independent_transmissions)
+#define EV_RESCALE 6 // removed by rescaling
+#define NUMEVENTS 7
+const char *phasenames[NUMPHASES]={"rescale", "policy", "person", "create", "output"};
+const char *eventnames[NUMEVENTS]={"created", "died", "trials", "rej_pd", "rej_herd", "rej_pd_herd", "rescaled"};
+
+struct profile{
+  double t[NUMPHASES];//seconds
+  long n[NUMEVENTS];
+};
+
+#ifdef PROFILE
+thread_local profile profnow;//since the last day written
+thread_local int profphase=-1;//phase being timed (-1: none)
+thread_local struct timespec proflast;//when profphase last changed
+
+// charge the time since the last change to the current phase and move to ph
+inline void profswitch(int ph){
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if(profphase>=0)
+    profnow.t[profphase]+=(now.tv_sec-proflast.tv_sec)+1e-9*(now.tv_nsec-proflast.tv_nsec);
+  proflast=now;profphase=ph;
+}
+
+// times the phase from its declaration to the end of its scope (or stop())
+struct proftimer{
+  int prev;
+  proftimer(int ph){prev=profphase;profswitch(ph);}
+  void stop(){if(prev!=-2){profswitch(prev);prev=-2;}}
+  ~proftimer(){stop();}
+};
+#define PROFTIMER(ph) proftimer proftimer_(ph)
+#define PROFSTOP() proftimer_.stop()
+#define PROFCOUNT(ev, k) (profnow.n[ev]+=(k))
+#else
+#define PROFTIMER(ph)
+#define PROFSTOP()
+#define PROFCOUNT(ev, k)
+#endif
+
+// Add profile b to a, and optionally empty b
+void addprofile(profile *a, profile *b, int empty){
+  int i;
+  for(i=0;i<NUMPHASES;i++){
+    a->t[i]+=b->t[i];
+    if(empty) b->t[i]=0;
+  }
+  for(i=0;i<NUMEVENTS;i++){
+    a->n[i]+=b->n[i];
+    if(empty) b->n[i]=0;
+  }
+}
+
+// Normal and gamma variates for create(). With batched_sampling they come
+// from the run's batches, or straight from gen in common random numbers
+// mode (where each person has their own stream); otherwise from the std::
+// distributions as in earlier versions. Gamma batch "which" is 0 for the
+// numbers to infect, 1 for infection times and 2 for testing delays.
+double normaldraw(const params *p, runstate *s, cbrng &gen, double mean, double stdev){
+  if(!p->batched_sampling)
+    return norml(mean, stdev, gen);
+  return mean+stdev*(p->crn?zignormal(gen):nextnormal(&s->normals, gen));
+}
+
+double gammadraw(const params *p, runstate *s, cbrng &gen, int which, double shp, double scl){
+  if(!p->batched_sampling)
+    return gamma(shp, scl, gen);
+  return scl*(p->crn?mtgamma(shp, gen):nextgamma(&s->gammas[which], shp, gen));
+}
+
+// Create a new infected individual with genealogical identity gid. In common
+// random numbers mode their characteristics are drawn from their own
+// stream, keyed by gid, rather than from the run's stream.
+template<int GAM, int INFGAM>
+int createind(const params *p, runstate *s, uint64_t gid){
+  PROFTIMER(PH_CREATE);
+  int i=firstfreepos(s->inflist+s->firstfree, MAXINFS-s->firstfree);
+  int j, number;
+  double inf_scl=p->inf_mid/p->inf_tm_shp;
+  double t[MAXDISCPROB+1];
+  inf **infs=s->infs;
+  cbrng own;
+  cbrng &gen=p->crn?own:s->gen;
+  if(p->crn)
+    own.seed(s->gen.key, gid);
+  if(i==-1){//no more space
+    engineerror("Ran out of space in list - you can consider resetting MAXINFS. EXITING.\n");
+  }
+  i+=s->firstfree;
+  s->firstfree=i+1;
+  if(i>=s->hiwater)
+    s->hiwater=i+1;
+  (s->nlive)++;
+  if(!POLICY(GAM, p->gamswtch) && p->offspring)
+    infs[i] = new inf(i, *(p->offspring), gen);
+  else if(!POLICY(GAM, p->gamswtch))
+    infs[i] = new inf(i, p->P, p->maxP, gen);
+  else if(p->batched_sampling){
+    infs[i] = new inf(i, 0);
+    number=int(round(gammadraw(p, s, gen, 0, p->infshp, p->infscl)));
+    infs[i]->numtoinf=number<MAXDISCPROB-1?number:MAXDISCPROB-1;
+  }
+  else
+    infs[i] = new inf(i, p->infshp, p->infscl, gen);
+  infs[i]->gid=gid;
+  (s->numinf)++;(s->numcurinf)++;(s->newinfs)++;
+
+  if(p->dist_on_sero>=0)//discrete simple
+    infs[i]->sero_time=(int)p->time_to_sero+choosefrombin((int)p->dist_on_sero, gen);
+  else//normal dist., -dist_on_sero=stdev
+    infs[i]->sero_time=int(round(normaldraw(p, s, gen, p->time_to_sero, -p->dist_on_sero)));
+
+  for(j=0;j<MAXAGE;j++){//number to infect at time j
+    infs[i]->infnums[j]=0;
+  }
+  // who falls ill? (currently unused - left in for potential use) Who dies?
+  if(p->crn || p->quantised_percentages){//a chance for each person
+    if(pcchance(p, p->percill, gen.u01()))
+      infs[i]->ill=pcchance(p, p->percdeath, gen.u01())?-1:1;
+  }
+  else{//deaths are rare: skip straight to the next one
+    if(s->deathskip<0)
+      s->deathskip=geomskip(p->pdie, gen);
+    if(s->deathskip==0){
+      infs[i]->ill=-1;
+      s->deathskip=-1;
+    }
+    else{//and likewise to the next who falls ill but recovers
+      s->deathskip--;
+      if(s->illskip<0)
+	s->illskip=geomskip(p->pillrec, gen);
+      if(s->illskip==0){
+	infs[i]->ill=1;
+	s->illskip=-1;
+      }
+      else
+	s->illskip--;
+    }
+  }
+  if(infs[i]->ill!=0){
+    if(infs[i]->ill==-1){//falls ill and dies
+      if(p->dist_on_death>=0)//discrete simple
+	infs[i]->dth_time=(int)p->time_to_death+choosefrombin((int)p->dist_on_death, gen);
+      else//normally distributed, -dist_on_death=stdev
+	infs[i]->dth_time=int(round(normaldraw(p, s, gen, p->time_to_death, -p->dist_on_death)));
+
+    }
+    else{//falls ill but recovers
+      if(p->dist_on_recovery>=0)
+	infs[i]->recov_time=(int)p->time_to_recovery+choosefrombin((int)p->dist_on_recovery, gen);
+      else{//normal dist, -dist_on_recovery=stdev
+	infs[i]->recov_time=int(round(normaldraw(p, s, gen, p->time_to_recovery, -p->dist_on_recovery)));
+	// if(infs[i]->recov_time>MAXAGE)
+	//   fprintf(stderr, "recov_time=%d\n", infs[i]->recov_time);
+      }
+    }
+    (s->numill)++;
+    //fprintf(stderr, "ill=%d\n", infs[i]->ill);
+  }
+  else{//won't fall ill
+    if(p->dist_on_recovery>=0)
+      infs[i]->recov_time=(int)p->time_to_recovery+choosefrombin((int)p->dist_on_recovery, gen);
+    else//normal dist, -dist_on_recovery=stdev
+      infs[i]->recov_time=int(round(normaldraw(p, s, gen, p->time_to_recovery, -p->dist_on_recovery)));
+  }
+
+  infs[i]->quardt=100;infs[i]->testdt=100;//default no quarantining/testing
+  if(pcchance(p, p->quarp, gen.u01())){//to quarantine?
+    if(p->dist_on_quardate>=0)
+      infs[i]->quardt=(int)p->quardate+choosefrombin((int)p->dist_on_quardate, gen);
+    else
+      infs[i]->quardt=int(round(normaldraw(p, s, gen, p->quardate, -p->dist_on_quardate)));
+
+    if(pcchance(p, p->testp, gen.u01())){// to test?
+      if(p->testdelay==0 || p->testdelay_shp<0)
+	infs[i]->testdt=infs[i]->quardt + p->testdelay;//testing on fixed day after quarantine date
+      else//testing delay follows a gamma distribution
+	infs[i]->testdt=infs[i]->quardt+int(round(gammadraw(p, s, gen, 2, p->testdelay_shp, p->testdelay/p->testdelay_shp)));
+    }
+  }
+
+  //last operation (one greater than last operation)
+  if(infs[i]->ill==-1){//dies (last op. is testing or death)
+    infs[i]->lastop_time=infs[i]->dth_time;
+    if(infs[i]->testdt!=100 && infs[i]->testdt > infs[i]->lastop_time)
+      infs[i]->lastop_time=infs[i]->testdt;
+  }
+  else{//recovers (last op. is testing, death or seroconversion)
+    infs[i]->lastop_time=infs[i]->recov_time;
+    if(infs[i]->testdt!=100 && infs[i]->testdt > infs[i]->lastop_time)
+      infs[i]->lastop_time=infs[i]->testdt;
+    if(infs[i]->sero_time > infs[i]->lastop_time)
+      infs[i]->lastop_time=infs[i]->sero_time;
+  }
+  (infs[i]->lastop_time)++;
+
+  //set infection times
+  if(POLICY(INFGAM, p->inf_gam) && p->batched_sampling){//gamma distributed
+    for(j=0;j<infs[i]->numtoinf;j++)
+      t[j]=gammadraw(p, s, gen, 1, p->inf_tm_shp, inf_scl);
+    infs[i]->setinftimes(t);
+  }
+  else if(POLICY(INFGAM, p->inf_gam))
+    infs[i]->setinftimes(p->inf_tm_shp, inf_scl, gen);
+  else
+    infs[i]->setinftimes(p->inf_start, p->inf_end, gen);
+  
+  s->inflist[i]=1;
+  PROFCOUNT(EV_CREATE, 1);
+  return i;
+
+}
+
+int create(const params *p, runstate *s, uint64_t gid){
+#ifdef GENERIC_KERNEL
+  return createind<RUNTIME, RUNTIME>(p, s, gid);
+#else
+  if(p->gamswtch)
+    return p->inf_gam?createind<1, 1>(p, s, gid):createind<1, 0>(p, s, gid);
+  return p->inf_gam?createind<0, 1>(p, s, gid):createind<0, 0>(p, s, gid);
+#endif
+}
+
+void die(runstate *s, inf *a){//clear list position and delete
+  s->inflist[a->num]=0;
+  if(a->num<s->firstfree)
+    s->firstfree=a->num;
+  (s->nlive)--;
+  delete a;
+  return;
+}
+
+void finishrun(runstate *s);
+
+// Start a run: reset the counters and create the initial infections.
+// The run takes its random numbers from stream "stream" of seed "seed".
+void startrun(const params *p, runstate *s, uint64_t seed, uint64_t stream){
+  int i, j, cur;
+  s->gen.seed(seed, stream);
+  s->day=0;
+  s->numinf=0;s->numcurinf=0;s->numcurinfold=0;s->numdeaths=0;s->newdeaths=0;s->numrecovs=0;
+  s->numquar=0;s->numtest=0;s->newtests=0;s->numill=0;s->numsero=0;s->numinfectious=0;s->newinfs=0;
+  s->actualR0=0;s->avdthtime=0;s->avrecovtime=0;s->avserotime=0;s->avtesttime=0;
+  s->ivnum=0;s->ivday=0;
+  s->effpop=p->totpop;
+  s->herdlevel=0;
+  s->pd=0;s->pdeff=0;
+  s->syncflag=0;s->delay=0;
+  s->cur_exp=1;
+  s->multiplier=1;
+
+  s->extinct=-1;s->deathskip=-1;s->illskip=-1;
+  emptybatches(s);
+
+  finishrun(s);//empty the store
+  s->nlive=0;s->hiwater=0;s->firstfree=0;
+
+  for(i=0;i<p->init_infs;i++){
+    cur=create(p, s, rootid(stream, i));//create
+    //fprintf(fd3, "0 %d\n", cur);
+
+    s->actualR0=s->actualR0*((double)(s->numinf-1))/((double)(s->numinf))+(double)((s->infs[cur])->numtoinf)/((double)(s->numinf));
+
+    //fprintf(stderr, "actualR0=%.4f\n", actualR0);
+    if(p->verbose){
+      fprintf(stderr, "infs[%d] (illstate=%d) will infect %d at times:\n",cur, s->infs[cur]->ill, s->infs[cur]->numtoinf);
+      for(j=0;j<(s->infs[cur])->numtoinf;j++){
+	fprintf(stderr, "   %d\n", s->infs[cur]->inftimes[j]);
+      }
+    }
+  }
+}
+
+// The chances of getting past herd immunity: the herd immunity level is
+// only recomputed when numinf has changed since herdinf
+inline void herdchances(runstate *s, int &herdinf, double &herdsurv, double &herdpass){
+  if(s->numinf==herdinf)
+    return;
+  s->herdlevel=100.0*((double)s->numinf/(double)s->effpop);
+  herdsurv=1.0-s->herdlevel/100.0;//(as a factor)
+  herdpass=(100.0-s->herdlevel)/100.0;//(as a chance)
+  herdinf=s->numinf;
+}
+
+// One day of the individuals' progress (see create() for the template
+// arguments)
+template<int GAM, int INFGAM, int HERD, int PD, int WEIGHTED>
+void daykernel(const params *p, runstate *s){
+  int i, j, k, a, n, tmpi;
+  double surv;
+  inf **infs=s->infs;
+  int *inflist=s->inflist;
+  const int multiplier=WEIGHTED?s->multiplier:1;
+  //the day's chances of getting past physical distancing and herd immunity
+  const double pdsurv=1.0-s->pdeff/100.0, pdpass=(100.0-s->pdeff)/100.0;
+  double herdsurv=1.0, herdpass=1.0;
+  int herdinf=-1;
+  const int herdeach=(p->herd_update==2);//thin each infection by the level as it is created?
+
+  if(POLICY(HERD, p->herd) && p->herd_update==1)//fixed for the day
+    herdchances(s, herdinf, herdsurv, herdpass);
+
+  for(i=0;i<s->hiwater;i++){//for each infected person (hiwater grows as new infecteds are created)
+    if(inflist[i]==1){
+      (infs[i]->age)++;//age updates at start...
+      if(infs[i]->age==infs[i]->lastop_time){//done with
+	die(s, infs[i]);//deallocate
+	continue;
+      }
+
+      if(infs[i]->age >= p->inf_start && infs[i]->age <= p->inf_end){//so far kept as is regardless of distribution
+	s->numinfectious+=multiplier;
+      }
+
+      if(infs[i]->age==infs[i]->sero_time){//seroconversion
+	s->numsero+=multiplier;
+	s->avserotime=s->avserotime*((double)(s->numsero-multiplier))/((double)(s->numsero))+(double)(multiplier*(infs[i])->age)/((double)(s->numsero));
+      }
+
+      if(infs[i]->age==infs[i]->quardt){//quarantine?
+	infs[i]->quar=1;
+	s->numquar+=multiplier;
+      }
+
+      if(infs[i]->age==infs[i]->testdt){//test?
+	s->numtest+=multiplier;s->newtests+=multiplier;
+	s->avtesttime=s->avtesttime*((double)(s->numtest-multiplier))/((double)(s->numtest))+(double)(multiplier*(infs[i])->age)/((double)(s->numtest));
+      }
+
+      if(infs[i]->ill==-1 && infs[i]->age==infs[i]->dth_time){//die
+	PROFCOUNT(EV_DEATH, 1);
+	s->numdeaths+=multiplier;s->newdeaths+=multiplier;s->numcurinf-=multiplier;
+	s->avdthtime=s->avdthtime*((double)(s->numdeaths-multiplier))/((double)(s->numdeaths))+(double)(multiplier*(infs[i])->age)/((double)(s->numdeaths));
+      }
+      else if(infs[i]->ill!=-1 && infs[i]->age==infs[i]->recov_time){//recover
+	s->numcurinf-=multiplier;s->numrecovs+=multiplier;
+	s->avrecovtime=s->avrecovtime*((double)(s->numrecovs-multiplier))/((double)(s->numrecovs))+(double)(multiplier*(infs[i])->age)/((double)(s->numrecovs));
+      }
+      else if(infs[i]->quar==0 && infs[i]->age<MAXAGE && (p->quantised_percentages || infs[i]->infnums[infs[i]->age]>0)){//still being processed, not quarantined (draws are only needed on days with infections)
+	if(POLICY(HERD, p->herd) && !p->herd_update)
+	  herdchances(s, herdinf, herdsurv, herdpass);
+	n=infs[i]->infnums[infs[i]->age];
+	PROFCOUNT(EV_TRIAL, n);
+	if(p->independent_transmissions){//each of the day's infections is prevented independently: one binomial draw
+	  surv=1.0;
+	  if(POLICY(PD, s->pd))
+	    surv*=pdsurv;
+	  if(POLICY(HERD, p->herd) && !herdeach)
+	    surv*=herdsurv;
+	  tmpi=n;
+	  if(surv<1.0 || !herdeach)
+	    n=u01binomial(n, surv, p->crn?crnu01(s, infs[i], CRNDAY+infs[i]->age, 0):s->gen.u01());
+	  PROFCOUNT(POLICY(PD, s->pd)?((POLICY(HERD, p->herd) && !herdeach)?EV_REJBOTH:EV_REJPD):EV_REJHERD, tmpi-n);
+	}
+	else if(POLICY(PD, s->pd) && !pcpass(p, 100.0-s->pdeff, pdpass, p->crn?crnu01(s, infs[i], CRNDAY+infs[i]->age, 0):s->gen.u01())){
+	  PROFCOUNT(EV_REJPD, n);
+	  n=0;//all infection events on a given day for an individual either do or don't take place
+	}
+	else if(POLICY(HERD, p->herd) && !herdeach && !pcpass(p, 100.0-s->herdlevel, herdpass, p->crn?crnu01(s, infs[i], CRNDAY+infs[i]->age, 1):s->gen.u01())){
+	  PROFCOUNT(EV_REJHERD, n);
+	  n=0;
+	}
+	if(n>0){
+	  for(k=0, a=0;a<infs[i]->age;a++)//earlier potential infectees
+	    k+=infs[i]->infnums[a];
+	  for(j=0;j<n;j++){
+	    if(POLICY(HERD, p->herd) && herdeach){//against the level reached so far, including this individual's earlier infections
+	      herdchances(s, herdinf, herdsurv, herdpass);
+	      if(!pcpass(p, 100.0-s->herdlevel, herdpass, p->crn?crnidu01(s, childid(infs[i]->gid, k+j), CRNHERD, 0):s->gen.u01())){
+		PROFCOUNT(EV_REJHERD, 1);
+		continue;
+	      }
+	    }
+	    tmpi=createind<GAM, INFGAM>(p, s, childid(infs[i]->gid, k+j));//create new infecteds
+	    if(POLICY(WEIGHTED, multiplier>1)){
+	      s->numinf+=(multiplier-1);s->numcurinf+=(multiplier-1);s->newinfs+=(multiplier-1);
+	    }
+	    s->actualR0=s->actualR0*((double)(s->numinf-multiplier))/((double)(s->numinf))+(double)(multiplier*(infs[tmpi])->numtoinf)/((double)(s->numinf));
+	    if(POLICY(WEIGHTED, multiplier>1) && infs[tmpi]->ill==1)
+	      s->numill+=(multiplier-1);
+	    //		    fprintf(fd3, "%d %d %d\n%d %d %d\n\n", m, i, i, m+1, tmpi, tmpi);
+	    if(tmpi>i)//this will update to zero as they come later in the sequence
+	      infs[tmpi]->age--;
+	  }
+	}
+      }
+    }
+  }//cycled through all infected individuals
+}
+
+typedef void (*kernelfn)(const params *p, runstate *s);
+#define KERNELS4(G, I, H) daykernel<G, I, H, 0, 0>, daykernel<G, I, H, 0, 1>, daykernel<G, I, H, 1, 0>, daykernel<G, I, H, 1, 1>
+const kernelfn daykernels[32]={KERNELS4(0, 0, 0), KERNELS4(0, 0, 1), KERNELS4(0, 1, 0), KERNELS4(0, 1, 1), KERNELS4(1, 0, 0), KERNELS4(1, 0, 1), KERNELS4(1, 1, 0), KERNELS4(1, 1, 1)};
+
+// Interventions (lockdowns) and physical distancing for the day
+void updatepolicy(const params *p, runstate *s){
+  PROFTIMER(PH_POLICY);
+  if(p->haspd && ((p->pd_at_dth>0 && s->numdeaths>=p->pd_at_dth) || (p->pd_at_test>0 && s->numtest>=p->pd_at_test) || (p->pd_at_inf>0 && s->numinf>=p->pd_at_inf))){//physical distancing
+    s->pd=1;
+    s->pdeff=p->pdeff1;
+  }
+  else
+    s->pd=0;
+
+  if(p->numiv){//the intervention timeline
+    const intervention *v;
+    while(s->ivnum<p->numiv){//has the next intervention started?
+      v=&(p->iv[s->ivnum]);
+      if(!((v->at_day>=0 && s->day>=v->at_day) || (v->at_inf>0 && s->numinf>=v->at_inf) || (v->at_test>0 && s->numtest>=v->at_test) || (v->at_dth>0 && s->numdeaths>=v->at_dth) || (v->after>=0 && s->ivnum>0 && s->ivday>=v->after)))
+	break;
+      s->ivnum++;s->ivday=0;
+      if(p->verbose)
+	fprintf(stderr, "Intervention %d starts.\n", s->ivnum);
+    }
+    if(s->ivnum>0){
+      v=&(p->iv[s->ivnum-1]);
+      if(s->ivday<v->len){
+	s->effpop=v->effpop[s->ivday];
+	s->pd=1;
+	s->pdeff=v->pdeff;//physical distancing becomes more effective
+	if(p->verbose)
+	  fprintf(stderr, "In intervention %d. Effective population now %.4f.\n", s->ivnum, s->effpop);
+      }
+      else{//intervention finishes. Assume physical distancing returns to early levels
+	s->effpop=p->totpop;
+	if(p->haspd)
+	  s->pdeff=p->pdeff1;
+	if(s->ivday==v->len && p->verbose)
+	  fprintf(stderr, "Intervention %d finished. Effective population now %.4f.\n", s->ivnum, s->effpop);
+      }
+      s->ivday++;
+    }
+  }
+  if(s->pd && p->verbose){
+    fprintf(stderr, "physical distancing = %.2f.\n", s->pdeff);
+  }
+}
+
+// A run carrying on under other parameters (a branch of a fork): it keeps
+// its progress through the interventions as far as the new timeline goes.
+// Interventions it had already passed the last of are over, and without
+// one in force the whole population is infectible again.
+void adoptpolicy(const params *p, runstate *s){
+  if(s->ivnum>p->numiv){
+    s->ivnum=p->numiv;
+    if(s->ivnum>0)
+      s->ivday=p->iv[s->ivnum-1].len;
+  }
+  if(s->ivnum==0 || s->ivday>=p->iv[s->ivnum-1].len)
+    s->effpop=p->totpop;
+}
+
+// Simulate one day. The day's outputs go in row[0..9]: day, numinf,
+// newinfs, numcurinf, numdeaths, newdeaths, numtest, newtests,
+// numinfectious, numsero.
+void stepday(const params *p, runstate *s, int row[]){
+  PROFTIMER(PH_PERSON);
+  int i;
+  int m=s->day;
+  inf **infs=s->infs;
+  int *inflist=s->inflist;
+
+  if(s->nlive==0){//died out: only the day changes
+    if(s->extinct<0)
+      s->extinct=m;
+    s->numinfectious=0;s->newinfs=0;s->newdeaths=0;s->newtests=0;
+    s->numcurinfold=s->numcurinf;
+    row[0]=m;row[1]=s->numinf;
+    row[2]=0;row[3]=s->numcurinf;
+    row[4]=s->numdeaths;row[5]=0;
+    row[6]=s->numtest;row[7]=0;
+    row[8]=0;row[9]=s->numsero;
+    s->day++;
+    return;
+  }
+  while(s->hiwater>0 && inflist[s->hiwater-1]==0)
+    s->hiwater--;
+
+  //rescale. kill off half randomly; double weight of remainder
+  if(p->dynmultiply && s->numcurinf>=p->scale_at_infs*int_pow(2,s->cur_exp-1) && s->multiplier==int_pow(2,s->cur_exp-1)){//multiplier
+    PROFTIMER(PH_RESCALE);
+    s->cur_exp++;s->multiplier*=2;
+    for(i=0;i<s->hiwater;i++){// kill off every other active infection
+      if(inflist[i]==1 && (p->crn?crnu01(s, infs[i], CRNRESCALE+s->cur_exp, 0)<0.5:randnum(2, s->gen)<1)){
+	die(s, infs[i]);//no removal from stats
+	PROFCOUNT(EV_RESCALE, 1);
+      }
+    }
+  }
+
+  s->numinfectious=0;s->newinfs=0;s->newdeaths=0;s->newtests=0;
+  s->numcurinfold=s->numcurinf;
+  if(p->herd && p->verbose)
+    fprintf(stderr, "herdlevel=%.4f\n", s->herdlevel);
+
+  updatepolicy(p, s);
+
+
+#ifdef GENERIC_KERNEL
+  daykernel<RUNTIME, RUNTIME, RUNTIME, RUNTIME, RUNTIME>(p, s);
+#else
+  daykernels[(p->gamswtch?16:0)+(p->inf_gam?8:0)+(p->herd?4:0)+(s->pd?2:0)+(s->multiplier>1?1:0)](p, s);
+#endif
+
+  if(p->verbose)
+    fprintf(stderr, "%d: numinf=%d, newinfs=%d, numcurinf=%d(%.2fpc), numdeaths=%d, newdeaths=%d, numtest=%d, numinfectious=%d, numsero=%d\n", m, s->numinf, s->newinfs, s->numcurinf, s->numcurinfold>=1?100.0*((double)s->numcurinf-(double)s->numcurinfold)/((double)s->numcurinfold):-1,s->numdeaths, s->newdeaths, s->numtest, s->numinfectious, s->numsero);
+  row[0]=m;row[1]=s->numinf;
+  row[2]=s->newinfs;row[3]=s->numcurinf;
+  row[4]=s->numdeaths;row[5]=s->newdeaths;
+  row[6]=s->numtest;row[7]=s->newtests;
+  row[8]=s->numinfectious;row[9]=s->numsero;
+
+  //Setting the delays
+  if(!s->syncflag && ((p->sync_at_test>0 && s->numtest>=p->sync_at_test) || (p->sync_at_death>0 && s->numdeaths>=p->sync_at_death) || (p->sync_at_inf>0 && s->numinf>=p->sync_at_inf))){
+    s->delay=m-p->sync_at_time;
+    s->syncflag=1;
+  }
+  s->day++;
+}
+
+// Free the remaining individuals at the end of a run
+void finishrun(runstate *s){
+  int i;
+  for(i=0;i<s->hiwater;i++){//free memory
+    if(s->inflist[i]==1)
+      die(s, s->infs[i]);//deallocate (numcurinf will get reset anyway)
+  }
+}
+
+
+// Make dst (already allocated) an exact copy of src: individuals, counters,
+// lockdown state and the position in the random number stream. dst can
+// then be continued independently of src.
+void copystate(const runstate *src, runstate *dst){
+  inf **infs=dst->infs;
+  int *inflist=dst->inflist;
+  int i;
+  finishrun(dst);
+  *dst=*src;
+  dst->infs=infs;dst->inflist=inflist;
+  for(i=0;i<src->hiwater;i++){
+    inflist[i]=src->inflist[i];
+    if(inflist[i]==1)
+      infs[i]=new inf(*(src->infs[i]));
+  }
+}
+
+
+//
+// Approximate Bayesian Computation (ABC-SMC) calibration against the data file
+//
+
+#define MAXABCPARAMS 20
+#define MAXABCGENS 100
+
+// the data and the settings for the distance
+struct abcdata{
+  int **realdata;
+  int totdata;
+  double wcases, wdeaths;//weights of cases and deaths in the distance
+  int abandon_at_inf;//runs with more infections than this are abandoned (-1: never)
+};
+
+// One candidate particle
+struct abcjob{
+  std::vector<double> theta;//the calibrated parameters
+  params p;//all parameters
+  uint64_t stream;
+  double dist;//distance to the data (HUGE_VAL if rejected)
+  int early;//terminated early?
+  int extinct;//died out?
+  int abandoned;//exceeded abandon_at_inf?
+};
+
+struct abcbatch{
+  std::vector<abcjob> *jobs;
+  std::atomic<int> next;//next job to be taken
+  const abcdata *dat;
+  uint64_t seed;
+  double eps;//current tolerance
+};
+
+// Simulate a particle and return its distance to the data. Cases (numtest)
+// and deaths (numdeaths) are compared on a log scale after synchronisation,
+// exactly as in the _av file: simulated day m+delay is data day m. The run
+// stops once the data are covered, or as soon as the partial distance
+// exceeds the tolerance eps (the distance can only grow).
+double abcdistance(const params *p, runstate *s, const abcdata *d, uint64_t seed, uint64_t stream, double eps, int *early, int *extinct, int *abandoned){
+  std::vector<int> cases(p->totdays), deaths(p->totdays);
+  int row[10];
+  int k, knext=0;
+  double sum=0, maxsum=eps*eps*d->totdata, dc, dd;
+
+  *early=0;*abandoned=0;
+  startrun(p, s, seed, stream);
+  while(s->day<p->totdays){
+    stepday(p, s, row);
+    cases[row[0]]=row[6];deaths[row[0]]=row[4];
+    if(d->abandon_at_inf>0 && s->numinf>d->abandon_at_inf){//diverged
+      *abandoned=1;
+      break;
+    }
+    if(!s->syncflag){
+      if(s->nlive==0)//died out before synchronisation
+	break;
+      continue;
+    }
+    if(s->delay<0 || s->delay+d->totdata>p->totdays)//can't be compared with the data
+      break;
+    for(k=knext;k<d->totdata && k+s->delay<s->day;k++){
+      dc=log(1.0+cases[k+s->delay])-log(1.0+d->realdata[k][0]);
+      dd=log(1.0+deaths[k+s->delay])-log(1.0+d->realdata[k][1]);
+      sum+=d->wcases*dc*dc+d->wdeaths*dd*dd;
+    }
+    knext=k;
+    if(sum>maxsum){
+      *early=1;
+      break;
+    }
+    if(knext==d->totdata)//all the data compared
+      break;
+  }
+  *extinct=(s->extinct>=0);
+  finishrun(s);
+  if(*early || *abandoned || knext<d->totdata)
+    return HUGE_VAL;
+  return sqrt(sum/d->totdata);
+}
+
+// each thread has its own population store
+void abcworker(abcbatch *b){
+  runstate s;
+  int j;
+  allocstate(&s);
+  while((j=b->next++)<(int)b->jobs->size()){
+    abcjob &jb=(*b->jobs)[j];
+    jb.dist=abcdistance(&jb.p, &s, b->dat, b->seed, jb.stream, b->eps, &jb.early, &jb.extinct, &jb.abandoned);
+  }
+  freestate(&s);
+}
+
+// The q-quantile (nearest rank) of values v sorted in increasing order
+double quantile(const std::vector<double> &v, double q){
+  size_t k=(size_t)(q*(v.size()-1)+0.5);
+  return v[k];
+}
+
+// Calibrate by ABC-SMC (Beaumont et al., Biometrika 2009). Priors are
+// uniform, one line "abc_prior <name> <min> <max>" per parameter ("name:2"
+// for the second value on a line). Particles of later generations are
+// proposed by perturbing those of the previous one with a Gaussian kernel
+// of twice the weighted variance. Tolerances are either listed
+// ("abc_tolerances"), or each is the abc_quantile quantile of the previous
+// generation's distances, down to abc_final_tolerance. Proposal c of
+// generation t draws from its own random stream, and candidates are
+// accepted in the order proposed, so the results don't depend on the
+// number of threads.
+void runabc(char *paramfilename, const abcdata *dat, uint64_t seed, int numthreads, FILE *fd, FILE *fdabc){
+  char plines[MAXABCPARAMS][200];
+  char names[MAXABCPARAMS][50], tempword[200];
+  double lo[MAXABCPARAMS], hi[MAXABCPARAMS], sd[MAXABCPARAMS];
+  double eps[MAXABCGENS];
+  int numeps=0, adaptive, maxgens, numparticles, maxsims;
+  double quant, finaleps, epsnow, u, tot, kern, mean, var;
+  int npar, i, j, k, t, c, numacc=0, oldnumacc=0, numsims, numearly, numextinct, numabandoned, batchsize;
+  std::vector<double> theta, oldtheta, w, oldw, dist;
+  std::vector<abcjob> jobs;
+  std::vector<std::thread> workers;
+  cbrng pgen;
+  abcbatch b;
+
+  npar=getoptionlines(paramfilename, "abc_prior", plines, MAXABCPARAMS);
+  if(npar==0){
+    fprintf(stderr, "ERROR: ABC calibration needs at least one line \"abc_prior <name> <min> <max>\". EXITING.\n");
+    exit(0);
+  }
+  for(k=0;k<npar;k++){
+    getnthblock(plines[k], names[k], 50, 2);
+    getnthblock(plines[k], tempword, 50, 3);lo[k]=atof(tempword);
+    getnthblock(plines[k], tempword, 50, 4);hi[k]=atof(tempword);
+    if(!(hi[k]>lo[k])){
+      fprintf(stderr, "ERROR: invalid prior range for %s. EXITING.\n", names[k]);
+      exit(0);
+    }
+    fprintf(fd, "abc_prior %s %.4f %.4f\n", names[k], lo[k], hi[k]);
+  }
+  numparticles=getoptioni(paramfilename, "abc_particles", 100, fd);
+  while(numeps<MAXABCGENS && getoption(paramfilename, "abc_tolerances", numeps+1, tempword, 200)==0 && tempword[0]!='\0')
+    eps[numeps++]=atof(tempword);
+  adaptive=(numeps==0);
+  if(adaptive){
+    quant=getoptionf(paramfilename, "abc_quantile", 0.5, fd);//next tolerance is this quantile of the distances
+    finaleps=getoptionf(paramfilename, "abc_final_tolerance", 0.1, fd);
+    maxgens=getoptioni(paramfilename, "abc_generations", 10, fd);
+  }
+  else{
+    quant=0.5;finaleps=eps[numeps-1];
+    maxgens=numeps;
+  }
+  if(maxgens>MAXABCGENS)
+    maxgens=MAXABCGENS;
+  maxsims=getoptioni(paramfilename, "abc_max_sims", 100*numparticles, fd);//per generation
+
+  theta.resize(numparticles*npar);w.resize(numparticles);dist.resize(numparticles);
+  batchsize=4*numthreads<16?16:4*numthreads;
+  epsnow=adaptive?HUGE_VAL:eps[0];
+
+  fprintf(fdabc, "#weight\tdistance");
+  for(k=0;k<npar;k++)
+    fprintf(fdabc, "\t%s", names[k]);
+  fprintf(fdabc, "\n");
+
+  for(t=0;t<maxgens;t++){
+    numacc=0;numsims=0;numearly=0;numextinct=0;numabandoned=0;c=0;
+    if(t>0){//kernel widths from the previous generation
+      for(k=0;k<npar;k++){
+	mean=0;var=0;
+	for(i=0;i<oldnumacc;i++)
+	  mean+=oldw[i]*oldtheta[i*npar+k];
+	for(i=0;i<oldnumacc;i++)
+	  var+=oldw[i]*(oldtheta[i*npar+k]-mean)*(oldtheta[i*npar+k]-mean);
+	sd[k]=sqrt(2.0*var);
+	if(!(sd[k]>0))
+	  sd[k]=1e-6*(hi[k]-lo[k]);
+      }
+    }
+
+    while(numacc<numparticles && numsims<maxsims){
+      jobs.resize(batchsize);
+      for(j=0;j<batchsize;j++){// propose a batch
+	jobs[j].theta.resize(npar);
+	pgen.seed(seed, ((uint64_t)(t+1)<<40)|((uint64_t)c<<1));
+	do{
+	  if(t==0){//from the prior
+	    for(k=0;k<npar;k++)
+	      jobs[j].theta[k]=lo[k]+(hi[k]-lo[k])*pgen.u01();
+	  }
+	  else{//perturb a particle of the previous generation
+	    u=pgen.u01();tot=0;
+	    for(i=0;i<oldnumacc-1;i++){
+	      tot+=oldw[i];
+	      if(u<tot)
+		break;
+	    }
+	    for(k=0;k<npar;k++)
+	      jobs[j].theta[k]=oldtheta[i*npar+k]+norml(0.0, sd[k], pgen);
+	  }
+	  for(k=0;k<npar;k++){//inside the prior support?
+	    if(jobs[j].theta[k]<lo[k] || jobs[j].theta[k]>hi[k])
+	      break;
+	  }
+	}while(k<npar);
+	numoverrides=0;
+	for(k=0;k<npar;k++)
+	  setoverride(names[k], jobs[j].theta[k]);
+	readparams(paramfilename, &(jobs[j].p), NULL);
+	setupparams(&(jobs[j].p));
+	jobs[j].stream=((uint64_t)(t+1)<<40)|((uint64_t)c<<1)|1;
+	c++;
+      }
+      numoverrides=0;
+
+      b.jobs=&jobs;b.next=0;b.dat=dat;b.seed=seed;b.eps=epsnow;
+      workers.clear();
+      for(j=1;j<numthreads;j++)
+	workers.push_back(std::thread(abcworker, &b));
+      abcworker(&b);
+      for(j=0;j<(int)workers.size();j++)
+	workers[j].join();
+
+      for(j=0;j<batchsize;j++){// accept in the order proposed
+	if(numacc<numparticles && numsims<maxsims){
+	  numsims++;
+	  numearly+=jobs[j].early;
+	  numextinct+=jobs[j].extinct;
+	  numabandoned+=jobs[j].abandoned;
+	  if(jobs[j].dist<HUGE_VAL && jobs[j].dist<=epsnow){
+	    dist[numacc]=jobs[j].dist;
+	    for(k=0;k<npar;k++)
+	      theta[numacc*npar+k]=jobs[j].theta[k];
+	    numacc++;
+	  }
+	}
+	freeparams(&(jobs[j].p));
+      }
+    }
+
+    if(numacc==0){
+      fprintf(stderr, "ABC: no particles accepted in generation %d after %d simulations. Stopping.\n", t, numsims);
+      fprintf(fd, "ABC: no particles accepted in generation %d after %d simulations.\n", t, numsims);
+      numacc=oldnumacc;
+      break;
+    }
+
+    //importance weights (the prior is uniform)
+    tot=0;
+    for(i=0;i<numacc;i++){
+      if(t==0)
+	w[i]=1.0;
+      else{
+	kern=0;
+	for(j=0;j<oldnumacc;j++){
+	  u=oldw[j];
+	  for(k=0;k<npar;k++)
+	    u*=exp(-0.5*pow((theta[i*npar+k]-oldtheta[j*npar+k])/sd[k], 2))/sd[k];
+	  kern+=u;
+	}
+	w[i]=kern>0?1.0/kern:0;
+      }
+      tot+=w[i];
+    }
+    for(i=0;i<numacc;i++)
+      w[i]/=tot;
+
+    fprintf(fdabc, "#generation %d tolerance %.6f simulations %d accepted %d early_terminated %d died_out %d abandoned %d\n", t, epsnow, numsims, numacc, numearly, numextinct, numabandoned);
+    for(i=0;i<numacc;i++){
+      fprintf(fdabc, "%.6g\t%.6f", w[i], dist[i]);
+      for(k=0;k<npar;k++)
+	fprintf(fdabc, "\t%.6g", theta[i*npar+k]);
+      fprintf(fdabc, "\n");
+    }
+    fprintf(fdabc, "\n");fflush(fdabc);
+    fprintf(stderr, "ABC generation %d: tolerance=%.4f, %d accepted from %d simulations (%d terminated early)\n", t, epsnow, numacc, numsims, numearly);
+    fprintf(fd, "ABC generation %d: tolerance=%.4f, %d accepted from %d simulations (%d terminated early, %d died out, %d abandoned)\n", t, epsnow, numacc, numsims, numearly, numextinct, numabandoned);
+
+    oldtheta=theta;oldw=w;oldnumacc=numacc;
+    if(numacc<numparticles){
+      fprintf(stderr, "ABC: only %d of %d particles accepted within abc_max_sims=%d. Stopping.\n", numacc, numparticles, maxsims);
+      break;
+    }
+    //the next tolerance
+    if(adaptive){
+      if(epsnow<=finaleps)
+	break;
+      std::vector<double> sorted(dist.begin(), dist.begin()+numacc);//(the distances of the accepted particles, unweighted)
+      std::sort(sorted.begin(), sorted.end());
+      epsnow=quantile(sorted, quant);
+      if(epsnow<finaleps)
+	epsnow=finaleps;
+    }
+    else if(t+1<numeps)
+      epsnow=eps[t+1];
+  }
+
+  //posterior summary
+  fprintf(fd, "ABC posterior (weighted mean and SD):\n");
+  for(k=0;k<npar;k++){
+    mean=0;var=0;
+    for(i=0;i<oldnumacc;i++)
+      mean+=oldw[i]*oldtheta[i*npar+k];
+    for(i=0;i<oldnumacc;i++)
+      var+=oldw[i]*(oldtheta[i*npar+k]-mean)*(oldtheta[i*npar+k]-mean);
+    fprintf(fd, "%s\t%.6g\t%.6g\n", names[k], mean, sqrt(var));
+    fprintf(stderr, "%s: %.6g (SD %.6g)\n", names[k], mean, sqrt(var));
+  }
+}
+
+
+// trueR0 for a set of parameters. With gamma distributed numbers to infect
+// it is computed exactly from the gamma distribution (see gamstats.h),
+// along with other statistics of the number to infect, and values are kept
+// for reuse by later points of a sweep and, in the file dist_cache, by later
+// launches. Otherwise it is the mean of the distribution.
+struct r0entry{
+  double R0, infshp;
+  gamstats st;
+};
+std::vector<r0entry> r0cache;
+
+double gettrueR0(params *p){
+  int i;
+  double trueR0=0;
+  size_t k;
+  r0entry e;
+  if(p->offspring)
+    return p->offspring->mean();
+  if(!p->gamswtch){
+    for(i=1;i<=p->maxP;i++)
+      trueR0+=(i-1)*((double)(p->P[i-1]-p->P[i]))/1000.0;
+    trueR0+=p->maxP*((double)(p->P[p->maxP]))/1000.0;
+    return trueR0;
+  }
+  for(k=0;k<r0cache.size();k++){
+    if(r0cache[k].R0==p->R0 && r0cache[k].infshp==p->infshp){
+      p->infstats=r0cache[k].st;
+      return p->infstats.mean;
+    }
+  }
+  cachedgammastats(p->dist_cache, p->R0, p->infshp, MAXDISCPROB-1, &(p->infstats));
+  e.R0=p->R0;e.infshp=p->infshp;e.st=p->infstats;
+  r0cache.push_back(e);
+  return p->infstats.mean;
+}
+
+// The output of every run, kept after the files have been written
+struct pointresult{
+  int **alloutput;
+  int num_runs;//runs done
+};
+
+// The output files and stored results of one set of parameters
+struct pointout{
+  FILE *fd, *fd1, *fd5, *fd6, *fd7, *fdq; //files to store output
+  int **alloutput;//to store all the simulation output
+  double **avoutput, **SEoutput;//to store average, SE of output, synchronised
+  int *delays;
+  int num_runs, totdays;
+  int keep;//keep alloutput after closing (for paired differences)?
+  int numextinct;//runs which died out
+  double *weights;//weight of each run (NULL: all 1)
+  int *roots;//which of the original runs each run descends from (if weights)
+  int numquant;
+  double quant[MAXQUANT];//quantiles written to _quant, increasing
+  int qmethod;//1: quantiles from t-digests of each output on each day...
+  std::vector<tdigest> tdsync, tdunsync;//...of runs with and without a positive delay
+  FILE *fdstore;//result store (NULL: none)
+  castoreheader sh;
+#ifdef PROFILE
+  FILE *fdprof;//profile
+  profile run, tot;//this run so far, and all runs
+#endif
+};
+
+#ifdef PROFILE
+// One line of the profile file. level is "day", "run" or "point"; run and
+// day are -1 where they don't apply
+void writeprofile(FILE *fd, const char *level, int r, int day, const profile *pr){
+  int i;
+  fprintf(fd, "%s\t%d\t%d", level, r, day);
+  for(i=0;i<NUMPHASES;i++)
+    fprintf(fd, "\t%.6g", pr->t[i]);
+  for(i=0;i<NUMEVENTS;i++)
+    fprintf(fd, "\t%ld", pr->n[i]);
+  fprintf(fd, "\n");
+}
+#endif
+
+//
+// The result store (layout in castore.h)
+//
+
+void storewrite(FILE *fd, int64_t off, const void *buf, size_t n){
+  if(fseeko(fd, off, SEEK_SET)!=0 || fwrite(buf, 1, n, fd)!=n){
+    fprintf(stderr, "ERROR: could not write the result store. EXITING.\n");
+    exit(0);
+  }
+}
+
+// A store with room for maxruns runs
+void openstore(pointout *o, const char fname[], int maxruns){
+  castoreheader *h=&o->sh;
+  int64_t tbl=(int64_t)maxruns*sizeof(int64_t);
+  o->fdstore=openftowrite(fname);
+  memset(h, 0, sizeof(castoreheader));
+  memcpy(h->magic, CASTORE_MAGIC, 8);
+  h->version=CASTORE_VERSION;
+  h->maxruns=maxruns;h->totdays=o->totdays;
+  h->cols=CASTORE_COLS;h->datacols=CASTORE_DATACOLS;
+  h->delayoff=sizeof(castoreheader);
+  h->weightoff=h->delayoff+tbl;
+  h->rootoff=h->weightoff+tbl;
+  h->outoff=(h->rootoff+tbl+CASTORE_ALIGN-1)/CASTORE_ALIGN*CASTORE_ALIGN;
+  storewrite(o->fdstore, 0, h, sizeof(castoreheader));
+}
+
+// Add run r, which has finished
+void storerun(pointout *o, int r){
+  castoreheader *h=&o->sh;
+  std::vector<int64_t> buf((size_t)o->totdays*CASTORE_COLS);
+  int64_t v;
+  double w;
+  int i, m;
+  for(m=0;m<o->totdays;m++){
+    for(i=0;i<CASTORE_COLS;i++)
+      buf[m*CASTORE_COLS+i]=o->alloutput[r*o->totdays+m][i];
+  }
+  storewrite(o->fdstore, h->outoff+(int64_t)r*buf.size()*sizeof(int64_t), &buf[0], buf.size()*sizeof(int64_t));
+  v=o->delays[r];
+  storewrite(o->fdstore, h->delayoff+r*sizeof(int64_t), &v, sizeof(int64_t));
+  w=o->weights?o->weights[r]:1.0;
+  storewrite(o->fdstore, h->weightoff+r*sizeof(double), &w, sizeof(double));
+  v=o->roots?o->roots[r]:r;
+  storewrite(o->fdstore, h->rootoff+r*sizeof(int64_t), &v, sizeof(int64_t));
+  if(r>=h->num_runs)
+    h->num_runs=r+1;
+  h->runsdone++;
+  h->weighted=(o->weights!=NULL);
+  storewrite(o->fdstore, 0, h, sizeof(castoreheader));
+  fflush(o->fdstore);
+}
+
+// All runs done: add the data and close
+void closestore(pointout *o, int **realdata, int totdata){
+  castoreheader *h=&o->sh;
+  std::vector<int64_t> buf((size_t)totdata*CASTORE_DATACOLS+1);
+  int i, m;
+  h->num_runs=o->num_runs;
+  h->totdata=totdata;
+  h->realoff=h->outoff+h->num_runs*h->totdays*CASTORE_COLS*sizeof(int64_t);
+  fflush(o->fdstore);
+  if(ftruncate(fileno(o->fdstore), h->realoff)!=0)//(nothing beyond the runs kept)
+    fprintf(stderr, "WARNING: could not truncate the result store.\n");
+  for(m=0;m<totdata;m++){
+    for(i=0;i<CASTORE_DATACOLS;i++)
+      buf[m*CASTORE_DATACOLS+i]=realdata[m][i];
+  }
+  if(totdata>0)
+    storewrite(o->fdstore, h->realoff, &buf[0], (size_t)totdata*CASTORE_DATACOLS*sizeof(int64_t));
+  h->complete=1;
+  storewrite(o->fdstore, 0, h, sizeof(castoreheader));
+  fclose(o->fdstore);
+}
+
+// Open the output file (starting with "header", the options used), "_log",
+// "_av", "_sync1", "_sync" and "_quant" (unless result_store is 2) and "_store" (if
+// result_store is set) for a set of parameters.
+void openpoint(pointout *o, const params *p, const char outfilename[], const char *header, double trueR0){
+  int i;
+  char endfname[306], logfname[304];
+  o->fd1=openftowrite(outfilename); //tab separated output
+  fputs(header, o->fd1);
+  o->fd5=o->fd6=o->fd7=o->fdq=NULL;
+  if(p->result_store!=2){//(otherwise derived from the store by castore)
+    strcpy(endfname, outfilename);strcat(endfname, "_av");
+    o->fd5=openftowrite(endfname); //tab separated output - average values
+    strcpy(endfname, outfilename);strcat(endfname, "_sync1");
+    o->fd6=openftowrite(endfname); //tab separated output - average values
+    if(p->sync_file){
+      strcpy(endfname, outfilename);strcat(endfname, "_sync");
+      o->fd7=openftowrite(endfname); //tab separated output - values after synchronisation
+    }
+    if(p->numquant>0){
+      strcpy(endfname, outfilename);strcat(endfname, "_quant");
+      o->fdq=openftowrite(endfname); //tab separated output - quantiles after synchronisation
+    }
+  }
+  o->numquant=p->numquant;
+  for(i=0;i<o->numquant;i++)
+    o->quant[i]=p->quant[i];
+  o->qmethod=p->quantile_method;
+
+  strcpy(logfname, outfilename);strcat(logfname, "_log");
+  o->fd=openftowrite(logfname); //log file
+#ifdef PROFILE
+  strcpy(logfname, outfilename);strcat(logfname, "_prof");
+  o->fdprof=openftowrite(logfname); //profile
+  fprintf(o->fdprof, "#seconds in each phase (exclusive of phases within it) and numbers of individuals\nlevel\trun\tday");
+  for(i=0;i<NUMPHASES;i++)
+    fprintf(o->fdprof, "\t%s", phasenames[i]);
+  for(i=0;i<NUMEVENTS;i++)
+    fprintf(o->fdprof, "\t%s", eventnames[i]);
+  fprintf(o->fdprof, "\n");
+  memset(&o->run, 0, sizeof(profile));memset(&o->tot, 0, sizeof(profile));
+#endif
+
+  o->num_runs=p->num_runs;o->totdays=p->totdays;o->keep=0;o->numextinct=0;
+  o->weights=NULL;o->roots=NULL;
+  o->alloutput=imatrix(0, p->num_runs*p->totdays-1, 0, 9);
+  o->avoutput=dmatrix(0, p->totdays-1, 0, 12);
+  o->SEoutput=dmatrix(0, p->totdays-1, 0, 12);
+  o->delays=(int *)malloc((size_t) ((p->num_runs)*sizeof(int)));
+  o->fdstore=NULL;
+  if(p->result_store){
+    strcpy(endfname, outfilename);strcat(endfname, "_store");
+    openstore(o, endfname, p->num_runs);
+  }
+
+  if(p->offspring){//probabilities of infecting 0, 1, 2, ...
+    for(i=0;i<=p->maxP;i++)
+      fprintf(o->fd, "%.6f\n", p->offspring->prob[i]);
+  }
+  else if(!p->gamswtch){
+    for(i=0;i<=p->maxP;i++)
+      fprintf(o->fd, "%d\n", p->P[i]);
+  }
+  fprintf(o->fd, "R0=%.4f, trueR0=%.4f\n", p->R0, trueR0);
+  if(p->gamswtch && p->infstats.mean>=0)
+    fprintf(o->fd, "number to infect: SD=%.4f, P(0)=%.4f, P(%d)=%.3g\n", p->infstats.sd, p->infstats.p0, MAXDISCPROB-1, p->infstats.pcap);
+  fprintf(o->fd, "run\tactualR0\tavdthtime\tavrecovtime\tavtesttime\tavserotime%s\n", p->numsplits>0?"\tfrom_run\tweight":"");
+}
+
+// Record the output of day row[0] of run r
+void recordday(pointout *o, int r, const int row[]){
+  PROFTIMER(PH_OUTPUT);
+  int i;
+  fprintf(o->fd1,"%d\t%d\t%d\t%d\t %d\t%d\t%d\t%d\t%d\t%d\n", row[0], row[1], row[2], row[3], row[4], row[5], row[6], row[7], row[8], row[9]);
+  for(i=0;i<10;i++)
+    o->alloutput[r*o->totdays+row[0]][i]=row[i];
+
+  //      fprintf(fd3, "\n");fflush(fd3);
+  fflush(o->fd);fflush(o->fd1);
+#ifdef PROFILE
+  PROFSTOP();
+  writeprofile(o->fdprof, "day", r+1, row[0], &profnow);
+  addprofile(&o->run, &profnow, 1);
+#endif
+}
+
+// Output text is put together in a buffer and written in large pieces, as
+// fprintf for each value is slow for large ensembles
+void bufint(std::string &b, int v){//as "%d\t"
+  char t[16];
+  int k=15;
+  unsigned int u=v<0?-(unsigned int)v:v;
+  t[k]='\t';
+  do{
+    t[--k]='0'+u%10;u/=10;
+  }while(u);
+  if(v<0)
+    t[--k]='-';
+  b.append(t+k, 16-k);
+}
+
+void bufdbl(std::string &b, const char *fmt, double v){
+  char t[400];
+  int len=snprintf(t, 400, fmt, v);
+  b.append(t, len<400?len:399);
+}
+
+void bufwrite(std::string &b, FILE *fd, size_t atleast){
+  if(b.size()>=atleast){
+    fwrite(b.data(), 1, b.size(), fd);
+    b.clear();
+  }
+}
+
+// The rows of run r from the synchronisation point on, with the data, in
+// the _sync file
+void writesyncrun(const pointout *o, int r, int **realdata, int totdata){
+  int i, m;
+  int **alloutput=o->alloutput;
+  int *delays=o->delays;
+  std::string b;
+
+  //Only output to synchronisation file if there is a data file and synchronisation point reached and positive delay
+  if(delays[r]>0){
+    for(m=0;m<o->totdays-delays[r];m++){
+	for(i=0;i<10;i++)
+	  bufint(b, alloutput[r*o->totdays+m+delays[r]][i]);
+	if(m<totdata){
+	  for(i=0;i<3;i++)
+	    bufint(b, realdata[m][i]);
+	}
+	else
+	  b+="?\t?\t?\t";
+	b+="\n";
+    }
+    b+="\n";
+    bufwrite(b, o->fd7, 0);
+    fflush(o->fd7);
+  }
+}
+
+// Add run r to the t-digests: each output on each day from the
+// synchronisation point on (a run which synchronised before sync_at_time,
+// with a negative delay, is taken unshifted)
+void digestrun(pointout *o, int r){
+  int i, m, d=o->delays[r]>0?o->delays[r]:0;
+  double w=o->weights?o->weights[r]:1.0;
+  const int *row;
+  std::vector<tdigest> &td=d>0?o->tdsync:o->tdunsync;
+  if(td.empty())
+    td.resize((size_t)o->totdays*9);
+  for(m=0;m<o->totdays-d;m++){
+    row=o->alloutput[r*o->totdays+m+d];
+    for(i=1;i<10;i++)
+      td[(size_t)m*9+i-1].add(row[i], w);
+  }
+}
+
+// Run r has finished in state s
+void endrun(pointout *o, int r, const runstate *s, int **realdata, int totdata){
+  PROFTIMER(PH_OUTPUT);
+  //synchronisation point never reached (died out?) gives delay 0
+  o->delays[r]=s->syncflag?s->delay:0;
+  if(s->extinct>=0)
+    o->numextinct++;
+  if(o->fd7)
+    writesyncrun(o, r, realdata, totdata);
+  if(o->fdq && o->qmethod)
+    digestrun(o, r);
+  if(o->fdstore)
+    storerun(o, r);
+
+  fprintf(o->fd1,"\n");
+  fprintf(o->fd, "%d\t%.4f\t%.4f\t%.4f\t%.4f\t%.4f", r+1, s->actualR0, s->avdthtime, s->avrecovtime, s->avtesttime, s->avserotime);
+  if(o->weights)
+    fprintf(o->fd, "\t%d\t%.6g", o->roots[r]+1, o->weights[r]);
+  fprintf(o->fd, "\n");
+#ifdef PROFILE
+  PROFSTOP();
+  addprofile(&o->run, &profnow, 1);
+  writeprofile(o->fdprof, "run", r+1, -1, &o->run);
+  addprofile(&o->tot, &o->run, 1);
+#endif
+}
+
+// The quantiles o->quant[] of the n values x[] with weights w[] (NULL: all
+// 1): the smallest value at which the cumulative weight reaches each
+// fraction of the total
+void getquantiles(const pointout *o, const int *x, const double *w, int n, double totw, int *res){
+  int k, j;
+  double c;
+  if(!w){
+    std::vector<int> v(x, x+n);
+    std::sort(v.begin(), v.end());
+    for(j=0;j<o->numquant;j++){
+      k=(int)ceil(o->quant[j]*n-1e-9)-1;
+      res[j]=v[k<0?0:(k>=n?n-1:k)];
+    }
+    return;
+  }
+  std::vector<std::pair<int, double> > v(n);
+  for(k=0;k<n;k++)
+    v[k]=std::make_pair(x[k], w[k]);
+  std::sort(v.begin(), v.end());
+  for(j=0,k=0,c=v[0].second;j<o->numquant;j++){
+    while(k<n-1 && c<o->quant[j]*totw*(1-1e-12))
+      c+=v[++k].second;
+    res[j]=v[k].first;
+  }
+}
+
+// The averages and standard errors over runs, in the _av and _sync1 files,
+// and quantiles in the _quant file (exact, or from the t-digests). With weights the averages are weighted,
+// and the runs descended from one original run are taken together as one
+// sample for the standard errors. The values of the runs included are first
+// copied, synchronised, to an array for each output and day, so that each
+// statistic is a pass through consecutive memory.
+void writeaverages(pointout *o, int **realdata, int totdata){
+  int i, j, m, r, k, n, nk, nd, hasany, totsims, maxdel;
+  int64_t isum;
+  double tmpSD, d, totw, Y, W, av;
+  int **alloutput=o->alloutput;
+  double **avoutput=o->avoutput, **SEoutput=o->SEoutput;
+  int *delays=o->delays;
+  const int *x, *row;
+  std::vector<int> runs, sample, xs, q;
+  std::vector<char> incl(o->num_runs);
+  std::vector<double> w;
+  std::string b;
+  FILE *fd5=o->fd5, *fd6=o->fd6, *fdq=o->fdq;
+
+  totsims=0;
+  maxdel=0;
+  for(r=0;r<o->num_runs;r++){
+    if(delays[r]>0){
+      totsims++;
+      if(delays[r]>maxdel){maxdel=delays[r];}
+    }
+  }
+  //only output to average file if there is a data file and synchronisation point reached and positive delay
+  nd=o->totdays-maxdel;
+
+  //the runs included, and the sample each is part of
+  n=0;hasany=0;totw=0;
+  for(r=0;r<o->num_runs;r++){
+    if((incl[r]=((totsims>0 && delays[r]>0) || totsims==0))){
+      runs.push_back(r);sample.push_back(n);
+      w.push_back(o->weights?o->weights[r]:1.0);
+      totw+=w.back();
+      hasany=1;
+    }
+    if(hasany && (!o->roots || r==o->num_runs-1 || o->roots[r+1]!=o->roots[r])){//end of a sample
+      n++;hasany=0;
+    }
+  }
+  nk=runs.size();
+  xs.resize((size_t)10*nd*nk);
+  for(k=0;k<nk;k++){
+    r=runs[k];
+    for(m=0;m<nd;m++){
+      row=alloutput[r*o->totdays+m+delays[r]];
+      for(i=0;i<10;i++)
+	xs[((size_t)i*nd+m)*nk+k]=row[i];
+    }
+  }
+
+  q.resize((size_t)10*nd*o->numquant);
+  for(i=0;i<10;i++){
+    for(m=0;m<nd;m++){
+      x=&xs[((size_t)i*nd+m)*nk];
+      if(!o->weights){//(an integer sum is exact, so the same as summing in any order)
+	isum=0;
+	for(k=0;k<nk;k++)
+	  isum+=x[k];
+	av=isum/totw;
+	tmpSD=0.0;
+	for(k=0;k<nk;k++){
+	  d=x[k]-av;
+	  tmpSD+=d*d;
+	}
+      }
+      else{
+	av=0;
+	for(k=0;k<nk;k++)
+	  av+=w[k]*x[k];
+	av/=totw;
+	tmpSD=0.0;Y=0;W=0;
+	for(k=0;k<nk;k++){
+	  Y+=w[k]*x[k];W+=w[k];
+	  if(k==nk-1 || sample[k+1]!=sample[k]){
+	    tmpSD+=(Y-av*W)*(Y-av*W);
+	    Y=0;W=0;
+	  }
+	}
+      }
+      avoutput[m][i]=av;
+      if(n>1){
+	tmpSD/=((double)n-1.0);//population SD
+	W=totw/n;//mean weight of a sample
+	SEoutput[m][i]=sqrt(tmpSD/((double)n*W*W));//SE
+      }
+      else{
+	SEoutput[m][i]=0.0;
+      }
+      if(fdq && i>0 && nk>0){
+	if(o->qmethod){//estimates
+	  tdigest &td=(totsims>0?o->tdsync:o->tdunsync)[(size_t)m*9+i-1];
+	  for(j=0;j<o->numquant;j++)
+	    q[((size_t)m*10+i)*o->numquant+j]=(int)floor(td.quantile(o->quant[j])+0.5);
+	}
+	else
+	  getquantiles(o, x, o->weights?&w[0]:NULL, nk, totw, &q[((size_t)m*10+i)*o->numquant]);
+      }
+    }
+  }
+
+  for(m=0;m<nd;m++){//average file
+    for(i=0;i<10;i++)
+      bufdbl(b, "%.1f\t", avoutput[m][i]);
+    for(i=0;i<10;i++)
+      bufdbl(b, "%.4f\t", SEoutput[m][i]);
+    if(m<totdata){//output data from the datafile too
+      for(i=0;i<3;i++)
+	bufint(b, realdata[m][i]);
+    }
+    else
+      b+="?\t?\t?\t";
+    b+="\n";
+  }
+  for(m=nd;m<o->totdays;m++){
+    for(i=0;i<10;i++){
+      avoutput[m][i]=-1;
+      SEoutput[m][i]=0;
+    }
+    b+="-1.0\t-1.0\t-1.0\t-1.0\t-1.0\t-1.0\t-1.0\t-1.0\t-1.0\t-1.0\t0.0\t0.0\t0.0\t0.0\t0.0\t0.0\t0.0\t0.0\t0.0\t0.0\t?\t?\t?\t\n";
+  }
+  bufwrite(b, fd5, 0);
+
+  for(m=0;m<nd;m++){//grouped sync file
+    for(r=0;r<o->num_runs;r++){
+      bufint(b, m);
+      row=alloutput[r*o->totdays+m+delays[r]];
+      for(i=1;i<10;i++){
+	if(incl[r])
+	  bufint(b, row[i]);
+	else
+	  b+="0\t";
+      }
+      if(m<totdata){//output data from the datafile too
+	for(i=0;i<3;i++)
+	  bufint(b, realdata[m][i]);
+      }
+      else
+	b+="?\t?\t?\t";
+      b+="\n";
+    }
+    bufint(b, m);
+    for(i=1;i<10;i++)
+      bufdbl(b, "%.1f\t", avoutput[m][i]);
+    if(m<totdata){//death undercount, mean + 95%CI
+      bufdbl(b, "%.4f\t", 100.0*(avoutput[m][4]-realdata[m][1])/avoutput[m][4]);
+      bufdbl(b, "%.4f\t", 100.0*((avoutput[m][4]-1.96*SEoutput[m][4])-realdata[m][1])/(avoutput[m][4]-1.96*SEoutput[m][4]));
+      bufdbl(b, "%.4f\t", 100.0*((avoutput[m][4]+1.96*SEoutput[m][4])-realdata[m][1])/(avoutput[m][4]+1.96*SEoutput[m][4]));
+    }
+    b+="\n";
+    bufint(b, m);
+    for(i=1;i<10;i++)
+      bufdbl(b, "%.4f\t", SEoutput[m][i]);
+    if(m<totdata){//case undercount, mean + 95%CI
+      bufdbl(b, "%.4f\t", 100.0*(avoutput[m][6]-realdata[m][0])/avoutput[m][6]);
+      bufdbl(b, "%.4f\t", 100.0*((avoutput[m][6]-1.96*SEoutput[m][6])-realdata[m][0])/(avoutput[m][6]-1.96*SEoutput[m][6]));
+      bufdbl(b, "%.4f\t", 100.0*((avoutput[m][6]+1.96*SEoutput[m][6])-realdata[m][0])/(avoutput[m][6]+1.96*SEoutput[m][6]));
+    }
+    b+="\n\n";
+    bufwrite(b, fd6, 1<<20);
+  }
+  bufwrite(b, fd6, 0);
+
+  if(!fdq || nk==0)
+    return;
+  //quantiles, and the undercounts they imply
+  b+=o->qmethod?"#quantiles (t-digest estimates)":"#quantiles";
+  b+=" over runs of each output after synchronisation, and the death and case undercounts (%) at these quantiles\nday\toutput";
+  for(j=0;j<o->numquant;j++)
+    bufdbl(b, "\tq%g", o->quant[j]);
+  b+="\n";
+  for(m=0;m<nd;m++){
+    for(i=1;i<10;i++){
+      bufint(b, m);
+      b+=colnames[i];
+      for(j=0;j<o->numquant;j++){
+	b+="\t";
+	bufint(b, q[((size_t)m*10+i)*o->numquant+j]);
+	b.erase(b.size()-1);
+      }
+      b+="\n";
+    }
+    if(m<totdata){
+      for(k=0;k<2;k++){//deaths, then cases
+	bufint(b, m);
+	b+=k==0?"death_undercount":"case_undercount";
+	for(j=0;j<o->numquant;j++){
+	  d=q[((size_t)m*10+(k==0?4:6))*o->numquant+j];
+	  bufdbl(b, "\t%.4f", 100.0*(d-realdata[m][k==0?1:0])/d);
+	}
+	b+="\n";
+      }
+    }
+    bufwrite(b, fdq, 1<<20);
+  }
+  bufwrite(b, fdq, 0);
+}
+
+// All runs done: write the averages and close the files
+void closepoint(pointout *o, int **realdata, int totdata){
+  PROFTIMER(PH_OUTPUT);
+  if(o->fd5)
+    writeaverages(o, realdata, totdata);
+  if(o->fdstore)
+    closestore(o, realdata, totdata);
+  fprintf(o->fd, "runs which died out: %d of %d\n", o->numextinct, o->num_runs);
+#ifdef PROFILE
+  PROFSTOP();
+  addprofile(&o->tot, &profnow, 1);
+  writeprofile(o->fdprof, "point", -1, -1, &o->tot);
+  fclose(o->fdprof);
+#endif
+  fclose(o->fd);fclose(o->fd1);
+  if(o->fd5){
+    fclose(o->fd5);fclose(o->fd6);
+  }
+  if(o->fd7)
+    fclose(o->fd7);
+  if(o->fdq)
+    fclose(o->fdq);
+  std::vector<tdigest>().swap(o->tdsync);std::vector<tdigest>().swap(o->tdunsync);
+  if(!o->keep)
+    free_imatrix(o->alloutput, 0, o->num_runs*o->totdays-1, 0, 9);
+  free_dmatrix(o->avoutput, 0, o->totdays-1, 0, 9);
+  free_dmatrix(o->SEoutput, 0, o->totdays-1, 0, 9);
+  free((char*)o->delays);
+}
+
+//
+// Checkpointing
+//
 
-  if(scale_at_infs>0)
-    dynmultiply=1;
-  else
-    dynmultiply=0;
-
-  alloutput=imatrix(0, num_runs*totdays-1, 0, 9);
-  avoutput=dmatrix(0, totdays-1, 0, 12);
-  SEoutput=dmatrix(0, totdays-1, 0, 12);
-  delays=(int *)malloc((size_t) ((num_runs)*sizeof(int)));
-
-  //gamma distribution on individual R0 values
-  if(geometric==-1){gamswtch=1;}
-  infscl=R0/infshp;
-
-  //fd3=fopen("data1/graph", "w");
-
-  //How is the number to infect distributed? How to truncate?
-  if(geometric==1){maxP=2*R0*(R0+1)<MAXDISCPROB?(int)(2*R0*(R0+1)):MAXDISCPROB;P=discGeom(R0, maxP);}//geometric (2 SD)
-  else{maxP=3*R0<MAXDISCPROB?(int)(3*R0):MAXDISCPROB;P=discPois(R0, maxP);}//Poisson (three SD)
+// Checkpoints are two files. "<output_file>_ckpt_runs" gets one record
+// (output rows and log values) per finished run, appended as the run ends.
+// "<output_file>_ckpt_state" holds the complete state of the run in
+// progress. The first checkpoint of a run writes the whole state; later
+// ones append what changed since the previous one: the individuals
+// infected since then in full, and only the number, age and quarantine
+// state of those still alive (nothing else about an individual changes
+// after it is created). When the changes appended add up to more than the
+// last full state, the whole state is written afresh. Records are copied
+// into memory and written by a separate thread (whole states to a
+// temporary file, then renamed), which also syncs the records of finished
+// runs, so the day loop only waits if the previous write hasn't finished.
+
+#define CKPTRUNSMAGIC 0x434b5255 //"CKRU"
+#define CKPTSTATEMAGIC 0x434b5354 //"CKST"
+#define CKPTRECMAGIC 0x52454331 //"REC1"
+#define CKPTDELTAMAGIC 0x434b4454 //"CKDT"
+
+struct ckptopts{
+  int every;//days between checkpoints of the run in progress (0: none)
+  int resume;//continue from the checkpoint files?
+};
+
+// FNV-1a hash of the options used: a checkpoint is only used by a run
+// with the same options
+uint64_t hashstring(const char *str){
+  uint64_t h=14695981039346656037ULL;
+  while(*str){
+    h^=(unsigned char)(*str++);
+    h*=1099511628211ULL;
+  }
+  return h;
+}
 
-  percill=20.0;//percentage of people who fall quite ill (not currently used - for hospitalisations data?)
-  percdeath=dthrate*100.0/percill;
+void putbytes(std::vector<char> &b, const void *x, size_t n){
+  b.insert(b.end(), (const char *)x, (const char *)x+n);
+}
 
-  //random seeding
-  timeint = time(&timepoint); /*convert time to an integer */
-  srand(timeint);
-  generator.seed(timeint);//seeding for distribution generator
-
-  trueR0=0;
-  if(!gamswtch){
-    for(i=0;i<=maxP;i++){
-      fprintf(fd, "%d\n", P[i]);
-      if(i>=1){//true R0
-	trueR0+=(i-1)*((double)(P[i-1]-P[i]))/1000.0;
-      }
+int getbytes(const std::vector<char> &b, size_t *pos, void *x, size_t n){
+  if(*pos+n>b.size())
+    return 0;
+  memcpy(x, &b[*pos], n);
+  *pos+=n;
+  return 1;
+}
+
+int readwholefile(const char fname[], std::vector<char> &b){
+  FILE *fd;
+  char tmp[65536];
+  size_t n;
+  b.clear();
+  if(!(fd=fopen(fname, "rb")))
+    return 0;
+  while((n=fread(tmp, 1, sizeof(tmp), fd))>0)
+    b.insert(b.end(), tmp, tmp+n);
+  fclose(fd);
+  return 1;
+}
+
+// write a buffer to fname safely, or append it (runs in its own thread)
+void writeckpt(std::vector<char> *b, std::string fname, int append){
+  std::string tmpname=append?fname:fname+".tmp";
+  FILE *fd=fopen(tmpname.c_str(), append?"ab":"wb");
+  if(!fd){
+    fprintf(stderr, "WARNING: checkpoint file \"%s\" could not be written.\n", tmpname.c_str());
+    return;
+  }
+  fwrite(&(*b)[0], 1, b->size(), fd);
+  fflush(fd);
+  fsync(fileno(fd));
+  fclose(fd);
+  if(!append)
+    rename(tmpname.c_str(), fname.c_str());
+}
+
+// sync the records of finished runs (runs in its own thread)
+void syncckpt(int fd){
+  fsync(fd);
+}
+
+// The seed recorded in "<outfilename>_ckpt_runs", if there is one
+void readckptseed(const char outfilename[], uint64_t *seed){
+  std::string runsname=std::string(outfilename)+"_ckpt_runs";
+  std::vector<char> b;
+  size_t pos=0;
+  int magic;
+  if(readwholefile(runsname.c_str(), b) && getbytes(b, &pos, &magic, sizeof(int)) && magic==CKPTRUNSMAGIC)
+    getbytes(b, &pos, seed, sizeof(uint64_t));
+}
+
+// The run in progress: its state and the rows output so far
+void packstate(std::vector<char> &b, uint64_t hash, int r, const runstate *s, int **alloutput, int totdays){
+  int i, m, nlive=0, magic=CKPTSTATEMAGIC;
+  b.clear();
+  putbytes(b, &magic, sizeof(int));
+  putbytes(b, &hash, sizeof(uint64_t));
+  putbytes(b, &r, sizeof(int));
+  putbytes(b, s, sizeof(runstate));//the pointers in it are not used
+  for(m=0;m<s->day;m++)
+    putbytes(b, alloutput[r*totdays+m], 10*sizeof(int));
+  nlive=s->nlive;
+  putbytes(b, &nlive, sizeof(int));
+  for(i=0;i<s->hiwater;i++){
+    if(s->inflist[i]==1)
+      putbytes(b, s->infs[i], sizeof(inf));
+  }
+}
+
+// What changed in the run in progress since the checkpoint on day
+// "fromday". Ages go up by one a day, so an individual younger than the
+// days since then was infected since then, perhaps in the place of one
+// that has died.
+void packdelta(std::vector<char> &b, int fromday, int r, const runstate *s, int **alloutput, int totdays){
+  int i, m, n=0, magic=CKPTDELTAMAGIC;
+  size_t len, at;
+  b.clear();
+  putbytes(b, &magic, sizeof(int));
+  putbytes(b, &len, sizeof(size_t));//filled in below
+  putbytes(b, s, sizeof(runstate));
+  for(m=fromday;m<s->day;m++)
+    putbytes(b, alloutput[r*totdays+m], 10*sizeof(int));
+  at=b.size();
+  putbytes(b, &n, sizeof(int));
+  for(i=0;i<s->hiwater;i++){//those still alive
+    if(s->inflist[i]==1 && s->infs[i]->age>=s->day-fromday){
+      putbytes(b, &s->infs[i]->num, sizeof(int));
+      putbytes(b, &s->infs[i]->age, sizeof(int));
+      putbytes(b, &s->infs[i]->quar, sizeof(int));
+      n++;
     }
-    trueR0+=maxP*((double)(P[maxP]))/1000.0;
   }
-  else{
-    for(i=0;i<1000000;i++)
-      trueR0+=round(gamma(infshp, infscl, generator))/1000000.0;
+  memcpy(&b[at], &n, sizeof(int));
+  at=b.size();n=0;
+  putbytes(b, &n, sizeof(int));
+  for(i=0;i<s->hiwater;i++){//those infected since
+    if(s->inflist[i]==1 && s->infs[i]->age<s->day-fromday){
+      putbytes(b, s->infs[i], sizeof(inf));
+      n++;
+    }
   }
-  fprintf(fd, "R0=%.4f, trueR0=%.4f\n", R0, trueR0);
-  fprintf(fd, "run\tactualR0\tavdthtime\tavrecovtime\tavtesttime\tavserotime\n");
+  memcpy(&b[at], &n, sizeof(int));
+  len=b.size();
+  memcpy(&b[sizeof(int)], &len, sizeof(size_t));
+}
 
-  //nest order: For each run... for each day... for each individual
-  avinfs=0.0;avdths=0.0;
-  for(r=0;r<num_runs;r++){//Each model run
-    startclock=0;
-    numinf=0;numcurinf=0;numcurinfold=0;numdeaths=0;newdeaths=0;numrecovs=0;
-    numquar=0;numtest=0;newtests=0;numill=0;numsero=0;
-    actualR0=0;avdthtime=0;avrecovtime=0;avserotime=0;avtesttime=0;
-    lockdownday=0;lockdown2day=0;
-    effpop=totpop;
-    pd=0;
-    syncflag=0;syncclock=0;
-    cur_exp=1;
-    multiplier=1;
-
-    for(i=0;i<MAXINFS;i++){inflist[i]=0;}//initialise
-
-    for(i=0;i<init_infs;i++){
-      cur=create(infs, gamswtch, infshp, infscl, P, maxP, inf_gam, inf_start, inf_end, inf_mid, inf_tm_shp, &numinf, &numcurinf, &newinfs, &numill, percill, percdeath, time_to_death, dist_on_death, time_to_recovery, dist_on_recovery, time_to_sero, dist_on_sero, quardate, quarp, dist_on_quardate, testp, testdelay, testdelay_shp);//create
-      //fprintf(fd3, "0 %d\n", cur);
-
-      actualR0=actualR0*((double)(numinf-1))/((double)(numinf))+(double)((infs[cur])->numtoinf)/((double)(numinf));
-
-      //fprintf(stderr, "actualR0=%.4f\n", actualR0);
-      fprintf(stderr, "infs[%d] (illstate=%d) will infect %d at times:\n",cur, infs[cur]->ill, infs[cur]->numtoinf);
-      for(j=0;j<(infs[cur])->numtoinf;j++){
-	fprintf(stderr, "   %d\n", infs[cur]->inftimes[j]);
-      }
+// Apply the changes recorded at b[*pos] to the restored run in progress.
+// Returns 0, without changing anything, if there is no complete record.
+int unpackdelta(const std::vector<char> &b, size_t *pos, int r, runstate *s, int **alloutput, int totdays){
+  size_t p0=*pos, len;
+  int i, m, n=0, num=0, magic;
+  runstate tmps;
+  inf **infs=s->infs;
+  int *inflist=s->inflist;
+  alignas(inf) char raw[sizeof(inf)];
+  if(!getbytes(b, pos, &magic, sizeof(int)) || magic!=CKPTDELTAMAGIC || !getbytes(b, pos, &len, sizeof(size_t)) || len>b.size()-p0 || !getbytes(b, pos, &tmps, sizeof(runstate)) || tmps.day<s->day || tmps.day>totdays){
+    *pos=p0;
+    return 0;
+  }
+  for(m=s->day;m<tmps.day;m++)
+    getbytes(b, pos, alloutput[r*totdays+m], 10*sizeof(int));
+  getbytes(b, pos, &n, sizeof(int));
+  for(i=0;i<n;i++){//survivors are marked 2
+    getbytes(b, pos, &num, sizeof(int));
+    if(num<0 || num>=s->hiwater || inflist[num]!=1){
+      fprintf(stderr, "ERROR: checkpoint state is corrupt. EXITING.\n");
+      exit(0);
     }
-    
-    for(m=0;m<totdays;m++){//each day
-
-      //rescale. kill off half randomly; double weight of remainder
-      if(dynmultiply && numcurinf>=scale_at_infs*int_pow(2,cur_exp-1) && multiplier==int_pow(2,cur_exp-1)){//multiplier
-	cur_exp++;multiplier*=2;
-	for(i=0;i<MAXINFS;i++){// kill off every other active infection
-	  if(inflist[i]==1 && randnum(2)<1)
-	    die(infs[i]);//no removal from stats
-	}
-      }
+    getbytes(b, pos, &infs[num]->age, sizeof(int));
+    getbytes(b, pos, &infs[num]->quar, sizeof(int));
+    inflist[num]=2;
+  }
+  for(i=0;i<s->hiwater;i++){
+    if(inflist[i]==1){//died since
+      delete infs[i];
+      inflist[i]=0;
+    }
+    else if(inflist[i]==2)
+      inflist[i]=1;
+  }
+  getbytes(b, pos, &n, sizeof(int));
+  for(i=0;i<n;i++){
+    getbytes(b, pos, raw, sizeof(inf));
+    num=((inf *)raw)->num;
+    if(num<0 || num>=tmps.hiwater || inflist[num]!=0){
+      fprintf(stderr, "ERROR: checkpoint state is corrupt. EXITING.\n");
+      exit(0);
+    }
+    infs[num]=new inf(*((inf *)raw));
+    inflist[num]=1;
+  }
+  *s=tmps;
+  s->infs=infs;s->inflist=inflist;
+  return 1;
+}
+
+// Restore the run in progress, with any changes recorded after it, if
+// the state is for run r. Returns 1 if so.
+int unpackstate(const std::vector<char> &b, uint64_t hash, int r, runstate *s, int **alloutput, int totdays){
+  size_t pos=0;
+  int i, m, nlive=0, magic, rr;
+  uint64_t h;
+  runstate tmps;
+  inf **infs=s->infs;
+  int *inflist=s->inflist;
+  alignas(inf) char raw[sizeof(inf)];
+  if(!getbytes(b, &pos, &magic, sizeof(int)) || magic!=CKPTSTATEMAGIC || !getbytes(b, &pos, &h, sizeof(uint64_t)) || h!=hash || !getbytes(b, &pos, &rr, sizeof(int)) || rr!=r || !getbytes(b, &pos, &tmps, sizeof(runstate)) || tmps.day>totdays || pos+tmps.day*10*sizeof(int)+sizeof(int)>b.size())
+    return 0;
+  finishrun(s);
+  *s=tmps;
+  s->infs=infs;s->inflist=inflist;
+  for(m=0;m<s->day;m++)
+    getbytes(b, &pos, alloutput[r*totdays+m], 10*sizeof(int));
+  getbytes(b, &pos, &nlive, sizeof(int));
+  for(i=0;i<nlive;i++){
+    if(!getbytes(b, &pos, raw, sizeof(inf))){
+      fprintf(stderr, "ERROR: checkpoint state is truncated. EXITING.\n");
+      exit(0);
+    }
+    m=((inf *)raw)->num;
+    infs[m]=new inf(*((inf *)raw));
+    inflist[m]=1;
+  }
+  while(unpackdelta(b, &pos, r, s, alloutput, totdays));
+  return 1;
+}
 
-      numinfectious=0;newinfs=0;newdeaths=0;newtests=0;
-      numcurinfold=numcurinf;
-      if(herd)
-	fprintf(stderr, "herdlevel=%.4f\n", herdlevel);
+// One record per finished run
+void packrun(std::vector<char> &b, int r, const runstate *s, int **alloutput, int totdays){
+  int magic=CKPTRECMAGIC;
+  b.clear();
+  putbytes(b, &magic, sizeof(int));
+  putbytes(b, &r, sizeof(int));
+  putbytes(b, s, sizeof(runstate));//for the delay and the values in the log file
+  putbytes(b, alloutput[r*totdays], totdays*10*sizeof(int));
+}
 
-      if(haspd && ((pd_at_dth>0 && numdeaths>=pd_at_dth) || (pd_at_test>0 && numtest>=pd_at_test) || (pd_at_inf>0 && numinf>=pd_at_inf))){//physical distancing
-	pd=1;
-	pdeff=pdeff1;
+// Paired differences between two scenarios run with the same seed: run r
+// of one is paired with run r of the other. For each day and each output
+// the file gives the mean difference (alt-base), its standard error from
+// the paired differences, and the standard error if the runs were
+// independent. In common random numbers mode the paired SE is much smaller.
+void writediffs(const char fname[], int **base, int **alt, int num_runs, int totdays){
+  FILE *fd=openftowrite(fname);
+  int i, m, r;
+  double d, md, vd, ma, mb, va, vb, a, b;
+  fprintf(fd, "#day, then for each of numinf, newinfs, numcurinf, numdeaths, newdeaths, numtest, newtests, numinfectious, numsero: mean difference, paired SE, unpaired SE\n");
+  for(m=0;m<totdays;m++){
+    fprintf(fd, "%d", m);
+    for(i=1;i<10;i++){
+      md=0;ma=0;mb=0;
+      for(r=0;r<num_runs;r++){
+	a=alt[r*totdays+m][i];b=base[r*totdays+m][i];
+	md+=a-b;ma+=a;mb+=b;
       }
-      else
-	pd=0;
-
-      if(haslockdown){
-	//lockdown 2 takes precedence
-	if(haslockdown==2 && lockdownday>=lockdown2startday && lockdown2day<lockdown2len){
-	  if(lockdown2day==0){
-	    effpop=totpop;
-	    effpop*=infectible_proportion2;//effective infectible population drops
-	    fprintf(stderr, "Lockdown 2 starts. Effective population now %.4f.\n", effpop);
-	  }
-	  else{ 
-	    if(lockdown2day>=popleak2_start_day && lockdown2day<=popleak2_end_day)
-	      effpop+=popleak2;//leak into infectible population
-	    fprintf(stderr, "In lockdown 2. Effective population now %.4f.\n", effpop);
-	  }
-	  pd=1;
-	  pdeff=pdeff_lockdown2;//physical distancing becomes more effective  
-	  lockdown2day++;
-	}
-	else if(((lockdown_at_dth>0 && numdeaths>=lockdown_at_dth) || (lockdown_at_test>0 && numtest>=lockdown_at_test) || (lockdown_at_inf>0 && numinf>=lockdown_at_inf)) && lockdownday<lockdownlen){
-	  if(lockdownday==0){
-	    effpop*=infectible_proportion;//effective infectible population drops
-	    fprintf(stderr, "Lockdown 1 starts. Effective population now %.4f.\n", effpop);
-	  }
-	  else{ 
-	    if(lockdownday>=popleak_start_day && lockdownday<=popleak_end_day)
-	      effpop+=popleak;//leak into infectible population
-	    fprintf(stderr, "In lockdown 1. Effective population now %.4f.\n", effpop);
-	  }
-	  pd=1;
-	  pdeff=pdeff_lockdown;//physical distancing becomes more effective  
-	  lockdownday++;
-	}
-	else{//lockdown finishes. Assume physical distancing returns to early levels
-	  effpop=totpop;
-	  if(lockdownday>=lockdownlen){
-	    fprintf(stderr, "Lockdown finished. Effective population now %.4f.\n", effpop);
-	    lockdownday++;//to know when to enter lockdown2
-	  }
-	  if(haspd){
-	    pdeff=pdeff1;
-	  }
-	  
-	}
+      md/=num_runs;ma/=num_runs;mb/=num_runs;
+      vd=0;va=0;vb=0;
+      for(r=0;r<num_runs;r++){
+	a=alt[r*totdays+m][i];b=base[r*totdays+m][i];
+	d=a-b;
+	vd+=(d-md)*(d-md);va+=(a-ma)*(a-ma);vb+=(b-mb)*(b-mb);
       }
-      if(pd){
-	fprintf(stderr, "physical distancing = %.2f.\n", pdeff);
+      if(num_runs>1){
+	vd/=(num_runs-1.0);va/=(num_runs-1.0);vb/=(num_runs-1.0);
+      }
+      fprintf(fd, "\t%.2f\t%.4f\t%.4f", md, sqrt(vd/num_runs), sqrt((va+vb)/num_runs));
+    }
+    fprintf(fd, "\n");
+  }
+  fclose(fd);
+}
+
+// Running means and variances (Welford) of the target outputs
+struct adaptstate{
+  int n;
+  double mean[MAXTARGETS], m2[MAXTARGETS];
+};
+
+// add run r to the statistics
+void addadapt(adaptstate *ad, const params *p, int **alloutput, int r){
+  int k, m;
+  double x, dx;
+  ad->n++;
+  for(k=0;k<p->numtargets;k++){
+    if(p->targetday[k]>=0)
+      x=alloutput[r*p->totdays+p->targetday[k]][p->targetcol[k]];
+    else{//peak
+      x=alloutput[r*p->totdays][p->targetcol[k]];
+      for(m=1;m<p->totdays;m++){
+	if(alloutput[r*p->totdays+m][p->targetcol[k]]>x)
+	  x=alloutput[r*p->totdays+m][p->targetcol[k]];
       }
+    }
+    dx=x-ad->mean[k];
+    ad->mean[k]+=dx/ad->n;
+    ad->m2[k]+=dx*(x-ad->mean[k]);
+  }
+}
 
+// relative SE of target k
+double adaptrse(const adaptstate *ad, int k){
+  double se;
+  if(ad->n<2)
+    return HUGE_VAL;
+  se=sqrt(ad->m2[k]/(ad->n-1.0)/ad->n);
+  if(se==0)
+    return 0;
+  return se/fabs(ad->mean[k]);
+}
 
-      for(i=0;i<MAXINFS;i++){//for each infected person
-	if(inflist[i]==1){
-	  (infs[i]->age)++;//age updates at start...
-	  if(infs[i]->age==infs[i]->lastop_time){//done with
-	    die(infs[i]);//deallocate
-	    continue;
-	  }
+// enough runs?
+int adaptdone(const adaptstate *ad, const params *p){
+  int k;
+  if(p->target_rse<=0 || ad->n<p->min_runs)
+    return 0;
+  for(k=0;k<p->numtargets;k++){
+    if(adaptrse(ad, k)>p->target_rse)
+      return 0;
+  }
+  return 1;
+}
 
-	  if(infs[i]->age >= inf_start && infs[i]->age <= inf_end){//so far kept as is regardless of distribution
-	    numinfectious+=multiplier;
+// Importance splitting ("split_at_inf" lines). When a run first reaches one
+// of the infection levels it is split into split_factor copies, each with
+// an equal share of its weight. The first copy carries on as before and the
+// others get random numbers of their own. Runs which die out early are
+// never copied, so many more trajectories reach the synchronisation point
+// for the same work. Each of the number_of_runs runs gives a family of
+// trajectories of total weight 1. Copies waiting to be continued are kept
+// packed, and are continued in the order made, so trajectory numbers
+// follow the order of the output.
+struct splitcopy{
+  std::vector<char> b;//packed state and rows so far
+  int t;//trajectory number
+  double weight;
+  int level;//levels passed
+  uint64_t key;//its own random numbers
+};
+
+void runsplit(const params *p, runstate *s, uint64_t seed, const char outfilename[], const char *header, double trueR0, int **realdata, int totdata){
+  int i, j, m, r, t, k, c, ncopies, level, maxtraj=p->num_runs, numtraj=0, numsynced=0, maxwaiting=0;
+  int row[10];
+  double weight;
+  params q=*p;
+  pointout o;
+  std::vector<splitcopy> waiting;
+  size_t next;
+
+  for(k=0;k<p->numsplits;k++){
+    if((double)maxtraj*p->split_factor*p->totdays>1e8){
+      fprintf(stderr, "ERROR: too many trajectories with split_factor %d and %d levels. EXITING.\n", p->split_factor, p->numsplits);
+      exit(0);
+    }
+    maxtraj*=p->split_factor;
+  }
+  q.num_runs=maxtraj;//room for every run to reach every level
+  openpoint(&o, &q, outfilename, header, trueR0);
+  o.weights=(double *)malloc((size_t) (maxtraj*sizeof(double)));
+  o.roots=(int *)malloc((size_t) (maxtraj*sizeof(int)));
+
+  for(r=0;r<p->num_runs;r++){//each original run (run r uses random stream r)
+    startrun(p, s, seed, r);
+    t=numtraj++;weight=1.0;level=0;
+    waiting.clear();next=0;
+    while(1){
+      for(m=s->day;m<p->totdays;m++){//each day
+	stepday(p, s, row);
+	recordday(&o, t, row);
+	for(c=level;c<p->numsplits && s->numinf>=p->splitlevels[c];c++);
+	if(c>level){//split
+	  ncopies=int_pow(p->split_factor, c-level);
+	  weight/=ncopies;level=c;
+	  for(k=1;k<ncopies;k++){
+	    splitcopy cp;
+	    cp.t=numtraj++;cp.weight=weight;cp.level=level;
+	    cp.key=mix64(s->gen.key+0x9E3779B97F4A7C15ULL*(uint64_t)(cp.t+1));
+	    for(j=0;j<s->day;j++){
+	      for(i=0;i<10;i++)
+		o.alloutput[cp.t*p->totdays+j][i]=o.alloutput[t*p->totdays+j][i];
+	    }
+	    packstate(cp.b, 0, cp.t, s, o.alloutput, p->totdays);
+	    waiting.push_back(cp);
 	  }
+	  if((int)(waiting.size()-next)>maxwaiting)
+	    maxwaiting=waiting.size()-next;
+	}
+      }
+      o.weights[t]=weight;o.roots[t]=r;
+      endrun(&o, t, s, realdata, totdata);
+      numsynced+=s->syncflag;
+      finishrun(s);
+      if(next==waiting.size())
+	break;
+      //continue the next copy
+      splitcopy &cp=waiting[next++];
+      unpackstate(cp.b, 0, cp.t, s, o.alloutput, p->totdays);
+      std::vector<char>().swap(cp.b);
+      s->gen.seed(cp.key, s->gen.stream);
+      s->deathskip=-1;s->illskip=-1;//(memoryless, so can be drawn afresh)
+      emptybatches(s);//(so that the copies don't share variates)
+      for(m=0;m<s->day;m++)
+	recordday(&o, cp.t, o.alloutput[cp.t*p->totdays+m]);
+      t=cp.t;weight=cp.weight;level=cp.level;
+    }
+  }
+  fprintf(o.fd, "importance splitting: %d trajectories from %d runs, %d reached the synchronisation point (at most %d copies waiting)\n", numtraj, p->num_runs, numsynced, maxwaiting);
+  if(p->verbose)
+    fprintf(stderr, "importance splitting: %d trajectories from %d runs, %d synchronised\n", numtraj, p->num_runs, numsynced);
+  o.num_runs=numtraj;
+  closepoint(&o, realdata, totdata);
+  free((char *)o.weights);free((char *)o.roots);
+}
 
-	  if(infs[i]->age==infs[i]->sero_time){//seroconversion
-	    numsero+=multiplier;
-	    avserotime=avserotime*((double)(numsero-multiplier))/((double)(numsero))+(double)(multiplier*(infs[i])->age)/((double)(numsero));
-	  }
+// Simulate the runs for one set of parameters and write the output files.
+// Run r uses random stream r. If ck is not NULL, checkpoints are written
+// and/or resumed from.
+// If kept is not NULL the output of every run is kept there. With
+// target_rse, runs stop once the target precision has been reached.
+void runpoint(const params *p, runstate *s, uint64_t seed, const char outfilename[], const char *header, double trueR0, int **realdata, int totdata, const ckptopts *ck, pointresult *kept){
+  int m, r, r0=0, resumed=0, magic, k, ckday=-1;
+  int row[10];
+  pointout o;
+  adaptstate ad;
+  std::string runsname, statename;
+  std::vector<char> runbuf, statebuf;
+  std::thread writer;
+  uint64_t hash=0, h;
+  size_t pos, validlen, ckbase=0, ckdelta=0;
+  runstate tmps;
+  FILE *fdr=NULL;
 
-	  if(infs[i]->age==infs[i]->quardt){//quarantine?
-	    infs[i]->quar=1;
-	    numquar+=multiplier;
-	  }
+  //These parameters are relevant if we want to 
+  //run simulations upto or a certain number of days
+  //beyond a particular death trigger
+  //Currently hard-wired in, to avoid overloading parameter files
+  int topresent=0;//only simulate to a fixed day namely "presentday" days after "trigger_dths" deaths or "trigger_infs" infections
+  int trigger_dths=1;//Number of deaths which trigger the clock. Not for synchronisation
+  int trigger_infs=0;//Number of infections which trigger the clock. Not for synchronisation
+  int startinfs=0, endinfs;
+  int presentday=1;//Number of days to run after trigger
+  int startclock=0;//The clock
 
-	  if(infs[i]->age==infs[i]->testdt){//test?
-	    numtest+=multiplier;newtests+=multiplier;
-	    avtesttime=avtesttime*((double)(numtest-multiplier))/((double)(numtest))+(double)(multiplier*(infs[i])->age)/((double)(numtest));
-	  }
+  //for doubling times
+  int totdoubling=0;
+  double avdoubling=0;
+  double avinfs, avdths;//average infections and deaths at trigger point
 
-	  if(infs[i]->ill==-1 && infs[i]->age==infs[i]->dth_time){//die
-	    numdeaths+=multiplier;newdeaths+=multiplier;numcurinf-=multiplier;
-	    avdthtime=avdthtime*((double)(numdeaths-multiplier))/((double)(numdeaths))+(double)(multiplier*(infs[i])->age)/((double)(numdeaths));
-	  }
-	  else if(infs[i]->ill!=-1 && infs[i]->age==infs[i]->recov_time){//recover
-	    numcurinf-=multiplier;numrecovs+=multiplier;
-	    avrecovtime=avrecovtime*((double)(numrecovs-multiplier))/((double)(numrecovs))+(double)(multiplier*(infs[i])->age)/((double)(numrecovs));
-	  }
-	  else if(infs[i]->quar==0 && infs[i]->age<MAXAGE && (!pd|| (pd && randpercentage(100.0-pdeff)))){//still being processed, not quarantined, no physical distancing or pd not happening
-	    if(herd){herdlevel=100.0*((double)numinf/(double)effpop);}
-	    if(!herd || (herd && randpercentage(100.0-herdlevel))){
-	      //Currently all infection events on a given day for an individual either do or don't take place
-	      for(j=0;j<infs[i]->infnums[infs[i]->age];j++){
-		tmpi=create(infs, gamswtch, infshp, infscl, P, maxP, inf_gam, inf_start, inf_end, inf_mid, inf_tm_shp, &numinf, &numcurinf, &newinfs, &numill, percill, percdeath, time_to_death, dist_on_death, time_to_recovery, dist_on_recovery, time_to_sero, dist_on_sero, quardate, quarp, dist_on_quardate, testp, testdelay, testdelay_shp);//create new infecteds
-		numinf+=(multiplier-1);numcurinf+=(multiplier-1);newinfs+=(multiplier-1);
-		actualR0=actualR0*((double)(numinf-multiplier))/((double)(numinf))+(double)(multiplier*(infs[tmpi])->numtoinf)/((double)(numinf));
-		if(infs[tmpi]->ill==1)
-		  numill+=(multiplier-1);
-		//		    fprintf(fd3, "%d %d %d\n%d %d %d\n\n", m, i, i, m+1, tmpi, tmpi);
-		if(tmpi>i)//this will update to zero as they come later in the sequence
-		  infs[tmpi]->age--;
-	      }
-	    }
-	  }
+  if(p->numsplits>0){//no checkpoints, adaptive runs or paired differences
+    runsplit(p, s, seed, outfilename, header, trueR0, realdata, totdata);
+    if(kept){
+      kept->alloutput=NULL;kept->num_runs=0;
+    }
+    return;
+  }
+
+  openpoint(&o, p, outfilename, header, trueR0);
+  if(kept){
+    o.keep=1;
+    kept->alloutput=o.alloutput;
+  }
+  ad.n=0;
+  for(k=0;k<MAXTARGETS;k++){ad.mean[k]=0;ad.m2[k]=0;}
+
+  if(ck){
+    hash=hashstring(header);
+    runsname=std::string(outfilename)+"_ckpt_runs";
+    statename=std::string(outfilename)+"_ckpt_state";
+    if(ck->resume && readwholefile(runsname.c_str(), runbuf)){//finished runs
+      pos=0;
+      if(!getbytes(runbuf, &pos, &magic, sizeof(int)) || magic!=CKPTRUNSMAGIC || !getbytes(runbuf, &pos, &h, sizeof(uint64_t)) || !getbytes(runbuf, &pos, &h, sizeof(uint64_t)) || h!=hash){
+	fprintf(stderr, "ERROR: checkpoint \"%s\" was made with different options. EXITING.\n", runsname.c_str());
+	exit(0);
+      }
+      validlen=pos;
+      while(r0<p->num_runs && getbytes(runbuf, &pos, &magic, sizeof(int)) && magic==CKPTRECMAGIC && getbytes(runbuf, &pos, &r, sizeof(int)) && r==r0 && getbytes(runbuf, &pos, &tmps, sizeof(runstate)) && pos+p->totdays*10*sizeof(int)<=runbuf.size()){
+	for(m=0;m<p->totdays;m++){
+	  getbytes(runbuf, &pos, row, 10*sizeof(int));
+	  recordday(&o, r0, row);
 	}
-      }//cycled through all infected individuals
-
-      fprintf(stderr, "%d: numinf=%d, newinfs=%d, numcurinf=%d(%.2fpc), numdeaths=%d, newdeaths=%d, numtest=%d, numinfectious=%d, numsero=%d\n", m, numinf, newinfs, numcurinf, numcurinfold>=1?100.0*((double)numcurinf-(double)numcurinfold)/((double)numcurinfold):-1,numdeaths, newdeaths, numtest, numinfectious, numsero);
-      fprintf(fd1,"%d\t%d\t%d\t%d\t %d\t%d\t%d\t%d\t%d\t%d\n", m, numinf, newinfs, numcurinf, numdeaths, newdeaths, numtest,newtests,numinfectious,numsero);
-      alloutput[r*totdays+m][0]=m;alloutput[r*totdays+m][1]=numinf;
-      alloutput[r*totdays+m][2]=newinfs;alloutput[r*totdays+m][3]=numcurinf;
-      alloutput[r*totdays+m][4]=numdeaths;alloutput[r*totdays+m][5]=newdeaths;
-      alloutput[r*totdays+m][6]=numtest;alloutput[r*totdays+m][7]=newtests;
-      alloutput[r*totdays+m][8]=numinfectious;alloutput[r*totdays+m][9]=numsero;
-
-      //Setting the delays
-      if(!syncflag && ((sync_at_test>0 && numtest>=sync_at_test) || (sync_at_death>0 && numdeaths>=sync_at_death) || (sync_at_inf>0 && numinf>=sync_at_inf))){
-	delays[r]=m-sync_at_time;
-	syncflag=1;
+	endrun(&o, r0, &tmps, realdata, totdata);
+	addadapt(&ad, p, o.alloutput, r0);
+	validlen=pos;
+	r0++;
       }
+      if(truncate(runsname.c_str(), validlen)!=0)//drop any incomplete record
+	fprintf(stderr, "WARNING: could not truncate \"%s\".\n", runsname.c_str());
+      fdr=fopen(runsname.c_str(), "ab");
+      fprintf(stderr, "Resuming after %d finished runs.\n", r0);
+    }
+    else{
+      fdr=openftowrite(runsname.c_str());
+      magic=CKPTRUNSMAGIC;
+      fwrite(&magic, sizeof(int), 1, fdr);
+      fwrite(&seed, sizeof(uint64_t), 1, fdr);
+      fwrite(&hash, sizeof(uint64_t), 1, fdr);
+      fflush(fdr);
+    }
+    if(ck->resume && r0<p->num_runs && readwholefile(statename.c_str(), statebuf) && unpackstate(statebuf, hash, r0, s, o.alloutput, p->totdays)){//run in progress
+      resumed=1;
+      for(m=0;m<s->day;m++)
+	recordday(&o, r0, o.alloutput[r0*p->totdays+m]);
+      fprintf(stderr, "Resuming run %d at day %d.\n", r0, s->day);
+    }
+  }
 
-      //      fprintf(fd3, "\n");fflush(fd3);
-      fflush(fd);fflush(fd1);
+  //nest order: For each run... for each day... for each individual
+  avinfs=0.0;avdths=0.0;
+  for(r=r0;r<p->num_runs && !adaptdone(&ad, p);r++){//Each model run (run r uses random stream r)
+    startclock=0;
+    if(!resumed)
+      startrun(p, s, seed, r);
+    resumed=0;
+    ckday=-1;//start with the whole state
+    
+    for(m=s->day;m<p->totdays;m++){//each day
+      stepday(p, s, row);
+      recordday(&o, r, row);
+      if(ck && ck->every>0 && s->day%ck->every==0 && s->day<p->totdays){//checkpoint the run in progress
+	if(writer.joinable())
+	  writer.join();
+	if(ckday<0 || ckdelta>ckbase){
+	  packstate(statebuf, hash, r, s, o.alloutput, p->totdays);
+	  ckbase=statebuf.size();ckdelta=0;
+	  writer=std::thread(writeckpt, &statebuf, statename, 0);
+	}
+	else{
+	  packdelta(statebuf, ckday, r, s, o.alloutput, p->totdays);
+	  ckdelta+=statebuf.size();
+	  writer=std::thread(writeckpt, &statebuf, statename, 1);
+	}
+	ckday=s->day;
+      }
 
       //Are we running the model only to a particular moment?
       if(topresent){
 	if(trigger_infs){//triggered by infection numbers
-	  if(numinf>=trigger_infs){
-	    //printf("%d, %d: numinf=%d, numdeaths=%d, \n", r, m, numinf, numdeaths);
+	  if(s->numinf>=trigger_infs){
 	    if(startclock==0)
-	      startinfs=numinf;
+	      startinfs=s->numinf;
 	    startclock++;
 	  }
-	  if(startclock==presentday+1){
-	    //printf("%d, %d: numinf=%d, numdeaths=%d, \n", r, m, numinf, numdeaths);
-	    endinfs=numinf;
-	    printf("model run %d: %d %d %d\n", r, startinfs, endinfs, presentday);
-	    if(presentday>0 && endinfs-startinfs!=0){
-	      printf("doubling=%.4f\n", log(2.0)*(presentday)/(log(endinfs)-log(startinfs)));
-	      totdoubling++; avdoubling+=log(2.0)*(presentday)/(log(endinfs)-log(startinfs));
-	    }
-	    avinfs+=numinf;avdths+=numdeaths;
-	    break;
-	  }
 	}
 	else{
-	  if(numdeaths>=trigger_dths){
+	  if(s->numdeaths>=trigger_dths){
 	    if(startclock==0)
-	      startinfs=numinf;
+	      startinfs=s->numinf;
 	    startclock++;
 	  }
-	  
-	  if(startclock==presentday+1){
-	    endinfs=numinf;
-	    printf("model run %d: %d %d %d\n", r, startinfs, endinfs, presentday);
-	    if(presentday>0 && endinfs-startinfs!=0){
-	      printf("doubling=%.4f\n", log(2.0)*(presentday)/(log(endinfs)-log(startinfs)));
-	      totdoubling++; avdoubling+=log(2.0)*(presentday)/(log(endinfs)-log(startinfs));
-	    }
-	    avinfs+=numinf;avdths+=numdeaths;
-	    break;
+	}
+	if(startclock==presentday+1){
+	  endinfs=s->numinf;
+	  printf("model run %d: %d %d %d\n", r, startinfs, endinfs, presentday);
+	  if(presentday>0 && endinfs-startinfs!=0){
+	    printf("doubling=%.4f\n", log(2.0)*(presentday)/(log(endinfs)-log(startinfs)));
+	    totdoubling++; avdoubling+=log(2.0)*(presentday)/(log(endinfs)-log(startinfs));
 	  }
+	  avinfs+=s->numinf;avdths+=s->numdeaths;
+	  break;
 	}
       }
-      if(syncflag)
-	syncclock++;// counts days since synchronisation event
     }
-    if(!syncflag){//synchronisation point never reached (died out?)
-      delays[r]=0;
-      syncflag=1;
+    endrun(&o, r, s, realdata, totdata);
+    addadapt(&ad, p, o.alloutput, r);
+    if(ck){
+      if(writer.joinable())
+	writer.join();
+      packrun(runbuf, r, s, o.alloutput, p->totdays);
+      fwrite(&runbuf[0], 1, runbuf.size(), fdr);
+      fflush(fdr);
+      writer=std::thread(syncckpt, fileno(fdr));
     }
+    finishrun(s);
+  }
+  if(p->target_rse>0){//report the precision reached
+    fprintf(o.fd, "adaptive: %d runs (min %d, max %d), target relative SE %.4f\n", r, p->min_runs, p->num_runs, p->target_rse);
+    for(k=0;k<p->numtargets;k++)
+      fprintf(o.fd, "%s%s day %d: mean %.4f, relative SE %.4f\n", p->targetday[k]<0?"peak_":"", colnames[p->targetcol[k]], p->targetday[k], ad.mean[k], adaptrse(&ad, k));
+    if(!adaptdone(&ad, p))
+      fprintf(o.fd, "adaptive: target not reached within %d runs\n", p->num_runs);
+    if(p->verbose)
+      fprintf(stderr, "adaptive: %s after %d runs\n", adaptdone(&ad, p)?"target reached":"target not reached", r);
+    o.num_runs=r;
+  }
+  if(kept)
+    kept->num_runs=o.num_runs;
+  closepoint(&o, realdata, totdata);
+  if(ck){//finished: the checkpoints are no longer needed
+    if(writer.joinable())
+      writer.join();
+    fclose(fdr);
+    remove(runsname.c_str());
+    remove(statename.c_str());
+  }
 
-    //Only output to synchronisation file if there is a data file and synchronisation point reached and positive delay
-    if(delays[r]>0){
-      for(m=0;m<totdays-delays[r];m++){
-	for(i=0;i<10;i++)
-	  fprintf(fd7, "%d\t", alloutput[r*totdays+m+delays[r]][i]);
-	if(m<totdata){
-	  for(i=0;i<3;i++)
-	    fprintf(fd7, "%d\t", realdata[m][i]);
-	}
-	else{
-	  for(i=0;i<3;i++)
-	    fprintf(fd7, "?\t");
-	}
-	fprintf(fd7, "\n");
+  if(topresent){
+    if(totdoubling>0)
+      printf("avinfs=%.4f, avdeaths=%.4f, av. doubling time=%.4f\n", avinfs/((double)p->num_runs), avdths/((double)p->num_runs),avdoubling/((double)totdoubling));
+    else
+      printf("avinfs=%.4f, avdeaths=%.4f\n", avinfs/((double)p->num_runs), avdths/((double)p->num_runs));
+  }
+
+}
+
+
+// Read the parameters (with the current overrides) and record the options
+// used in a string, as they would appear at the top of the output file.
+char *readheader(char *paramfilename, params *p, uint64_t seed){
+  char *header=NULL;
+  size_t len=0;
+  FILE *mf=open_memstream(&header, &len);
+  readparams(paramfilename, p, mf);
+  fprintf(mf, "#seed %d\n", (int)seed);
+  fclose(mf);
+  return header;
+}
+
+//
+// Scenario branching
+//
+
+#define MAXFORKS 100
+#define MAXSWEEPDIMS 10//also the maximum number of "fork" lines
+
+// Has the point at which the runs fork been reached?
+int forkreached(const runstate *s, int fork_at_day, int fork_at_inf, int fork_at_dth, int fork_at_test){
+  return (fork_at_day>=0 && s->day>=fork_at_day) || (fork_at_inf>0 && s->numinf>=fork_at_inf) || (fork_at_dth>0 && s->numdeaths>=fork_at_dth) || (fork_at_test>0 && s->numtest>=fork_at_test);
+}
+
+// Each run is simulated with the parameters p until the fork point (a day,
+// or a number of infections, deaths or tests), and its state is then
+// continued once with each of the nb sets of parameters in branches. The
+// part before the fork is simulated only once. All branches continue from
+// the same point of the random number stream. Branch k is written under
+// outfilenames[k].
+void runforks(const params *p, const params *branches, int nb, uint64_t seed, int fork_at_day, int fork_at_inf, int fork_at_dth, int fork_at_test, char outfilenames[][300], char **headers, double *trueR0s, int **realdata, int totdata){
+  int k, m, r;
+  int row[10];
+  std::vector<pointout> o(nb);
+  std::vector<int> prefix;
+  runstate s, cur;
+  runstate *sk;
+  char endfname[306];
+
+  allocstate(&s);allocstate(&cur);
+  for(k=0;k<nb;k++)
+    openpoint(&o[k], &branches[k], outfilenames[k], headers[k], trueR0s[k]);
+
+  for(r=0;r<p->num_runs;r++){
+    startrun(p, &s, seed, r);
+    prefix.clear();
+    while(s.day<p->totdays && !forkreached(&s, fork_at_day, fork_at_inf, fork_at_dth, fork_at_test)){
+      stepday(p, &s, row);
+      prefix.insert(prefix.end(), row, row+10);
+    }
+    if(p->verbose)
+      fprintf(stderr, "run %d forks at day %d\n", r, s.day);
+    for(k=0;k<nb;k++){
+      for(m=0;m<(int)prefix.size()/10;m++)
+	recordday(&o[k], r, &prefix[10*m]);
+      if(k<nb-1){//the last branch can continue from the snapshot itself
+	copystate(&s, &cur);
+	sk=&cur;
+      }
+      else
+	sk=&s;
+      adoptpolicy(&branches[k], sk);
+      while(sk->day<p->totdays){
+	stepday(&branches[k], sk, row);
+	recordday(&o[k], r, row);
       }
-      fprintf(fd7, "\n");
-      fflush(fd7);
+      endrun(&o[k], r, sk, realdata, totdata);
+      finishrun(sk);
     }
+  }
+  for(k=0;k<nb;k++){
+    o[k].keep=1;
+    closepoint(&o[k], realdata, totdata);
+  }
+  for(k=1;k<nb;k++){//paired differences from the first branch
+    sprintf(endfname, "%s_diff", outfilenames[k]);
+    writediffs(endfname, o[0].alloutput, o[k].alloutput, p->num_runs, p->totdays);
+  }
+  for(k=0;k<nb;k++)
+    free_imatrix(o[k].alloutput, 0, p->num_runs*p->totdays-1, 0, 9);
+  freestate(&s);freestate(&cur);
+}
+
 
-    fprintf(fd1,"\n");
-    for(i=0;i<MAXINFS;i++){//free memory
-      if(inflist[i]==1)
-	die(infs[i]);//deallocate (numcurinf will get reset anyway)
+// Set up the branches from the lines "fork <name> <v1> ... <vn>" (branch
+// k uses the kth value of every line) and run them. Branch k is written
+// under "<outfilename>_<k>", and "<outfilename>_fork" lists the branches.
+void runforkfile(char *paramfilename, char *outfilename, const params *p, uint64_t seed, int **realdata, int totdata){
+  char flines[MAXSWEEPDIMS][200], names[MAXSWEEPDIMS][50], tempword[200];
+  char (*outfilenames)[300];
+  char **headers;
+  double *trueR0s;
+  params *branches;
+  int nlines, nb=-1, n, k, j;
+  int fork_at_day, fork_at_inf, fork_at_dth, fork_at_test;
+  char endfname[306];
+  FILE *fdf;
+
+  nlines=getoptionlines(paramfilename, "fork", flines, MAXSWEEPDIMS);
+  for(k=0;k<nlines;k++){
+    getnthblock(flines[k], names[k], 50, 2);
+    n=0;
+    while(n<MAXFORKS){
+      getnthblock(flines[k], tempword, 50, n+3);
+      if(tempword[0]=='\0' || tempword[0]=='/')
+	break;
+      n++;
     }
-    fprintf(fd, "%d\t%.4f\t%.4f\t%.4f\t%.4f\t%.4f\n", r+1, actualR0, avdthtime, avrecovtime, avtesttime, avserotime);
+    if(nb>=0 && n!=nb){
+      fprintf(stderr, "ERROR: every \"fork\" line must give the same number of values. EXITING.\n");
+      exit(0);
+    }
+    nb=n;
   }
-
-  totsims=0;
-  maxdel=0;
-  for(r=0;r<num_runs;r++){
-    if(delays[r]>0){
-      totsims++;
-      if(delays[r]>maxdel){maxdel=delays[r];}
+  if(nb<=0){
+    fprintf(stderr, "ERROR: no values on the \"fork\" lines. EXITING.\n");
+    exit(0);
+  }
+  fork_at_day=getoptioni(paramfilename, "fork_at_day", -1, NULL);
+  fork_at_inf=getoptioni(paramfilename, "fork_at_inf", -1, NULL);
+  fork_at_dth=getoptioni(paramfilename, "fork_at_dth", -1, NULL);
+  fork_at_test=getoptioni(paramfilename, "fork_at_test", -1, NULL);
+  if(fork_at_day<0 && fork_at_inf<=0 && fork_at_dth<=0 && fork_at_test<=0)
+    fork_at_day=0;//no shared part
+
+  outfilenames=(char (*)[300])malloc((size_t) (nb*sizeof(*outfilenames)));
+  headers=(char **)malloc((size_t) (nb*sizeof(char*)));
+  trueR0s=(double *)malloc((size_t) (nb*sizeof(double)));
+  branches=(params *)malloc((size_t) (nb*sizeof(params)));
+
+  strcpy(endfname, outfilename);strcat(endfname, "_fork");
+  fdf=openftowrite(endfname);
+  fprintf(fdf, "#fork_at_day %d fork_at_inf %d fork_at_dth %d fork_at_test %d\n", fork_at_day, fork_at_inf, fork_at_dth, fork_at_test);
+  fprintf(fdf, "#output");
+  for(k=0;k<nlines;k++)
+    fprintf(fdf, "\t%s", names[k]);
+  fprintf(fdf, "\n");
+  optwarn=0;
+  for(j=0;j<nb;j++){
+    numoverrides=0;
+    sprintf(outfilenames[j], "%s_%d", outfilename, j);
+    fprintf(fdf, "%s", outfilenames[j]);
+    for(k=0;k<nlines;k++){
+      getnthblock(flines[k], tempword, 50, j+3);
+      setoverride(names[k], atof(tempword));
+      fprintf(fdf, "\t%s", overrides[numoverrides-1].val);
     }
+    fprintf(fdf, "\n");
+    headers[j]=readheader(paramfilename, &branches[j], seed);
+    setupparams(&branches[j]);
+    branches[j].num_runs=p->num_runs;branches[j].totdays=p->totdays;//fixed by the shared part
+    branches[j].verbose=p->verbose;
+    trueR0s[j]=gettrueR0(&branches[j]);
   }
-  //only output to average file if there is a data file and synchronisation point reached and positive delay
+  numoverrides=0;
+  fclose(fdf);
 
-  for(m=0;m<totdays-maxdel;m++){
-    for(i=0;i<10;i++){//average values
-      avoutput[m][i]=0;
-      for(r=0;r<num_runs;r++){
-	if((totsims>0 && delays[r]>0) || totsims==0)
-	  avoutput[m][i]+=alloutput[r*totdays+m+delays[r]][i];
+  runforks(p, branches, nb, seed, fork_at_day, fork_at_inf, fork_at_dth, fork_at_test, outfilenames, headers, trueR0s, realdata, totdata);
+
+  for(j=0;j<nb;j++){
+    free(headers[j]);
+    freeparams(&branches[j]);
+  }
+  free((char *) outfilenames);free((char *) headers);free((char *) trueR0s);free((char *) branches);
+}
+
+
+//
+// Parameter sweeps
+//
+
+#define MAXSWEEPVALS 100
+
+// One point of a sweep, set up by the main thread
+struct sweeppoint{
+  char outfilename[300];
+  char *header;//options used, for the output file
+  params p;
+  double trueR0;
+  pointresult res;//kept for paired differences
+};
+
+struct sweepbatch{
+  std::vector<sweeppoint> *pts;
+  std::atomic<int> next;//next point to be taken
+  uint64_t seed;
+  int **realdata;
+  int totdata;
+};
+
+// each thread reuses its own population store for all its points
+void sweepworker(sweepbatch *b){
+  runstate s;
+  int j;
+  allocstate(&s);
+  while((j=b->next++)<(int)b->pts->size()){
+    sweeppoint &pt=(*b->pts)[j];
+    runpoint(&pt.p, &s, b->seed, pt.outfilename, pt.header, pt.trueR0, b->realdata, b->totdata, NULL, &pt.res);
+    fprintf(stderr, "sweep: finished %s\n", pt.outfilename);
+  }
+  freestate(&s);
+}
+
+// Run every point of a sweep. Either a grid, given by one or more lines
+// "sweep <name> <v1> <v2> ..." with outputs "<outfilename>_<i1>_<i2>...",
+// or a list of points in the file named by "sweeplist", whose first line
+// gives the parameter names and each later line one point, with outputs
+// "<outfilename>_<n>". Names may be written "name:2" for the second value
+// on a line. "<outfilename>_sweep" lists the points.
+void runsweep(char *paramfilename, char *outfilename, uint64_t seed, int numthreads, int **realdata, int totdata){
+  char slines[MAXSWEEPDIMS][200], tempword[200], listfname[200], oneline[1000];
+  char names[MAXSWEEPDIMS][50];
+  double vals[MAXSWEEPDIMS][MAXSWEEPVALS];
+  int nvals[MAXSWEEPDIMS], idx[MAXSWEEPDIMS];
+  int ndims, i, k, numpts;
+  std::vector<double> listvals;
+  std::vector<sweeppoint> pts;
+  std::vector<std::thread> workers;
+  sweepbatch b;
+  FILE *fdl, *fds;
+  char endfname[306];
+
+  ndims=getoptionlines(paramfilename, "sweep", slines, MAXSWEEPDIMS);
+  if(ndims>0){//grid
+    numpts=1;
+    for(k=0;k<ndims;k++){
+      getnthblock(slines[k], names[k], 50, 2);
+      nvals[k]=0;
+      while(nvals[k]<MAXSWEEPVALS){
+	getnthblock(slines[k], tempword, 50, nvals[k]+3);
+	if(tempword[0]=='\0' || tempword[0]=='/')
+	  break;
+	vals[k][nvals[k]++]=atof(tempword);
       }
-      if(totsims>0)
-	avoutput[m][i]/=totsims;
-      else
-	avoutput[m][i]/=num_runs;
-      fprintf(fd5, "%.1f\t", avoutput[m][i]);
-     
-    }
-    for(i=0;i<10;i++){//standard errors
-      tmpSD=0.0;
-      for(r=0;r<num_runs;r++){
-	if((totsims>0 && delays[r]>0) || totsims==0)
-	  tmpSD+=(alloutput[r*totdays+m+delays[r]][i]-avoutput[m][i])*(alloutput[r*totdays+m+delays[r]][i]-avoutput[m][i]);
+      if(nvals[k]==0){
+	fprintf(stderr, "ERROR: no values given for sweep parameter %s. EXITING.\n", names[k]);
+	exit(0);
       }
-      if(totsims>1){
-	tmpSD/=((double)totsims-1.0);//population SD
-	SEoutput[m][i]=sqrt(tmpSD/(double)totsims);//SE
-      }      
-      else if(num_runs>1){
-	tmpSD/=((double)num_runs-1.0);
-	SEoutput[m][i]=sqrt(tmpSD/(double)num_runs);
+      numpts*=nvals[k];
+    }
+  }
+  else{//list
+    getoption(paramfilename, "sweeplist", 1, listfname, 200);
+    fdl=openftoread(listfname);
+    ndims=0;numpts=0;
+    while(getline(fdl, oneline, 1000) > 0){
+      if ((oneline[0] == '#') || (oneline[0] == '/') || (oneline[0] == '\n') || (oneline[0] == '\0')){} // comment/empty lines
+      else if(ndims==0){//names
+	while(ndims<MAXSWEEPDIMS){
+	  getnthblock(oneline, names[ndims], 50, ndims+1);
+	  if(names[ndims][0]=='\0')
+	    break;
+	  ndims++;
+	}
       }
       else{
-	SEoutput[m][i]=0.0;
+	for(k=0;k<ndims;k++){
+	  getnthblock(oneline, tempword, 50, k+1);
+	  listvals.push_back(atof(tempword));
+	}
+	numpts++;
       }
-      fprintf(fd5, "%.4f\t", SEoutput[m][i]);
     }
+    fclose(fdl);
+    if(ndims==0 || numpts==0){
+      fprintf(stderr, "ERROR: no parameters or points in sweep list file \"%s\". EXITING.\n", listfname);
+      exit(0);
+    }
+  }
 
-    if(m<totdata){//output data from the datafile too
-      for(i=0;i<3;i++)
-	fprintf(fd5, "%d\t", realdata[m][i]);
+  strcpy(endfname, outfilename);strcat(endfname, "_sweep");
+  fds=openftowrite(endfname);
+  fprintf(fds, "#output");
+  for(k=0;k<ndims;k++)
+    fprintf(fds, "\t%s", names[k]);
+  fprintf(fds, "\n");
+
+  // set up all the points (overrides are global, so this is not threaded)
+  optwarn=0;
+  pts.resize(numpts);
+  for(k=0;k<ndims;k++)
+    idx[k]=0;
+  for(i=0;i<numpts;i++){
+    numoverrides=0;
+    strcpy(pts[i].outfilename, outfilename);
+    if(listvals.size()){
+      for(k=0;k<ndims;k++)
+	setoverride(names[k], listvals[i*ndims+k]);
+      sprintf(tempword, "_%d", i);strcat(pts[i].outfilename, tempword);
     }
     else{
-      for(i=0;i<3;i++)
-	fprintf(fd5, "?\t");
-    }
-    fprintf(fd5, "\n");
-
-    for(r=0;r<num_runs;r++){//grouped sync file
-      fprintf(fd6, "%d\t", m);
-      for(i=1;i<10;i++){
-	if((totsims>0 && delays[r]>0) || totsims==0)
-	  fprintf(fd6, "%d\t", alloutput[r*totdays+m+delays[r]][i]);
-	else
-	  fprintf(fd6, "0\t");
-      }
-      if(m<totdata){//output data from the datafile too
-	for(i=0;i<3;i++)
-	  fprintf(fd6, "%d\t", realdata[m][i]);
+      for(k=0;k<ndims;k++){
+	setoverride(names[k], vals[k][idx[k]]);
+	sprintf(tempword, "_%d", idx[k]);strcat(pts[i].outfilename, tempword);
       }
-      else{
-	for(i=0;i<3;i++)
-	  fprintf(fd6, "?\t");
+      for(k=ndims-1;k>=0;k--){//next grid point (last parameter fastest)
+	if(++idx[k]<nvals[k])
+	  break;
+	idx[k]=0;
       }
-      fprintf(fd6, "\n");
     }
-    fprintf(fd6, "%d\t", m);
-    for(i=1;i<10;i++)
-      fprintf(fd6, "%.1f\t", avoutput[m][i]);
-
-    if(m<totdata){//death undercount, mean + 95%CI
-      fprintf(fd6, "%.4f\t", 100.0*(avoutput[m][4]-realdata[m][1])/avoutput[m][4]);
-      fprintf(fd6, "%.4f\t", 100.0*((avoutput[m][4]-1.96*SEoutput[m][4])-realdata[m][1])/(avoutput[m][4]-1.96*SEoutput[m][4]));
-      fprintf(fd6, "%.4f\t", 100.0*((avoutput[m][4]+1.96*SEoutput[m][4])-realdata[m][1])/(avoutput[m][4]+1.96*SEoutput[m][4]));
+    fprintf(fds, "%s", pts[i].outfilename);
+    for(k=0;k<numoverrides;k++)
+      fprintf(fds, "\t%s", overrides[k].val);
+    fprintf(fds, "\n");
+    pts[i].header=readheader(paramfilename, &(pts[i].p), seed);
+    setupparams(&(pts[i].p));
+    pts[i].trueR0=gettrueR0(&(pts[i].p));
+  }
+  numoverrides=0;
+  fclose(fds);
+
+  b.pts=&pts;b.next=0;b.seed=seed;b.realdata=realdata;b.totdata=totdata;
+  if(numthreads>numpts)
+    numthreads=numpts;
+  for(k=1;k<numthreads;k++)
+    workers.push_back(std::thread(sweepworker, &b));
+  sweepworker(&b);
+  for(k=0;k<(int)workers.size();k++)
+    workers[k].join();
+
+  for(i=1;i<numpts;i++){//paired differences from the first point
+    if(pts[i].p.totdays==pts[0].p.totdays && pts[0].res.alloutput && pts[i].res.alloutput){//(paired up to the smaller number of runs)
+      strcpy(endfname, pts[i].outfilename);strcat(endfname, "_diff");
+      writediffs(endfname, pts[0].res.alloutput, pts[i].res.alloutput, pts[i].res.num_runs<pts[0].res.num_runs?pts[i].res.num_runs:pts[0].res.num_runs, pts[0].p.totdays);
     }
+  }
+  for(i=0;i<numpts;i++){
+    if(pts[i].res.alloutput)
+      free_imatrix(pts[i].res.alloutput, 0, pts[i].p.num_runs*pts[i].p.totdays-1, 0, 9);
+    free(pts[i].header);
+    freeparams(&(pts[i].p));
+  }
+}
 
-    fprintf(fd6, "\n");
 
-    fprintf(fd6, "%d\t", m);
-    for(i=1;i<10;i++)
-      fprintf(fd6, "%.4f\t", SEoutput[m][i]);
+// The command line program (left out when the engine is compiled as a
+// library: see covidagent.cc)
+#ifndef INF2_LIBRARY
+int main(int argc, char *argv[]){
+  int timeint;
+  time_t timepoint;
+  double trueR0;
+  params p;
+  runstate s;
+  uint64_t seed;
+  int abc, sweep, branch, numthreads;
+  char paramfilename[200], outfilename[200], endfname[206], logfname[204], datafilename[200], tempword[200];
+  char onelines[1][200];
+  char *header;
+  FILE *fd, *fd1;
+  abcdata dat;
+  ckptopts ck;
 
-    if(m<totdata){//case undercount, mean + 95%CI
-      fprintf(fd6, "%.4f\t", 100.0*(avoutput[m][6]-realdata[m][0])/avoutput[m][6]);
-      fprintf(fd6, "%.4f\t", 100.0*((avoutput[m][6]-1.96*SEoutput[m][6])-realdata[m][0])/(avoutput[m][6]-1.96*SEoutput[m][6]));
-      fprintf(fd6, "%.4f\t", 100.0*((avoutput[m][6]+1.96*SEoutput[m][6])-realdata[m][0])/(avoutput[m][6]+1.96*SEoutput[m][6]));
-    }
-    fprintf(fd6, "\n\n");
+  //data file
+  int maxdat=1000, totdata=0;
+  int **realdata=imatrix(0, maxdat-1, 0, 2);
 
+
+  if(argc < 2){
+    fprintf(stderr, "ERROR: you must provide a parameter file name. You may also provide an output file name.\n");
+    exit(0);
   }
+  strncpy (paramfilename, argv[1], sizeof(paramfilename));
+  if(argc>=3)
+    strncpy (outfilename, argv[2], sizeof(outfilename));
+  else
+    strcpy(outfilename, "data1/tmp");//default output file
 
-  for(m=totdays-maxdel;m<totdays;m++){
-    for(i=0;i<10;i++){
-      avoutput[m][i]=-1;
-      fprintf(fd5, "%.1f\t", avoutput[m][i]);
-    }
-    for(i=0;i<10;i++){
-      SEoutput[m][i]=0;
-      fprintf(fd5, "%.1f\t", SEoutput[m][i]);
-    }
-    for(i=0;i<3;i++)
-      fprintf(fd5, "?\t");
-    fprintf(fd5, "\n");
+  //random seeding: the same seed gives the same results
+  timeint = time(&timepoint); /*convert time to an integer */
+  seed=(uint64_t)getoptioni(paramfilename, "seed", timeint, NULL);
+  //checkpointing
+  ck.every=getoptioni(paramfilename, "checkpoint_every", 0, NULL);
+  ck.resume=getoptioni(paramfilename, "resume", 0, NULL);
+  if(ck.resume && getoption(paramfilename, "seed", 1, tempword, 200)!=0)//use the seed of the checkpointed run
+    readckptseed(outfilename, &seed);
+  header=readheader(paramfilename, &p, seed);
+
+  if (getoption(paramfilename, "datafile", 1, datafilename, 200)==0){
+    totdata=readDataFile(datafilename, realdata, maxdat);
   }
 
-  if(topresent){
-    if(totdoubling>0)
-      printf("avinfs=%.4f, avdeaths=%.4f, av. doubling time=%.4f\n", avinfs/((double)num_runs), avdths/((double)num_runs),avdoubling/((double)totdoubling));
-    else
-      printf("avinfs=%.4f, avdeaths=%.4f\n", avinfs/((double)num_runs), avdths/((double)num_runs));
+  abc=getoptioni(paramfilename, "abc", 0, NULL);//calibrate by ABC-SMC instead?
+  sweep=(getoptionlines(paramfilename, "sweep", onelines, 1)>0 || getoption(paramfilename, "sweeplist", 1, tempword, 200)==0);//run a sweep?
+  branch=(getoptionlines(paramfilename, "fork", onelines, 1)>0);//fork the runs into branches?
+  if(abc || sweep){
+    numthreads=getoptioni(paramfilename, "threads", 1, NULL);
+    if(numthreads<1)
+      numthreads=1;
   }
 
+  if(abc){
+    FILE *fdabc;
+    if(totdata==0 || p.sync_at_time<0 || (p.sync_at_test<=0 && p.sync_at_death<=0 && p.sync_at_inf<=0)){
+      fprintf(stderr, "ERROR: ABC calibration needs a datafile, sync_at_time, and one of sync_at_test, sync_at_death or sync_at_inf. EXITING.\n");
+      exit(0);
+    }
+    fd1=openftowrite(outfilename);
+    fputs(header, fd1);
+    fprintf(fd1, "#threads %d\n", numthreads);
+    strcpy(logfname, outfilename);strcat(logfname, "_log");
+    fd=openftowrite(logfname); //log file
+    dat.realdata=realdata;dat.totdata=totdata;
+    dat.wcases=getoptionf(paramfilename, "abc_weight_cases", 1, fd1);
+    dat.wdeaths=getoptionf(paramfilename, "abc_weight_deaths", 1, fd1);
+    dat.abandon_at_inf=getoptioni(paramfilename, "abandon_at_inf", -1, fd1);
+    strcpy(endfname, outfilename);strcat(endfname, "_abc");
+    fdabc=openftowrite(endfname);
+    optwarn=0;//particles re-read the parameter file
+    runabc(paramfilename, &dat, seed, numthreads, fd, fdabc);
+    fclose(fdabc);fclose(fd);fclose(fd1);
+  }
+  else if(sweep)
+    runsweep(paramfilename, outfilename, seed, numthreads, realdata, totdata);
+  else if(branch){
+    setupparams(&p);
+    p.verbose=1;
+    runforkfile(paramfilename, outfilename, &p, seed, realdata, totdata);
+    freeparams(&p);
+  }
+  else{
+    setupparams(&p);
+    p.verbose=1;
+    trueR0=gettrueR0(&p);
+    allocstate(&s);
+    runpoint(&p, &s, seed, outfilename, header, trueR0, realdata, totdata, &ck, NULL);
+    freestate(&s);
+    freeparams(&p);
+  }
 
-  free_infar(infs, 0, MAXINFS-1);
-  free((char *) P);//fclose(fd3);
-  fclose(fd);fclose(fd1);fclose(fd5);fclose(fd6);fclose(fd7);
-  free_imatrix(alloutput, 0, num_runs*totdays-1, 0, 9);
-  free_dmatrix(avoutput, 0, totdays-1, 0, 9);
-  free_dmatrix(SEoutput, 0, totdays-1, 0, 9);
+  free(header);
   free_imatrix(realdata, 0, maxdat-1, 0, 2);
-  free((char*)delays);
   return 0;
 }
-
+#endif
@@ -0,0 +1,143 @@
+/* Copyright (C) 2021, Murad Banaji
+ *
+ * This file is part of COVIDAGENT
+ *
+ * COVIDAGENT is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3,
+ * or (at your option) any later version.
+ *
+ * COVIDAGENT is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with COVIDAGENT: see the file COPYING.  If not, see
+ * <https://www.gnu.org/licenses/>
+
+ */
+
+// Streaming quantile estimation: the merging t-digest of T. Dunning and
+// O. Ertl ("Computing extremely accurate quantiles using t-digests", 2019).
+//
+// Values (optionally weighted) are added one at a time; memory stays
+// bounded at a few times "compression" centroids. Quantiles near 0 and 1
+// are the most accurate. Two digests can be merged, so each thread can
+// keep its own and combine them at the end.
+
+#ifndef TDIGEST_H
+#define TDIGEST_H
+
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <utility>
+
+class tdigest{
+
+ public:
+  double compression;
+  std::vector<std::pair<double, double> > cent;//centroids (mean, weight) sorted by mean
+  std::vector<std::pair<double, double> > buf;//values not yet merged
+  double totw;//total weight (including buf)
+  double minv, maxv;
+  double sum;//for the mean
+
+  tdigest(double comp=100.0){
+    compression=comp;totw=0;sum=0;minv=HUGE_VAL;maxv=-HUGE_VAL;
+  }
+
+  void add(double x, double w=1.0){
+    if(!(w>0) || x!=x)//ignore zero weights and NaNs
+      return;
+    buf.push_back(std::make_pair(x, w));
+    totw+=w;sum+=w*x;
+    if(x<minv) minv=x;
+    if(x>maxv) maxv=x;
+    if(buf.size()>=(size_t)(5*compression))
+      compress();
+  }
+
+  // Add all the values summarised in another digest
+  void merge(const tdigest &o){
+    size_t i;
+    for(i=0;i<o.cent.size();i++)
+      buf.push_back(o.cent[i]);
+    for(i=0;i<o.buf.size();i++)
+      buf.push_back(o.buf[i]);
+    totw+=o.totw;sum+=o.sum;
+    if(o.minv<minv) minv=o.minv;
+    if(o.maxv>maxv) maxv=o.maxv;
+    compress();
+  }
+
+  // scale function k1: centroids are small near q=0 and q=1
+  double kscale(double q) const{
+    return compression/(2.0*M_PI)*asin(2.0*q-1.0);
+  }
+
+  void compress(){
+    std::vector<std::pair<double, double> > all, out;
+    double wsofar=0, kleft, w, m;
+    size_t i;
+    if(buf.empty())
+      return;
+    all.reserve(cent.size()+buf.size());
+    all.insert(all.end(), cent.begin(), cent.end());
+    all.insert(all.end(), buf.begin(), buf.end());
+    buf.clear();
+    std::sort(all.begin(), all.end());
+    out.reserve(all.size());
+    m=all[0].first;w=all[0].second;
+    kleft=kscale(0.0);
+    for(i=1;i<all.size();i++){
+      if(kscale((wsofar+w+all[i].second)/totw)-kleft<=1.0){//absorb into current centroid
+        m+=(all[i].first-m)*all[i].second/(w+all[i].second);
+        w+=all[i].second;
+      }
+      else{
+        out.push_back(std::make_pair(m, w));
+        wsofar+=w;
+        kleft=kscale(wsofar/totw);
+        m=all[i].first;w=all[i].second;
+      }
+    }
+    out.push_back(std::make_pair(m, w));
+    cent.swap(out);
+  }
+
+  double mean(){
+    return totw>0?sum/totw:NAN;
+  }
+
+  // Estimate the q-quantile (0<=q<=1)
+  double quantile(double q){
+    double idx, cum=0, left, right;
+    size_t i, n;
+    compress();
+    n=cent.size();
+    if(n==0)
+      return NAN;
+    if(n==1 || q<=0)
+      return q<=0?minv:cent[0].first;
+    if(q>=1)
+      return maxv;
+    idx=q*totw;
+    if(idx<cent[0].second/2.0)//between the minimum and the first centroid
+      return minv+(cent[0].first-minv)*idx/(cent[0].second/2.0);
+    for(i=0;i<n-1;i++){
+      left=cum+cent[i].second/2.0;
+      right=cum+cent[i].second+cent[i+1].second/2.0;
+      if(idx<right)
+        return cent[i].first+(cent[i+1].first-cent[i].first)*(idx-left)/(right-left);
+      cum+=cent[i].second;
+    }
+    //between the last centroid and the maximum
+    left=totw-cent[n-1].second/2.0;
+    return cent[n-1].first+(maxv-cent[n-1].first)*(idx-left)/(totw-left);
+  }
+
+};
+
+#endif